@@ -2,12 +2,19 @@
 #include "config.h"
 #include "main.h"
 #include "esp32_ota/ota_from_spiffs.h"
+#include "rp2040_flasher/image_source.h"
+#include "rp2040_flasher/firmware_cache.h"
+#include "rp2040_flasher/flash_targets.h"
+#include "rp2040_flasher/flash_metrics.h"
+#include "rp2040_flasher/crc32.h"
+#include "rp2040_flasher/staging_writer.h"
+
+#define ALIGN_UP(val, align) (((val) + ((align) - 1)) & ~((align) - 1))
 
 extern Uploader* uploader;
 
 static BleUpload* gBle = nullptr;
 
-static QueueHandle_t s_bleRxQ = nullptr;
 static TaskHandle_t  s_writerTask = nullptr;
 
 
@@ -15,6 +22,7 @@ static TaskHandle_t  s_writerTask = nullptr;
 class ServerCallbacks : public NimBLEServerCallbacks {
   void onConnect(NimBLEServer* s) override {
     if (gBle) gBle->notifyClients("log:Client BLE connecté.");
+    if (gBle) gBle->setPeerMtu(BLE_ATT_MTU_DFLT);
 
     // handle=0 : unique connexion
     s->updateConnParams(0, 6, 9, 0, 400);
@@ -23,6 +31,10 @@ class ServerCallbacks : public NimBLEServerCallbacks {
     if (gBle) gBle->notifyClients("error:Client BLE déconnecté.");
     s->getAdvertising()->start();
   }
+  // Charge utile des paquets DATA
+  void onMTUChange(uint16_t MTU, ble_gap_conn_desc* desc) override {
+    if (gBle) gBle->setPeerMtu(MTU);
+  }
 };
 
 class CtrlCallbacks : public NimBLECharacteristicCallbacks {
@@ -36,9 +48,11 @@ class CtrlCallbacks : public NimBLECharacteristicCallbacks {
 class DataCallbacks : public NimBLECharacteristicCallbacks {
   void onWrite(NimBLECharacteristic* c) override {
     if (!gBle) return;
-    std::string v = c->getValue();
-    if (!v.empty()) {
-      gBle->onDataChunk(reinterpret_cast<const uint8_t*>(v.data()), v.size());
+    // Référence à la valeur de la caractéristique, sans copie: seule la tâche
+    // hôte NimBLE, qui exécute ce callback, la modifie
+    const NimBLEAttValue& v = c->getValue();
+    if (v.size()) {
+      gBle->onDataChunk(v.data(), v.size());
     }
   }
 };
@@ -50,7 +64,7 @@ void BleUpload::Setup() {
 
   NimBLEDevice::setPower(ESP_PWR_LVL_P21);
 
-  NimBLEDevice::setMTU(517);
+  NimBLEDevice::setMTU(BLE_MAX_MTU);
 
   server = NimBLEDevice::createServer();
   auto *cbs = new ServerCallbacks();
@@ -84,6 +98,16 @@ void BleUpload::Setup() {
   adv->start();
   advRunning = true;
 
+  // Anneau pour la plus grande MTU: jamais réalloué pendant que la tâche
+  // d'écriture le lit. Multiple de STAGING_BLOCK_SIZE, il ne coupe jamais un
+  // bloc vidé en deux.
+  if (!rxRing.allocate(ALIGN_UP((BLE_MAX_MTU - 3 - BLE_SEQ_HEADER) * BLE_RX_RING_PACKETS, STAGING_BLOCK_SIZE))) {
+    notifyClients("error:Mémoire insuffisante pour la réception BLE.");
+  }
+  xTaskCreatePinnedToCore([](void* arg){
+    static_cast<BleUpload*>(arg)->writerLoop();
+  }, "ble_fs_writer", 4096, this, 2, &s_writerTask, 1);
+
   notifyClients("log:BLE prêt. Publicité en cours.");
 }
 
@@ -98,65 +122,182 @@ void BleUpload::loop() {
   // Rien à faire ici
 }
 
+// START_UPLOAD, dans la tâche hôte NimBLE: plus aucun paquet dans l'anneau,
+// la tâche d'écriture le remet à zéro et ouvre le fichier (openUpload())
 void BleUpload::beginUpload(size_t total) {
   resetInactivityTimer();
+  if (!rxRing.capacity()) { notifyClients("error:Mémoire insuffisante pour la réception BLE."); return; }
+  receiving = false;
+  requestedSize = total;
+  startRequested = true;
+  if (s_writerTask) xTaskNotifyGive(s_writerTask);
+}
+
+// Suite de beginUpload() dans la tâche ble_fs_writer, seule à lire l'anneau.
+// Le client n'envoie rien avant le premier crédit, accordé une fois le
+// fichier ouvert.
+void BleUpload::openUpload() {
+  startRequested = false;
   if (binFile) binFile.close();
-  expectedSize = total;
+  expectedSize = requestedSize;
   received = 0;
+  endRequested = false;
   lastProgressPct = -1;
+  lastProgressMs = 0;
+  uploadHash.begin();
+  uploadCrc = CRC32_INIT;
+  rxRing.reset();
+  imageDigestRemove("/firmware.bin");
   binFile = LittleFS.open("/firmware.bin", "w");
   if (!binFile) { notifyClients("error:Impossible d'ouvrir /firmware.bin"); return; }
+  uploadStartMs = millis();
+  resetFlow();
+  receiving = true;
+}
+
+// Nouveau transfert, dans la tâche ble_fs_writer qui tient l'état des
+// crédits: numérotation à zéro, premier crédit envoyé juste après
+void BleUpload::resetFlow() {
+  flowResetRequested = false;
+  rxSeq = 0;
+  accepted = 0;
+  gapCount = 0;
+  ringDrops = 0;
+  gapOpen = false;
+  gapNotified = 0;
+  creditLimit = 0;
+  creditMs = 0;
+  creditOpen = true;
+}
 
-  if (!s_bleRxQ) s_bleRxQ = xQueueCreate(64, sizeof(BleChunk));  // 64 x 256 = 16 KiB buffer
-  if (!s_writerTask) {
-    xTaskCreatePinnedToCore([](void* arg){
-      BleUpload* self = static_cast<BleUpload*>(arg);
-      BleChunk c;
-      for(;;){
-        if (xQueueReceive(s_bleRxQ, &c, portMAX_DELAY) == pdTRUE) {
-          if (self->binFile) self->binFile.write(c.data, c.len);
-          self->received += c.len;
-          if (self->expectedSize > 0) {
-            int p = (int)((self->received * 100ull) / self->expectedSize);
-            // throttle 250 ms mini
-            static uint32_t lastMs=0; static int lastPct=-1;
-            uint32_t now=millis();
-            if ((p != lastPct) && (p - lastPct >= 1 || now - lastMs >= 250)) {
-              self->notifyClients(String("log:Téléversement en cours: ") + p + "%");
-              lastPct = p; lastMs = now;
-            }
-            if (self->received >= self->expectedSize) self->endUpload();
-          }
+// Crédit et reprises, depuis la tâche ble_fs_writer seulement
+void BleUpload::grantCredit() {
+  if (!creditOpen || flowResetRequested) return;
+  bool active = streaming || (binFile && (!expectedSize || accepted < expectedSize));
+  if (gapNotified != gapCount) {
+    gapNotified = gapCount;
+    notifyClients(String("EVENT:RESEND:") + rxSeq);
+  }
+  // accepted lu avant la place libre: au pire la limite est trop basse
+  uint32_t done = accepted;
+  uint32_t room = streaming ? streamImage.freeSpace() : rxRing.freeSpace();
+  uint32_t quantum = (streaming ? STREAM_RING_SIZE : rxRing.capacity()) / 4;
+  uint32_t limit = done + room;
+  uint32_t now = millis();
+  if (active && limit < creditLimit + quantum && now - creditMs < BLE_CREDIT_REFRESH_MS) return;
+  // Transfert fini: dernier crédit, qui confirme tous les paquets
+  if (!active) creditOpen = false;
+  creditLimit = limit;
+  creditMs = now;
+  notifyClients(String("EVENT:CREDIT:") + rxSeq + ":" + limit + ":" + packetPayload());
+}
+
+// Écrit l'anneau dans binFile par blocs LittleFS entiers, puis le reste une
+// fois tout reçu (taille annoncée atteinte ou END_UPLOAD)
+void BleUpload::writerLoop() {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BLE_WRITER_POLL_MS));
+    if (startRequested) openUpload();
+    if (flowResetRequested) resetFlow();
+    while (binFile) {
+      bool complete = endRequested || (expectedSize > 0 && received + rxRing.used() >= expectedSize);
+      const uint8_t* p;
+      uint32_t n = rxRing.peek(&p);
+      if (n > STAGING_BLOCK_SIZE) n = STAGING_BLOCK_SIZE;
+      if (!n || (n < STAGING_BLOCK_SIZE && !complete)) {
+        if (complete && !rxRing.used()) endUpload();
+        break;
+      }
+      binFile.write(p, n);
+      uploadHash.update(p, n);
+      uploadCrc = crc32Update(uploadCrc, p, n);
+      rxRing.consume(n);
+      received += n;
+      grantCredit();
+      if (expectedSize > 0) {
+        int pct = (int)((received * 100ull) / expectedSize);
+        uint32_t now = millis();
+        if (pct != lastProgressPct && now - lastProgressMs >= 250) {
+          notifyClients(String("log:Téléversement en cours: ") + pct + "%");
+          lastProgressPct = pct; lastProgressMs = now;
         }
       }
-    }, "ble_fs_writer", 4096, this, 2, &s_writerTask, 1);
+    }
+    grantCredit();
   }
 }
 
 void BleUpload::endUpload() {
   resetInactivityTimer();
+  receiving = false;
   if (binFile) {
     binFile.close();
     lastProgressPct = -1;
-    notifyClients("EVENT:UPLOAD_COMPLETE");
-    notifyClients("log:Fichier reçu (BLE). Prêt à préparer le flash.");
+    uploadMs = millis() - uploadStartMs;
+    ringHighWater = rxRing.highWater();
+    ImageDigest digest;
+    uploadHash.finish(digest.sha256);
+    digest.size = received;
+    digest.crc32 = ~uploadCrc;
+    imageDigestSave("/firmware.bin", digest);
+    if (firmwareCacheStore("/firmware.bin")) {
+      notifyClients("EVENT:CACHED:" + firmwareCacheSelected());
+    }
+    // Empreinte calculée pendant la réception, comparée par le client
+    notifyClients("EVENT:UPLOAD_COMPLETE:" + imageDigestEvent(digest));
+    notifyClients(String("log:Fichier reçu (BLE): ") + received + " octets en " + uploadMs + " ms ("
+                  + (uploadMs ? (uint32_t)(received / uploadMs) : 0) + " Ko/s), anneau rempli au plus à "
+                  + ringHighWater + "/" + rxRing.capacity() + " octets, " + ringDrops + " paquet(s) perdu(s), "
+                  + gapCount + " reprise(s).");
+    notifyClients("log:Prêt à préparer le flash.");
   }
 }
 
+// EVENT:BLE_STATS:<octets>:<ms>:<remplissage max>:<taille anneau>:<paquets perdus>:<reprises>
+String BleUpload::statsEvent() const {
+  return String("EVENT:BLE_STATS:") + received + ":" + uploadMs + ":" + ringHighWater + ":"
+         + rxRing.capacity() + ":" + ringDrops + ":" + gapCount;
+}
+
+// Paquet rxSeq à renvoyer: la reprise n'est demandée qu'une fois par trou
+void BleUpload::requestResend() {
+  if (gapOpen) return;
+  gapOpen = true;
+  ++gapCount;
+  if (s_writerTask) xTaskNotifyGive(s_writerTask);
+}
+
+// Tâche hôte NimBLE: ne bloque jamais. Un paquet qui ne tient pas dans
+// l'anneau (client au-delà de son crédit) est perdu et redemandé.
 void BleUpload::onDataChunk(const uint8_t* data, size_t len) {
-  if (!binFile || !s_bleRxQ) { notifyClients("error:Upload non initialisé."); return; }
-  while (len > 0) {
-    BleChunk c;
-    size_t n = len > sizeof(c.data) ? sizeof(c.data) : len;
-    memcpy(c.data, data, n);
-    c.len = (uint16_t)n;
-    if (xQueueSend(s_bleRxQ, &c, 0) != pdTRUE) {
-      // file pleine: on attend un peu pour ne pas drop
-      vTaskDelay(1);
-      continue;
-    }
-    data += n; len -= n;
+  if (len < BLE_SEQ_HEADER) return;
+  if (!streaming && !receiving) { notifyClients("error:Upload non initialisé."); return; }
+  uint16_t seq = data[0] | (data[1] << 8);
+  if (seq != rxSeq) {
+    // Doublon d'une reprise: déjà reçu. Sinon un paquet manque: on ignore
+    // la suite jusqu'à ce qu'il revienne.
+    if ((int16_t)(seq - rxSeq) > 0) requestResend();
+    return;
   }
+  data += BLE_SEQ_HEADER;
+  len -= BLE_SEQ_HEADER;
+  if (streaming) {
+    // Flash en flux: directement dans l'anneau du flasheur
+    if (!streamImage.active()) { streaming = false; return; }
+    if (streamImage.freeSpace() < len) { ++ringDrops; requestResend(); return; }
+    gapOpen = false;
+    rxSeq = rxSeq + 1;
+    accepted += streamImage.write(data, len);
+    if (streamImage.received() >= streamImage.size()) streaming = false;
+    resetInactivityTimer();
+    return;
+  }
+  if (rxRing.freeSpace() < len) { ++ringDrops; requestResend(); return; }
+  gapOpen = false;
+  rxSeq = rxSeq + 1;
+  // Seule copie du paquet: dans l'anneau, que la tâche écrit tel quel
+  accepted += rxRing.write(data, len);
+  if (rxRing.used() >= STAGING_BLOCK_SIZE) xTaskNotifyGive(s_writerTask);
 }
 
 
@@ -183,40 +324,92 @@ void BleUpload::handleCtrlCommand(const std::string& s) {
     return;
   }
   if (s == "END_UPLOAD") {
-    endUpload();
+    // Fermé par la tâche d'écriture une fois l'anneau vidé
+    endRequested = true;
+    if (s_writerTask) xTaskNotifyGive(s_writerTask);
     return;
   }
   if (s == "CMD:PREPARE_FLASH") {
     uploader->notifyClients("log:Commande reçue (BLE). Préparation bootloader RP2040...");
-    digitalWrite(BOOTLOADER_PIN, LOW);
-    delay(100);
-    digitalWrite(RESETRP2040_PIN, LOW);
-    delay(100);
-    digitalWrite(RESETRP2040_PIN, HIGH);
-    delay(100);
+    prepareFlashTargets();
     uploader->notifyClients("log:En attente de la réponse du RP2040...");
-    startFlashProcess();
     uploader->notifyClients("EVENT:RP2040_BOOTLOADER_MODE");
     return;
   }
-  if (s == "CMD:START_FLASH") {
+  if (s == "CMD:START_FLASH" || s == "CMD:START_FLASH_DIFF") {
     if (rp2040BootloaderActive) {
-      digitalWrite(BOOTLOADER_PIN, HIGH);
-      uploader->notifyClients("log:Démarrage du flash (BLE)...");
-      startFlashProcess(SEND_INFO_COMMAND);
+      bool diff = (s == "CMD:START_FLASH_DIFF");
+      uploader->notifyClients(diff ? "log:Démarrage du flash différentiel (BLE)..."
+                                   : "log:Démarrage du flash (BLE)...");
+      startFlashTargets(diff);
     } else {
       uploader->notifyClients("error:Le RP2040 n'est pas en mode bootloader.");
     }
     return;
   }
+  // CMD:METRICS - derniers flashs, une notification EVENT:METRICS par flash
+  if (s == "CMD:METRICS") {
+    static FlashRun runs[FLASH_METRICS_RUNS];
+    uint8_t count = flashRunHistory(runs);
+    for (uint8_t i = 0; i < count; ++i) {
+      notifyClients(flashRunEvent(runs[i]));
+    }
+    return;
+  }
+  // CMD:BLE_STATS - débit et remplissage de l'anneau du dernier téléversement
+  if (s == "CMD:BLE_STATS") {
+    notifyClients(statsEvent());
+    return;
+  }
+  // CMD:TARGETS:<masque> - cibles RP2040 à flasher (bit 0 = première)
+  if (s.rfind("CMD:TARGETS:", 0) == 0) {
+    // 0 = simple consultation
+    uint32_t mask = strtoul(s.c_str() + strlen("CMD:TARGETS:"), nullptr, 10);
+    if (mask && !selectFlashTargets(mask)) {
+      notifyClients("error:Sélection de cibles refusée.");
+    }
+    notifyClients(flashTargetsEvent());
+    return;
+  }
+  // CMD:STREAM_FLASH:<taille>[:KEEP] - flash pendant le téléversement
+  if (s.rfind("CMD:STREAM_FLASH:", 0) == 0) {
+    if (!rp2040BootloaderActive) {
+      uploader->notifyClients("error:Le RP2040 n'est pas en mode bootloader.");
+      return;
+    }
+    char* end = nullptr;
+    uint32_t total = strtoul(s.c_str() + strlen("CMD:STREAM_FLASH:"), &end, 10);
+    bool keep = end && strcmp(end, ":KEEP") == 0;
+    bool started = startStreamFlash(total, keep);
+    // Crédits remis à zéro par la tâche d'écriture, qui envoie le premier
+    if (started) flowResetRequested = true;
+    streaming = started;
+    if (started && s_writerTask) xTaskNotifyGive(s_writerTask);
+    if (!streaming) {
+      notifyClients("error:Impossible de démarrer le flash en flux (BLE).");
+    } else {
+      uploader->notifyClients(String("log:Flash en flux (BLE) de ") + total + " octets...");
+      uploader->notifyClients("EVENT:STREAM_READY");
+    }
+    return;
+  }
+  // CMD:CACHE:<sha256> - image déjà en cache? Si oui elle est sélectionnée
+  // et le téléversement peut être sauté
+  if (s.rfind("CMD:CACHE:", 0) == 0) {
+    const char* hash = s.c_str() + strlen("CMD:CACHE:");
+    notifyClients(String(firmwareCacheSelect(hash) ? "EVENT:CACHE_HIT:" : "EVENT:CACHE_MISS:") + hash);
+    return;
+  }
   if (s == "CMD:APPLY_OTA") {
     auto cb = [this](int pct, const char* msg){
       if (msg && *msg) this->notifyClients(String("log:") + msg);
       else             this->notifyClients(String("log:OTA en cours: ") + pct + "%");
     };
 
+    // Image protégée de l'éviction jusqu'à la fin de la tâche
+    String image = firmwareImageAcquire();
     BaseType_t ok = ota_start_task(
-        "/firmware.bin",
+        image.c_str(),
         cb,                         // ← virgule ici
         false,
         "ble_ota_task",
@@ -6,12 +6,39 @@
 #include "config.h"
 #include "main.h"
 #include "rp2040_flasher/rp2040_flasher.h"
+#include "rp2040_flasher/sha256.h"
+#include "rp2040_flasher/byte_ring.h"
 
 #define FW_SERVICE_UUID   "d3a8f820-9b39-4a7c-9d09-7b5e5a313001"
 #define CTRL_CHAR_UUID    "d3a8f821-9b39-4a7c-9d09-7b5e5a313001"
 #define DATA_CHAR_UUID    "d3a8f822-9b39-4a7c-9d09-7b5e5a313001"
 #define NOTIF_CHAR_UUID   "d3a8f823-9b39-4a7c-9d09-7b5e5a313001"
 
+// Anneau de réception: BLE_RX_RING_PACKETS paquets de la plus grande MTU,
+// arrondi au bloc LittleFS (STAGING_BLOCK_SIZE) que la tâche d'écriture vide
+// d'un coup. Alloué une fois dans Setup(), remis à zéro par cette tâche.
+#define BLE_MAX_MTU 517
+#define BLE_RX_RING_PACKETS 64
+// La tâche d'écriture se réveille au moins toutes les BLE_WRITER_POLL_MS
+// pour écrire la fin du fichier (moins d'un bloc)
+#define BLE_WRITER_POLL_MS 10
+
+// Contrôle de flux des paquets DATA (écrits sans réponse). Chaque paquet
+// commence par son numéro sur BLE_SEQ_HEADER octets (16 bits, petit-boutiste)
+// suivi d'au plus MTU - 3 - BLE_SEQ_HEADER octets. L'ESP32 accorde des
+// crédits selon la place libre dans l'anneau de réception:
+//   EVENT:CREDIT:<n° attendu>:<limite>:<charge utile max>
+// limite = nombre total d'octets que le client peut avoir envoyés. Un paquet
+// hors séquence est ignoré et la reprise est demandée par
+//   EVENT:RESEND:<n° attendu>
+// Un paquet au-delà du crédit qui ne tient plus dans l'anneau est perdu de
+// la même façon: le callback GATT (tâche hôte NimBLE) n'attend jamais.
+// Le crédit est renvoyé au moins toutes les BLE_CREDIT_REFRESH_MS tant que
+// le transfert dure (notification perdue, paquets de fin perdus), puis une
+// dernière fois quand tout est reçu.
+#define BLE_SEQ_HEADER 2
+#define BLE_CREDIT_REFRESH_MS 250
+
 class BleUpload : public Uploader {
   public:
     BleUpload();
@@ -21,9 +48,12 @@ class BleUpload : public Uploader {
     void loop() override;
     bool hasClient() const { return clientConnected; }
     void setClientConnected(bool v) { clientConnected = v; }
+    void setPeerMtu(uint16_t mtu) { peerMtu = mtu; }
 
     void handleCtrlCommand(const std::string& s);
     void onDataChunk(const uint8_t* data, size_t len);
+    // Tâche ble_fs_writer: ouvre binFile, y vide rxRing et le ferme
+    void writerLoop();
 
   private:
     bool clientConnected = false;
@@ -38,12 +68,44 @@ class BleUpload : public Uploader {
 
     File binFile;
     size_t expectedSize = 0;
-    size_t received = 0;
+    size_t received = 0;         // octets écrits dans binFile (tâche ble_fs_writer)
     int lastProgressPct = -1; 
+    uint32_t lastProgressMs = 0;
+    bool streaming = false;      // données vers streamImage au lieu du fichier
+    Sha256 uploadHash;           // empreinte de ce qui est écrit (tâche ble_fs_writer)
+    uint32_t uploadCrc = 0;
+    ByteRing rxRing;             // callback GATT -> tâche ble_fs_writer
+    volatile bool receiving = false;     // binFile ouvert, l'anneau accepte les paquets
+    volatile bool startRequested = false; // START_UPLOAD reçu, ouvert par la tâche
+    volatile bool flowResetRequested = false; // STREAM_FLASH reçu, resetFlow() par la tâche
+    volatile size_t requestedSize = 0;
+    volatile bool endRequested = false;  // END_UPLOAD reçu, fermé une fois l'anneau vide
+    uint16_t peerMtu = BLE_ATT_MTU_DFLT;
+
+    // Contrôle de flux (voir BLE_SEQ_HEADER). Le callback GATT tient rxSeq,
+    // accepted et gapCount, la tâche ble_fs_writer envoie crédits et reprises.
+    volatile uint16_t rxSeq = 0;         // prochain n° de paquet attendu
+    volatile uint32_t accepted = 0;      // octets de données acceptés
+    volatile uint32_t gapCount = 0;      // trous de séquence constatés
+    volatile bool gapOpen = false;       // trou en cours, reprise déjà demandée
+    uint32_t gapNotified = 0;
+    uint32_t creditLimit = 0;            // dernière limite annoncée
+    uint32_t creditMs = 0;
+    volatile bool creditOpen = false;    // transfert en cours ou crédit final à envoyer
+
+    // Mesures du dernier téléversement (CMD:BLE_STATS)
+    uint32_t uploadStartMs = 0;
+    uint32_t uploadMs = 0;
+    volatile uint32_t ringDrops = 0;     // paquets perdus, anneau plein malgré le crédit
+    uint32_t ringHighWater = 0;
 
     void beginUpload(size_t total);
+    void openUpload();
     void endUpload();
+    void resetFlow();
+    void requestResend();
+    void grantCredit();
+    uint32_t packetPayload() const { return peerMtu - 3 - BLE_SEQ_HEADER; }
+    String statsEvent() const;
 };
 
-struct BleChunk { uint16_t len; uint8_t data[256]; }; // 256 = ton CHUNK JS
-
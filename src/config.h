@@ -31,7 +31,16 @@
 #define RP2040_SERIAL_RX_PIN RX
 #endif
 
+// Cibles RP2040 supplémentaires, flashées en parallèle de la première (bancs
+// de production). Pour chacune un UART libre et quatre broches, par exemple:
+//   -D RP2040_TARGET2_UART=Serial2 -D RP2040_TARGET2_TX_PIN=4 -D RP2040_TARGET2_RX_PIN=5
+//   -D RP2040_TARGET2_RESET_PIN=6 -D RP2040_TARGET2_BOOT_PIN=9
+// et de même RP2040_TARGET3_* (Serial0 est libre sur un ESP32-S3 en USB CDC).
+
 #define RP2040_SERIAL_BAUD 921600
+// Tampon TX du driver UART: permet au flasheur de préparer le bloc suivant
+// pendant que le précédent part sur la ligne (2 blocs de 4 KiB + en-têtes).
+#define RP2040_SERIAL_TX_BUFFER 8448
 
 #ifdef USE_RGB
 #undef RGB_BUILTIN
@@ -3,6 +3,7 @@
 #include <FS.h>
 #include <LittleFS.h>
 #include <Update.h>
+#include "rp2040_flasher/firmware_cache.h"
 extern "C" {
   #include "esp_ota_ops.h"
 }
@@ -210,7 +211,10 @@ static void ota_task(void* pv) {
     if (args->user_cb) args->user_cb(lastPct >= 0 ? lastPct : 0, "OTA: échec.");
   }
 
+  // Image du cache plus lue: elle peut de nouveau être supprimée
+  firmwareCacheRelease(args->path.c_str());
   s_otaTaskRunning = false;
+  args.reset();
   vTaskDelete(nullptr);
 }
 
@@ -225,6 +229,7 @@ BaseType_t ota_start_task(const char* path,
   if (s_otaTaskRunning) {
     // Déjà en cours; signale via callback si fourni
     if (cb) cb(0, "OTA: une mise à jour est déjà en cours.");
+    if (path) firmwareCacheRelease(path);
     return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY; // retourne un truc non-pdPASS
   }
 
@@ -234,7 +239,10 @@ BaseType_t ota_start_task(const char* path,
       std::move(cb),
       delete_after_success
   };
-  if (!args) return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+  if (!args) {
+    if (path) firmwareCacheRelease(path);
+    return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+  }
 
   s_otaTaskRunning = true;
   BaseType_t ok = xTaskCreatePinnedToCore(
@@ -249,6 +257,7 @@ BaseType_t ota_start_task(const char* path,
 
   if (ok != pdPASS) {
     s_otaTaskRunning = false;
+    firmwareCacheRelease(args->path.c_str());
     delete args;
   }
   return ok;
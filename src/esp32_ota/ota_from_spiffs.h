@@ -47,7 +47,10 @@ struct OtaTaskArgs {
   bool          delete_after_success;  // supprimer le fichier après succès
 };
 
-// Lance l’OTA dans une tâche dédiée (retourne pdPASS si ok)
+// Lance l’OTA dans une tâche dédiée (retourne pdPASS si ok). Une image du
+// cache (firmware_cache.h) est protégée par l'appelant avec
+// firmwareImageAcquire() ou firmwareCacheAcquire(); elle est libérée à la fin
+// de la tâche, ou tout de suite si la tâche ne démarre pas.
 BaseType_t ota_start_task(const char* path,
                           OtaProgressCb cb,
                           bool delete_after_success = false,
@@ -4,6 +4,7 @@
 #include "esp_ota_ops.h"
 #include "config.h"
 #include "rp2040_flasher/rp2040_flasher.h"
+#include "rp2040_flasher/firmware_cache.h"
 #include "uploader.h"
 #ifdef USE_WIFI
 #include "wifi/wifi_upload.h"
@@ -175,8 +176,9 @@ void setup() {
     SerialDBG.begin(DBG_SERIAL_BAUD);
     
     //SerialRP2040.setRxBufferSize(4096);
-    //SerialRP2040.setTxBufferSize(2048);
+    SerialRP2040.setTxBufferSize(RP2040_SERIAL_TX_BUFFER);
     SerialRP2040.begin(RP2040_SERIAL_BAUD, SERIAL_8N1, RP2040_SERIAL_RX_PIN, RP2040_SERIAL_TX_PIN);
+    flasherBegin();
 
     delay(500); // Attendre que l'UART soit prête
     printWakeupReason();
@@ -221,6 +223,7 @@ void setup() {
     if (!LittleFS.begin()) {
         DEBUG(println("LittleFS mount failed!"));
     }
+    firmwareCacheBegin();
 
     Uploader* wifi = nullptr;
     Uploader* ble  = nullptr;
@@ -285,5 +288,5 @@ void loop() {
     }
     blink_led();
     uploader->loop();
-    handleFlasher(); // Appel de la machine à états dans la boucle principale
+    // Le flasheur tourne dans sa propre tâche (flasherBegin())
 }
@@ -0,0 +1,68 @@
+#include "byte_ring.h"
+
+ByteRing::~ByteRing() {
+    free(buffer);
+}
+
+bool ByteRing::allocate(uint32_t capacity) {
+    if (buffer && size == capacity) {
+        reset();
+        return true;
+    }
+    free(buffer);
+    buffer = nullptr;
+    size = 0;
+#ifdef BOARD_HAS_PSRAM
+    buffer = (uint8_t*)ps_malloc(capacity);
+#endif
+    if (!buffer) {
+        buffer = (uint8_t*)malloc(capacity);
+    }
+    if (!buffer) {
+        return false;
+    }
+    size = capacity;
+    reset();
+    return true;
+}
+
+void ByteRing::reset() {
+    head = 0;
+    tail = 0;
+    peak = 0;
+}
+
+uint32_t ByteRing::write(const uint8_t* data, uint32_t length) {
+    uint32_t h = head;
+    uint32_t room = size - (h - tail);
+    if (length > room) {
+        length = room;
+    }
+    if (!length) {
+        return 0;
+    }
+    uint32_t pos = h % size;
+    uint32_t first = size - pos < length ? size - pos : length;
+    memcpy(buffer + pos, data, first);
+    memcpy(buffer, data + first, length - first);
+    __sync_synchronize(); // données visibles avant la nouvelle tête
+    head = h + length;
+    if (h + length - tail > peak) {
+        peak = h + length - tail;
+    }
+    return length;
+}
+
+uint32_t ByteRing::peek(const uint8_t** data) const {
+    uint32_t t = tail;
+    uint32_t available = head - t;
+    __sync_synchronize(); // tête lue avant les données
+    uint32_t pos = size ? t % size : 0;
+    *data = buffer + pos;
+    return size - pos < available ? size - pos : available;
+}
+
+void ByteRing::consume(uint32_t length) {
+    __sync_synchronize(); // lecture terminée avant de rendre la place
+    tail = tail + length;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Anneau d'octets sans verrou entre un producteur et un consommateur (deux
+// tâches). Le producteur n'écrit que head, le consommateur que tail; ce sont
+// des positions absolues, l'index dans le tampon vaut position % capacité.
+// Le consommateur lit sur place (peek() puis consume()), sans copie
+// intermédiaire.
+class ByteRing {
+    public:
+        ~ByteRing();
+        // (Ré)alloue l'anneau, en PSRAM si la carte en a, et le vide. À
+        // appeler quand ni le producteur ni le consommateur ne travaillent.
+        bool allocate(uint32_t capacity);
+        void reset();
+        uint32_t capacity() const { return size; }
+        uint32_t used() const { return head - tail; }
+        uint32_t freeSpace() const { return size - used(); }
+
+        // Producteur: copie ce qui tient et renvoie le nombre d'octets pris
+        uint32_t write(const uint8_t* data, uint32_t length);
+
+        // Consommateur: zone contiguë lisible à partir du plus ancien octet,
+        // libérée ensuite par consume()
+        uint32_t peek(const uint8_t** data) const;
+        void consume(uint32_t length);
+
+        // Remplissage maximal atteint depuis reset()
+        uint32_t highWater() const { return peak; }
+
+    private:
+        uint8_t* buffer = nullptr;
+        uint32_t size = 0;
+        volatile uint32_t head = 0;        // fin des octets écrits (producteur)
+        volatile uint32_t tail = 0;        // plus ancien octet non consommé (consommateur)
+        uint32_t peak = 0;                 // écrit par le producteur
+};
@@ -0,0 +1,270 @@
+#include "compressed_image.h"
+#include "config.h"
+
+// L'inflateur de miniz est en ROM sur les ESP32: pas de dépendance ajoutée.
+// Sur l'hôte, le shim des tests fournit la même interface.
+#if __has_include(<rom/miniz.h>)
+#include <rom/miniz.h>
+#define INFLATE_HAS_ROM 1
+#endif
+
+bool readCompressedHeader(ImageSource* source, CompressedImageHeader* header) {
+    if (source->size() < sizeof(*header) || source->available(0) < sizeof(*header)) {
+        return false;
+    }
+    if (source->read(0, (uint8_t*)header, sizeof(*header)) != sizeof(*header)) {
+        return false;
+    }
+    return header->magic == COMPRESSED_IMAGE_MAGIC;
+}
+
+#ifdef INFLATE_HAS_ROM
+
+#define INFLATE_DICT_SIZE TINFL_LZ_DICT_SIZE
+// Sortie maximale par octet d'entrée: 258 octets pour 2 bits (longueur 258 et
+// distance codées sur 1 bit chacune)
+#define INFLATE_MAX_EXPANSION 1032
+// Marge pour l'entrée déjà tamponnée par tinfl (4 octets) et une copie
+// restée en suspens au dernier appel
+#define INFLATE_PENDING_BYTES 5
+
+struct InflateState {
+    tinfl_decompressor decomp;
+    uint8_t dict[INFLATE_DICT_SIZE];
+    uint8_t input[INFLATE_INPUT_CHUNK];
+};
+
+bool InflateImageSource::open(ImageSource* source, const CompressedImageHeader& header) {
+    if (header.method != COMPRESSION_ZLIB && header.method != COMPRESSION_DEFLATE_RAW) {
+        return false;
+    }
+    // ~44 KiB, rendus à la fin du flash
+    if (!state) {
+#ifdef BOARD_HAS_PSRAM
+        state = (InflateState*)ps_malloc(sizeof(InflateState));
+#endif
+        if (!state) {
+            state = (InflateState*)malloc(sizeof(InflateState));
+        }
+        if (!state) {
+            return false;
+        }
+    }
+    inner = source;
+    method = header.method;
+    rawSize = header.rawSize;
+    rawCrc = header.rawCrc;
+    restart();
+    return true;
+}
+
+void InflateImageSource::restart() {
+    tinfl_init(&state->decomp);
+    inPos = sizeof(CompressedImageHeader);
+    inStart = 0;
+    inEnd = 0;
+    outPos = 0;
+    released = 0;
+    finished = false;
+    failed = false;
+}
+
+// Un appel à l'inflateur: recharge l'entrée si besoin puis décompresse
+// jusqu'à la fin du dictionnaire au plus, sans écraser les octets produits à
+// partir de keep. Renvoie 1 si on a avancé, 0 si l'image est finie, si le
+// flux n'a rien de nouveau ou s'il faut attendre que keep avance, -1 en cas
+// d'erreur.
+int InflateImageSource::inflateStep(uint32_t keep) {
+    if (failed) {
+        return -1;
+    }
+    if (finished) {
+        return 0;
+    }
+    uint32_t compressedEnd = inner->size();
+    if (inStart == inEnd && inPos < compressedEnd) {
+        uint32_t n = inner->available(inPos);
+        if (!n) {
+            return 0; // flux: la suite n'est pas encore arrivée
+        }
+        if (n > INFLATE_INPUT_CHUNK) {
+            n = INFLATE_INPUT_CHUNK;
+        }
+        int r = inner->read(inPos, state->input, n);
+        if (r <= 0) {
+            failed = true;
+            return -1;
+        }
+        inPos += r;
+        inStart = 0;
+        inEnd = r;
+    }
+    // tinfl exige toute la place jusqu'à la fin du dictionnaire circulaire et
+    // peut la remplir, écrasant ce qui a été produit un tour plus tôt. Si des
+    // octets encore utiles seraient écrasés, on borne l'entrée pour borner la
+    // sortie.
+    uint32_t dictPos = outPos & (INFLATE_DICT_SIZE - 1);
+    size_t inSize = inEnd - inStart;
+    size_t outSize = INFLATE_DICT_SIZE - dictPos;
+    if (keep > outPos) {
+        keep = outPos;
+    }
+    uint32_t room = keep + INFLATE_DICT_SIZE - outPos;
+    if (room < outSize) {
+        uint32_t limit = room / INFLATE_MAX_EXPANSION;
+        if (limit <= INFLATE_PENDING_BYTES) {
+            return 0;
+        }
+        limit -= INFLATE_PENDING_BYTES;
+        if (inSize > limit) {
+            inSize = limit;
+        }
+    }
+    mz_uint32 flags = method == COMPRESSION_ZLIB ? TINFL_FLAG_PARSE_ZLIB_HEADER : 0;
+    if (inPos < compressedEnd || inSize < inEnd - inStart) {
+        flags |= TINFL_FLAG_HAS_MORE_INPUT;
+    }
+    tinfl_status status = tinfl_decompress(&state->decomp, state->input + inStart, &inSize,
+                                           state->dict, state->dict + dictPos, &outSize, flags);
+    inStart += inSize;
+    outPos += outSize;
+    if (status < 0 || outPos > rawSize ||
+        (status == TINFL_STATUS_NEEDS_MORE_INPUT && inStart == inEnd && inPos >= compressedEnd)) {
+        DEBUG(printf("Inflate error %d at output offset %lu\n", (int)status, (unsigned long)outPos));
+        failed = true;
+        return -1;
+    }
+    if (status == TINFL_STATUS_DONE) {
+        finished = true;
+        if (outPos != rawSize) {
+            DEBUG(printf("Inflate: %lu bytes produced, header says %lu\n", (unsigned long)outPos, (unsigned long)rawSize));
+            failed = true;
+            return -1;
+        }
+    }
+    return (inSize || outSize) ? 1 : 0;
+}
+
+// Premier octet produit à garder dans le dictionnaire quand le flasheur lit
+// à offset. Un flux ne peut pas être redécompressé: on garde aussi tout ce
+// que le flasheur n'a pas libéré, pour que ses reprises y restent.
+uint32_t InflateImageSource::keepFrom(uint32_t offset) {
+    return !inner->seekable() && released < offset ? released : offset;
+}
+
+// Le dictionnaire contient toujours les INFLATE_DICT_SIZE derniers octets
+// produits; on décompresse en avance sans rien écraser à partir de offset.
+uint32_t InflateImageSource::available(uint32_t offset) {
+    if (!state || offset >= rawSize) {
+        return 0;
+    }
+    if (outPos > offset + INFLATE_DICT_SIZE) {
+        return rawSize - offset; // déjà sorti du dictionnaire: read() redécompresse
+    }
+    while (outPos < offset + INFLATE_LOOKAHEAD) {
+        if (inflateStep(keepFrom(offset)) <= 0) {
+            break;
+        }
+    }
+    // En cas d'erreur on annonce les données pour que read() remonte l'échec
+    // au flasheur au lieu de le laisser attendre.
+    if (failed) {
+        return rawSize - offset;
+    }
+    return outPos > offset ? outPos - offset : 0;
+}
+
+// On copie ce qui est déjà décompressé avant de relancer l'inflateur, qui
+// peut écraser le début du dictionnaire.
+int InflateImageSource::read(uint32_t offset, uint8_t* buffer, uint32_t length) {
+    if (!state || failed) {
+        return -1;
+    }
+    if (offset >= rawSize) {
+        return 0;
+    }
+    if (length > rawSize - offset) {
+        length = rawSize - offset;
+    }
+    // Octets déjà écrasés dans le dictionnaire: on repart du début
+    if (outPos > offset + INFLATE_DICT_SIZE) {
+        if (!inner->seekable()) {
+            return -1;
+        }
+        restart();
+    }
+    uint32_t copied = 0;
+    while (copied < length) {
+        uint32_t pos = offset + copied;
+        if (pos < outPos) {
+            uint32_t n = outPos - pos < length - copied ? outPos - pos : length - copied;
+            uint32_t ringPos = pos & (INFLATE_DICT_SIZE - 1);
+            uint32_t first = INFLATE_DICT_SIZE - ringPos < n ? INFLATE_DICT_SIZE - ringPos : n;
+            memcpy(buffer + copied, state->dict + ringPos, first);
+            memcpy(buffer + copied + first, state->dict, n - first);
+            copied += n;
+            continue;
+        }
+        int r = inflateStep(keepFrom(pos));
+        if (r < 0) {
+            return -1;
+        }
+        if (r == 0) {
+            break;
+        }
+    }
+    return copied;
+}
+
+#else
+
+// Pas d'inflateur sur cette cible: les images compressées sont refusées
+bool InflateImageSource::open(ImageSource*, const CompressedImageHeader&) {
+    return false;
+}
+
+void InflateImageSource::restart() {
+}
+
+int InflateImageSource::inflateStep(uint32_t) {
+    return -1;
+}
+
+uint32_t InflateImageSource::keepFrom(uint32_t offset) {
+    return offset;
+}
+
+uint32_t InflateImageSource::available(uint32_t) {
+    return 0;
+}
+
+int InflateImageSource::read(uint32_t, uint8_t*, uint32_t) {
+    return -1;
+}
+
+#endif
+
+// Le flasheur ne relira pas avant offset; la source compressée peut libérer
+// tout ce qui est déjà passé dans le tampon d'entrée.
+void InflateImageSource::release(uint32_t offset) {
+    if (offset > released) {
+        released = offset;
+    }
+    if (inner) {
+        inner->release(inPos);
+    }
+}
+
+bool InflateImageSource::expectedCrc(uint32_t* crc) {
+    *crc = rawCrc;
+    return true;
+}
+
+void InflateImageSource::close() {
+    if (inner) {
+        inner->close();
+    }
+    inner = nullptr;
+    free(state);
+    state = nullptr;
+}
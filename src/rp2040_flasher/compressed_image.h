@@ -0,0 +1,70 @@
+#pragma once
+
+#include <Arduino.h>
+#include "image_source.h"
+
+// Conteneur d'image compressée: en-tête de 16 octets suivi du flux deflate.
+// Le flasheur travaille sur l'image décompressée: taille et CRC de l'en-tête
+// servent pour SEAL et pour vérifier la décompression.
+#define COMPRESSED_IMAGE_MAGIC 0x315A5052   // "RPZ1"
+
+enum CompressedImageMethod : uint8_t {
+    COMPRESSION_ZLIB = 1,        // CompressionStream('deflate') côté navigateur
+    COMPRESSION_DEFLATE_RAW = 2  // CompressionStream('deflate-raw'), gzip sans son en-tête
+};
+
+struct __attribute__((packed)) CompressedImageHeader {
+    uint32_t magic;
+    uint8_t method;
+    uint8_t reserved[3];
+    uint32_t rawSize;            // taille de l'image décompressée
+    uint32_t rawCrc;             // CRC32 IEEE de l'image décompressée
+};
+
+// Lit l'en-tête en début de source; false si ce n'est pas une image compressée
+bool readCompressedHeader(ImageSource* source, CompressedImageHeader* header);
+
+struct InflateState;
+
+// Décompression à la volée d'une autre source. La sortie passe par le
+// dictionnaire circulaire de 32 KiB de l'inflateur: on peut relire les
+// derniers 32 KiB produits (reprise du pipeline d'écriture), au-delà il faut
+// tout redécompresser, ce qui n'est possible que si la source est relisible.
+// Sur un flux, la décompression attend donc que le flasheur libère (release)
+// ce qu'il pourrait relire.
+class InflateImageSource : public ImageSource {
+    public:
+        bool open(ImageSource* source, const CompressedImageHeader& header);
+        uint32_t compressedSize() { return inner ? inner->size() : 0; }
+
+        uint32_t size() override { return rawSize; }
+        uint32_t available(uint32_t offset) override;
+        int read(uint32_t offset, uint8_t* buffer, uint32_t length) override;
+        void release(uint32_t offset) override;
+        bool seekable() override { return inner && inner->seekable(); }
+        bool expectedCrc(uint32_t* crc) override;
+        void close() override;
+
+    private:
+        void restart();
+        int inflateStep(uint32_t keep);
+        uint32_t keepFrom(uint32_t offset);
+
+        ImageSource* inner = nullptr;
+        InflateState* state = nullptr;
+        uint8_t method = 0;
+        uint32_t rawSize = 0;
+        uint32_t rawCrc = 0;
+        uint32_t inPos = 0;           // prochain octet compressé à lire dans inner
+        uint32_t inStart = 0;         // partie non consommée du tampon d'entrée
+        uint32_t inEnd = 0;
+        uint32_t outPos = 0;          // octets décompressés produits
+        uint32_t released = 0;        // le flasheur ne relira pas avant
+        bool finished = false;
+        bool failed = false;
+};
+
+// Avance de décompression visée par available()
+#define INFLATE_LOOKAHEAD 4096
+#define INFLATE_INPUT_CHUNK 1024
+
@@ -0,0 +1,151 @@
+#include "crc32.h"
+
+#include <string.h>
+#ifdef CRC32_HAS_ROM
+#include <esp_rom_crc.h>
+#endif
+
+// Sélection de la variante du flasheur: 0 = table, 1 = slice-by-8, 2 = ROM
+#ifndef FLASHER_CRC32_IMPL
+#ifdef CRC32_HAS_ROM
+#define FLASHER_CRC32_IMPL 2
+#else
+#define FLASHER_CRC32_IMPL 1
+#endif
+#endif
+
+// crcTables[0] est la table classique; crcTables[k][i] donne le CRC de l'octet
+// i suivi de k octets nuls, ce qui permet de traiter 8 octets d'un coup.
+static uint32_t crcTables[8][256];
+static bool crcTablesReady = false;
+
+static void crc32InitTables() {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int j = 0; j < 8; ++j) {
+            c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+        }
+        crcTables[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int k = 1; k < 8; ++k) {
+            uint32_t prev = crcTables[k - 1][i];
+            crcTables[k][i] = (prev >> 8) ^ crcTables[0][prev & 0xFF];
+        }
+    }
+    crcTablesReady = true;
+}
+
+uint32_t crc32UpdateTable(uint32_t crc, const uint8_t* data, size_t length) {
+    if (!crcTablesReady) {
+        crc32InitTables();
+    }
+    while (length--) {
+        crc = (crc >> 8) ^ crcTables[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+// Suppose une cible little-endian (ESP32, RP2040, x86).
+uint32_t crc32UpdateSlice8(uint32_t crc, const uint8_t* data, size_t length) {
+    if (!crcTablesReady) {
+        crc32InitTables();
+    }
+    while (length >= 8) {
+        uint32_t lo;
+        uint32_t hi;
+        memcpy(&lo, data, 4);
+        memcpy(&hi, data + 4, 4);
+        lo ^= crc;
+        crc = crcTables[7][lo & 0xFF] ^ crcTables[6][(lo >> 8) & 0xFF] ^
+              crcTables[5][(lo >> 16) & 0xFF] ^ crcTables[4][lo >> 24] ^
+              crcTables[3][hi & 0xFF] ^ crcTables[2][(hi >> 8) & 0xFF] ^
+              crcTables[1][(hi >> 16) & 0xFF] ^ crcTables[0][hi >> 24];
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = (crc >> 8) ^ crcTables[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef CRC32_HAS_ROM
+// crc32_le inverse l'état en entrée et en sortie: on le compense pour garder
+// le même chaînage que les autres variantes.
+uint32_t crc32UpdateRom(uint32_t crc, const uint8_t* data, size_t length) {
+    return ~esp_rom_crc32_le(~crc, data, length);
+}
+#endif
+
+const Crc32Variant crc32Variants[] = {
+    { "table", crc32UpdateTable },
+    { "slice8", crc32UpdateSlice8 },
+#ifdef CRC32_HAS_ROM
+    { "rom", crc32UpdateRom },
+#endif
+};
+const size_t crc32VariantCount = sizeof(crc32Variants) / sizeof(crc32Variants[0]);
+
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t length) {
+#if FLASHER_CRC32_IMPL == 2 && defined(CRC32_HAS_ROM)
+    return crc32UpdateRom(crc, data, length);
+#elif FLASHER_CRC32_IMPL == 0
+    return crc32UpdateTable(crc, data, length);
+#else
+    return crc32UpdateSlice8(crc, data, length);
+#endif
+}
+
+// Multiplication par une matrice 32x32 sur GF(2), une colonne par mot
+static uint32_t gf2MatrixTimes(const uint32_t* matrix, uint32_t vector) {
+    uint32_t sum = 0;
+    while (vector) {
+        if (vector & 1) {
+            sum ^= *matrix;
+        }
+        vector >>= 1;
+        matrix++;
+    }
+    return sum;
+}
+
+static void gf2MatrixSquare(uint32_t* square, const uint32_t* matrix) {
+    for (int n = 0; n < 32; n++) {
+        square[n] = gf2MatrixTimes(matrix, matrix[n]);
+    }
+}
+
+// Applique à crcA l'opérateur "ajouter lengthB octets nuls" par mises au
+// carré successives, puis y ajoute crcB.
+uint32_t crc32Combine(uint32_t crcA, uint32_t crcB, size_t lengthB) {
+    if (!lengthB) {
+        return crcA;
+    }
+    uint32_t even[32];
+    uint32_t odd[32];
+    odd[0] = 0xEDB88320; // opérateur pour un bit nul
+    uint32_t row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+    gf2MatrixSquare(even, odd);  // 2 bits
+    gf2MatrixSquare(odd, even);  // 4 bits
+    do {
+        gf2MatrixSquare(even, odd);
+        if (lengthB & 1) {
+            crcA = gf2MatrixTimes(even, crcA);
+        }
+        lengthB >>= 1;
+        if (!lengthB) {
+            break;
+        }
+        gf2MatrixSquare(odd, even);
+        if (lengthB & 1) {
+            crcA = gf2MatrixTimes(odd, crcA);
+        }
+        lengthB >>= 1;
+    } while (lengthB);
+    return crcA ^ crcB;
+}
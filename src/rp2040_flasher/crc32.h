@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC32 IEEE 802.3 (polynôme réfléchi 0xEDB88320), celui du bootloader RP2040.
+// L'état se chaîne bloc par bloc: on part de CRC32_INIT, on appelle une des
+// fonctions de mise à jour pour chaque bloc, et le CRC final vaut ~état.
+#define CRC32_INIT 0xFFFFFFFF
+
+typedef uint32_t (*Crc32UpdateFn)(uint32_t crc, const uint8_t* data, size_t length);
+
+// Variantes disponibles, toutes avec la même interface
+uint32_t crc32UpdateTable(uint32_t crc, const uint8_t* data, size_t length);   // 1 octet par itération, table 1 KiB
+uint32_t crc32UpdateSlice8(uint32_t crc, const uint8_t* data, size_t length);  // 8 octets par itération, tables 8 KiB
+#if defined(ESP_PLATFORM) && __has_include(<esp_rom_crc.h>)
+#define CRC32_HAS_ROM 1
+uint32_t crc32UpdateRom(uint32_t crc, const uint8_t* data, size_t length);     // crc32_le de la ROM de l'ESP32
+#endif
+
+struct Crc32Variant {
+    const char* name;
+    Crc32UpdateFn update;
+};
+extern const Crc32Variant crc32Variants[];
+extern const size_t crc32VariantCount;
+
+// Variante utilisée par le flasheur (choisie à la compilation par FLASHER_CRC32_IMPL)
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t length);
+
+// CRC de la concaténation A|B à partir des CRC finaux de A et B et de la
+// longueur de B (méthode de zlib), sans relire les données.
+uint32_t crc32Combine(uint32_t crcA, uint32_t crcB, size_t lengthB);
@@ -0,0 +1,454 @@
+#include "firmware_cache.h"
+#include "config.h"
+#include <LittleFS.h>
+
+// Table des images, copie du manifeste. Lue par la tâche du flasheur et
+// modifiée par les transports (async_tcp, BLE) et par le flasheur (copie
+// d'un flash en flux): les accès à la table se font sous verrou court
+// (CACHE_LOCK). Les modifications, fichiers compris, se font en plus une à
+// la fois sous STORE_LOCK, du choix des images à supprimer au manifeste.
+static CachedImage entries[FIRMWARE_CACHE_ENTRIES];
+static uint8_t entryCount = 0;
+static int selected = -1;          // index dans entries, -1 = /firmware.bin
+static uint32_t useClock = 0;
+
+#ifdef ESP_PLATFORM
+static portMUX_TYPE cacheLock = portMUX_INITIALIZER_UNLOCKED;
+#define CACHE_LOCK() portENTER_CRITICAL(&cacheLock)
+#define CACHE_UNLOCK() portEXIT_CRITICAL(&cacheLock)
+static SemaphoreHandle_t storeLock = nullptr;   // créé par firmwareCacheBegin()
+#define STORE_LOCK() do { if (storeLock) xSemaphoreTake(storeLock, portMAX_DELAY); } while (0)
+#define STORE_UNLOCK() do { if (storeLock) xSemaphoreGive(storeLock); } while (0)
+#else
+#define CACHE_LOCK()
+#define CACHE_UNLOCK()
+#define STORE_LOCK()
+#define STORE_UNLOCK()
+#endif
+
+// Les noms LittleFS sont courts (64 caractères chemin compris): le fichier
+// porte les 64 premiers bits de l'empreinte, le manifeste l'empreinte entière.
+#define ENTRY_NAME_BYTES 8
+static String entryPath(const uint8_t* sha256) {
+    return String(FIRMWARE_CACHE_DIR "/") + sha256Hex(sha256).substring(0, 2 * ENTRY_NAME_BYTES) + ".bin";
+}
+
+static String digestPath(const char* imagePath) {
+    return String(imagePath) + IMAGE_DIGEST_SUFFIX;
+}
+
+bool imageDigestSave(const char* imagePath, const ImageDigest& digest) {
+    File f = LittleFS.open(digestPath(imagePath), "w");
+    if (!f) {
+        return false;
+    }
+    String line = sha256Hex(digest.sha256) + " " + digest.size + " " + String(digest.crc32, HEX) + "\n";
+    bool ok = f.write((const uint8_t*)line.c_str(), line.length()) == line.length();
+    f.close();
+    return ok;
+}
+
+bool imageDigestLoad(const char* imagePath, ImageDigest& digest) {
+    File f = LittleFS.open(digestPath(imagePath), "r");
+    if (!f) {
+        return false;
+    }
+    char line[100];
+    int n = f.read((uint8_t*)line, sizeof(line) - 1);
+    f.close();
+    line[n > 0 ? n : 0] = 0;
+    char hex[2 * SHA256_SIZE + 1];
+    unsigned long size = 0, crc = 0;
+    if (sscanf(line, "%64s %lu %lx", hex, &size, &crc) != 3 || !sha256FromHex(hex, digest.sha256)) {
+        return false;
+    }
+    // Une empreinte qui ne correspond plus à l'image est ignorée
+    File image = LittleFS.open(imagePath, "r");
+    if (!image || image.size() != size) {
+        return false;
+    }
+    digest.size = size;
+    digest.crc32 = crc;
+    return true;
+}
+
+void imageDigestRemove(const char* imagePath) {
+    LittleFS.remove(digestPath(imagePath));
+}
+
+String imageDigestEvent(const ImageDigest& digest) {
+    return sha256Hex(digest.sha256) + ":" + String(digest.crc32, HEX);
+}
+
+static int findEntry(const uint8_t* sha256) {
+    for (int i = 0; i < entryCount; ++i) {
+        if (!memcmp(entries[i].sha256, sha256, SHA256_SIZE)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static uint32_t usedBytes() {
+    uint32_t used = 0;
+    for (int i = 0; i < entryCount; ++i) {
+        used += entries[i].size;
+    }
+    return used;
+}
+
+static void removeEntry(int index) {
+    CACHE_LOCK();
+    if (selected == index) {
+        selected = -1;
+    } else if (selected > index) {
+        selected--;
+    }
+    memmove(&entries[index], &entries[index + 1], (entryCount - index - 1) * sizeof(CachedImage));
+    entryCount--;
+    CACHE_UNLOCK();
+}
+
+static void saveManifest() {
+    CachedImage copy[FIRMWARE_CACHE_ENTRIES];
+    CACHE_LOCK();
+    uint8_t count = entryCount;
+    int current = selected;
+    memcpy(copy, entries, count * sizeof(CachedImage));
+    CACHE_UNLOCK();
+
+    String text;
+    text.reserve(count * 90 + 80);
+    for (int i = 0; i < count; ++i) {
+        text += sha256Hex(copy[i].sha256) + " " + copy[i].size + " " + copy[i].lastUse + "\n";
+    }
+    if (current >= 0) {
+        text += "selected " + sha256Hex(copy[current].sha256) + "\n";
+    }
+    File f = LittleFS.open(FIRMWARE_CACHE_MANIFEST, "w");
+    if (!f) {
+        DEBUG(println("Firmware cache: cannot write manifest"));
+        return;
+    }
+    f.write((const uint8_t*)text.c_str(), text.length());
+    f.close();
+}
+
+void firmwareCacheBegin() {
+#ifdef ESP_PLATFORM
+    if (!storeLock) {
+        storeLock = xSemaphoreCreateMutex();
+    }
+#endif
+    LittleFS.mkdir(FIRMWARE_CACHE_DIR);
+    entryCount = 0;
+    selected = -1;
+    useClock = 0;
+    File f = LittleFS.open(FIRMWARE_CACHE_MANIFEST, "r");
+    if (!f) {
+        return;
+    }
+    char line[100];
+    uint32_t length = 0;
+    int c = 0;
+    for (;;) {
+        uint8_t byte;
+        c = f.read(&byte, 1) == 1 ? byte : -1;
+        if (c >= 0 && c != '\n') {
+            if (length < sizeof(line) - 1) {
+                line[length++] = c;
+            }
+            continue;
+        }
+        line[length] = 0;
+        length = 0;
+        char hex[2 * SHA256_SIZE + 1];
+        unsigned long size = 0, lastUse = 0;
+        CachedImage entry;
+        if (sscanf(line, "selected %64s", hex) == 1 && sha256FromHex(hex, entry.sha256)) {
+            selected = findEntry(entry.sha256);
+        } else if (sscanf(line, "%64s %lu %lu", hex, &size, &lastUse) == 3 && sha256FromHex(hex, entry.sha256) &&
+                   entryCount < FIRMWARE_CACHE_ENTRIES) {
+            // Une image dont le fichier manque ou a changé de taille est oubliée
+            File image = LittleFS.open(entryPath(entry.sha256), "r");
+            if (image && image.size() == size) {
+                entry.size = size;
+                entry.lastUse = lastUse;
+                entries[entryCount++] = entry;
+                if (lastUse > useClock) {
+                    useClock = lastUse;
+                }
+            }
+        }
+        if (c < 0) {
+            break;
+        }
+    }
+    f.close();
+    DEBUG(printf("Firmware cache: %u images, %lu bytes\n", entryCount, (unsigned long)usedBytes()));
+}
+
+static bool hashFile(File& f, uint8_t* sha256) {
+    uint8_t* buffer = (uint8_t*)malloc(4096);
+    if (!buffer) {
+        return false;
+    }
+    Sha256 hash;
+    int n;
+    while ((n = f.read(buffer, 4096)) > 0) {
+        hash.update(buffer, n);
+    }
+    hash.finish(sha256);
+    free(buffer);
+    return true;
+}
+
+// Supprime l'image utilisée le moins récemment, sauf celles qu'un flash est
+// en train de lire; false s'il n'y en a pas. Sous STORE_LOCK.
+static bool evictOldest() {
+    int oldest = -1;
+    CACHE_LOCK();
+    for (int i = 0; i < entryCount; ++i) {
+        if (!entries[i].readers && (oldest < 0 || entries[i].lastUse < entries[oldest].lastUse)) {
+            oldest = i;
+        }
+    }
+    CACHE_UNLOCK();
+    if (oldest < 0) {
+        return false;
+    }
+    DEBUG(printf("Firmware cache: evicting %s\n", sha256Hex(entries[oldest].sha256).c_str()));
+    String evicted = entryPath(entries[oldest].sha256);
+    removeEntry(oldest);
+    LittleFS.remove(evicted);
+    imageDigestRemove(evicted.c_str());
+    return true;
+}
+
+// Suite de firmwareCacheStore(), sous STORE_LOCK
+static bool storeLocked(const char* path, CachedImage& entry, bool hashed) {
+    // Dans tous les cas l'ancienne sélection ne correspond plus au dernier
+    // téléversement
+    CACHE_LOCK();
+    selected = -1;
+    CACHE_UNLOCK();
+    if (!hashed || entry.size > FIRMWARE_CACHE_BUDGET) {
+        saveManifest();
+        return false;
+    }
+
+    int index = findEntry(entry.sha256);
+    if (index >= 0) {
+        LittleFS.remove(path);  // déjà en cache
+        imageDigestRemove(path);
+    } else {
+        // Place libérée en partant de l'image utilisée le moins récemment,
+        // sauf celles qu'un flash est en train de lire
+        while (entryCount == FIRMWARE_CACHE_ENTRIES || usedBytes() + entry.size > FIRMWARE_CACHE_BUDGET) {
+            if (!evictOldest()) {
+                DEBUG(println("Firmware cache: no room, images in use"));
+                saveManifest();
+                return false;
+            }
+        }
+        String target = entryPath(entry.sha256);
+        LittleFS.remove(target);
+        if (!LittleFS.rename(path, target.c_str())) {
+            saveManifest();
+            return false;
+        }
+        imageDigestRemove(target.c_str());
+        LittleFS.rename(digestPath(path).c_str(), digestPath(target.c_str()).c_str());
+        entry.readers = 0;
+        CACHE_LOCK();
+        index = entryCount;
+        entries[entryCount++] = entry;
+        CACHE_UNLOCK();
+    }
+    CACHE_LOCK();
+    entries[index].lastUse = ++useClock;
+    selected = index;
+    CACHE_UNLOCK();
+    saveManifest();
+    return true;
+}
+
+bool firmwareCacheStore(const char* path, const uint8_t* sha256) {
+    CachedImage entry;
+    File f = LittleFS.open(path, "r");
+    if (!f) {
+        return false;
+    }
+    entry.size = f.size();
+    bool hashed = true;
+    ImageDigest digest;
+    if (sha256) {
+        memcpy(entry.sha256, sha256, SHA256_SIZE);
+    } else if (imageDigestLoad(path, digest)) {
+        memcpy(entry.sha256, digest.sha256, SHA256_SIZE);
+    } else {
+        hashed = hashFile(f, entry.sha256);
+    }
+    f.close();
+
+    STORE_LOCK();
+    bool stored = storeLocked(path, entry, hashed);
+    STORE_UNLOCK();
+    return stored;
+}
+
+bool firmwareCacheSelect(const char* hex) {
+    uint8_t sha256[SHA256_SIZE];
+    if (hex && !sha256FromHex(hex, sha256)) {
+        return false;
+    }
+    STORE_LOCK();
+    int index = hex ? findEntry(sha256) : -1;
+    if (hex && index < 0) {
+        STORE_UNLOCK();
+        return false;
+    }
+    CACHE_LOCK();
+    if (index >= 0) {
+        entries[index].lastUse = ++useClock;
+    }
+    selected = index;
+    CACHE_UNLOCK();
+    saveManifest();
+    STORE_UNLOCK();
+    return true;
+}
+
+String firmwareImagePath() {
+    uint8_t sha256[SHA256_SIZE];
+    CACHE_LOCK();
+    bool cached = selected >= 0;
+    if (cached) {
+        memcpy(sha256, entries[selected].sha256, SHA256_SIZE);
+    }
+    CACHE_UNLOCK();
+    return cached ? entryPath(sha256) : String("/firmware.bin");
+}
+
+// Préfixe de l'empreinte lu dans le nom de path (voir entryPath()); false
+// pour un fichier hors cache
+static bool entryPrefix(const char* path, uint8_t* sha256) {
+    size_t dir = strlen(FIRMWARE_CACHE_DIR "/");
+    const char* name = path + dir;
+    if (strncmp(path, FIRMWARE_CACHE_DIR "/", dir) || strlen(name) != 2 * ENTRY_NAME_BYTES + 4 ||
+        strcmp(name + 2 * ENTRY_NAME_BYTES, ".bin")) {
+        return false;
+    }
+    char hex[2 * SHA256_SIZE + 1];
+    memset(hex, '0', 2 * SHA256_SIZE);
+    memcpy(hex, name, 2 * ENTRY_NAME_BYTES);
+    hex[2 * SHA256_SIZE] = 0;
+    return sha256FromHex(hex, sha256);
+}
+
+// Entrée de préfixe sha256, -1 sinon; sous CACHE_LOCK
+static int entryOfPrefix(const uint8_t* sha256) {
+    for (int i = 0; i < entryCount; ++i) {
+        if (!memcmp(entries[i].sha256, sha256, ENTRY_NAME_BYTES)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void firmwareCacheAcquire(const char* path) {
+    uint8_t sha256[SHA256_SIZE];
+    if (!entryPrefix(path, sha256)) {
+        return;
+    }
+    STORE_LOCK();
+    CACHE_LOCK();
+    int index = entryOfPrefix(sha256);
+    if (index >= 0) {
+        entries[index].readers++;
+    }
+    CACHE_UNLOCK();
+    STORE_UNLOCK();
+}
+
+String firmwareImageAcquire() {
+    uint8_t sha256[SHA256_SIZE];
+    STORE_LOCK();
+    CACHE_LOCK();
+    bool cached = selected >= 0;
+    if (cached) {
+        entries[selected].readers++;
+        memcpy(sha256, entries[selected].sha256, SHA256_SIZE);
+    }
+    CACHE_UNLOCK();
+    STORE_UNLOCK();
+    return cached ? entryPath(sha256) : String("/firmware.bin");
+}
+
+void firmwareCacheRelease(const char* path) {
+    uint8_t sha256[SHA256_SIZE];
+    if (!entryPrefix(path, sha256)) {
+        return;
+    }
+    STORE_LOCK();
+    CACHE_LOCK();
+    int index = entryOfPrefix(sha256);
+    if (index >= 0 && entries[index].readers) {
+        entries[index].readers--;
+    }
+    CACHE_UNLOCK();
+    STORE_UNLOCK();
+}
+
+bool firmwareCacheReclaim(uint32_t bytes) {
+    STORE_LOCK();
+    uint32_t reclaimable = 0;
+    CACHE_LOCK();
+    for (int i = 0; i < entryCount; ++i) {
+        if (!entries[i].readers) {
+            reclaimable += entries[i].size;
+        }
+    }
+    CACHE_UNLOCK();
+    if (reclaimable < bytes) {
+        STORE_UNLOCK();
+        return false;
+    }
+    uint32_t keep = usedBytes() - bytes;
+    while (usedBytes() > keep && evictOldest()) {
+        // suivante
+    }
+    saveManifest();
+    STORE_UNLOCK();
+    return true;
+}
+
+String firmwareCacheSelected() {
+    uint8_t sha256[SHA256_SIZE];
+    CACHE_LOCK();
+    bool cached = selected >= 0;
+    if (cached) {
+        memcpy(sha256, entries[selected].sha256, SHA256_SIZE);
+    }
+    CACHE_UNLOCK();
+    return cached ? sha256Hex(sha256) : String();
+}
+
+String firmwareCacheJson() {
+    CachedImage copy[FIRMWARE_CACHE_ENTRIES];
+    CACHE_LOCK();
+    uint8_t count = entryCount;
+    int current = selected;
+    memcpy(copy, entries, count * sizeof(CachedImage));
+    CACHE_UNLOCK();
+
+    uint32_t used = 0;
+    String images;
+    for (int i = 0; i < count; ++i) {
+        used += copy[i].size;
+        images += String(i ? "," : "") + "{\"sha256\":\"" + sha256Hex(copy[i].sha256) +
+                  "\",\"size\":" + copy[i].size + ",\"lastUse\":" + copy[i].lastUse + "}";
+    }
+    return String("{\"budget\":") + FIRMWARE_CACHE_BUDGET + ",\"used\":" + used + ",\"selected\":\"" +
+           (current >= 0 ? sha256Hex(copy[current].sha256) : String()) + "\",\"images\":[" + images + "]}";
+}
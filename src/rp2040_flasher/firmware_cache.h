@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Arduino.h>
+#include "sha256.h"
+
+// Images déjà téléversées, rangées sur LittleFS sous leur SHA-256. Un client
+// envoie d'abord l'empreinte de son image: si elle est en cache, elle est
+// sélectionnée et le téléversement est inutile. L'image sélectionnée est
+// celle que flashent le RP2040 et l'OTA de l'ESP32; sans sélection, c'est
+// /firmware.bin. Les moins récemment utilisées sont supprimées pour rester
+// dans FIRMWARE_CACHE_BUDGET octets.
+#ifndef FIRMWARE_CACHE_BUDGET
+#define FIRMWARE_CACHE_BUDGET (1024 * 1024)
+#endif
+#define FIRMWARE_CACHE_ENTRIES 8
+#define FIRMWARE_CACHE_DIR "/fw"
+// Une ligne par image "<sha256> <taille> <dernière utilisation>", puis
+// "selected <sha256>" si une image est sélectionnée
+#define FIRMWARE_CACHE_MANIFEST FIRMWARE_CACHE_DIR "/manifest"
+
+// Empreintes d'une image calculées pendant sa réception, rangées à côté
+// d'elle dans "<image>.meta" (une ligne "<sha256> <taille> <crc32>"): le
+// cache n'a pas à relire l'image pour la ranger, le flasheur vérifie le CRC
+// de ce qu'il relit, et le client compare le SHA-256 au sien.
+#define IMAGE_DIGEST_SUFFIX ".meta"
+
+struct ImageDigest {
+    uint8_t sha256[SHA256_SIZE];
+    uint32_t size;
+    uint32_t crc32;        // CRC final (voir crc32.h)
+};
+
+bool imageDigestSave(const char* imagePath, const ImageDigest& digest);
+// false sans empreinte, ou si elle ne correspond pas à la taille de l'image
+bool imageDigestLoad(const char* imagePath, ImageDigest& digest);
+// À appeler avant de réécrire une image
+void imageDigestRemove(const char* imagePath);
+// "<sha256>:<crc32>" pour EVENT:UPLOAD_COMPLETE
+String imageDigestEvent(const ImageDigest& digest);
+
+struct CachedImage {
+    uint8_t sha256[SHA256_SIZE];
+    uint32_t size;
+    uint32_t lastUse;      // horloge logique, croît à chaque sélection
+    uint8_t readers = 0;   // flashs en cours qui lisent l'image (non persisté)
+};
+
+// Relit le manifeste; à appeler après LittleFS.begin()
+void firmwareCacheBegin();
+// Range le fichier path (en général /firmware.bin, qui est déplacé avec son
+// empreinte) dans le cache et le sélectionne. sha256 = empreinte déjà
+// calculée, ou nullptr pour reprendre celle du .meta, à défaut relire le
+// fichier. false si l'image dépasse le budget (ou que la place est prise
+// par des images en cours de flash): elle reste alors en place,
+// sélectionnée comme fichier par défaut.
+bool firmwareCacheStore(const char* path, const uint8_t* sha256 = nullptr);
+// Sélectionne l'image d'empreinte hex (64 chiffres hexa); false si elle n'est
+// pas en cache. nullptr revient à /firmware.bin.
+bool firmwareCacheSelect(const char* hex);
+// Fichier à flasher: image sélectionnée, sinon /firmware.bin
+String firmwareImagePath();
+// Image de path lue par un flash: jamais supprimée du cache avant
+// firmwareCacheRelease(). Sans effet pour un fichier hors cache.
+void firmwareCacheAcquire(const char* path);
+// firmwareImagePath() et firmwareCacheAcquire() d'un coup: l'image ne peut
+// pas être supprimée entre les deux
+String firmwareImageAcquire();
+void firmwareCacheRelease(const char* path);
+// Libère au moins bytes octets de LittleFS en supprimant des images, les
+// moins récemment utilisées d'abord, sauf celles en cours de flash. false,
+// sans rien supprimer, si elles ne suffisent pas.
+bool firmwareCacheReclaim(uint32_t bytes);
+// Empreinte de l'image sélectionnée, "" sans sélection
+String firmwareCacheSelected();
+// Contenu du cache pour GET /cache
+String firmwareCacheJson();
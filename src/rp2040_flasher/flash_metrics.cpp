@@ -0,0 +1,152 @@
+#include "flash_metrics.h"
+
+// Historique circulaire: écrit par la boucle du flasheur, lu par le serveur
+// web (tâche async_tcp). Les copies se font sous verrou, le formatage après.
+static FlashRun history[FLASH_METRICS_RUNS];
+static uint8_t historyHead = 0;    // prochain emplacement
+static uint8_t historyCount = 0;
+static uint32_t nextRunId = 1;
+static uint32_t runsOk = 0;
+static uint32_t runsFailed = 0;
+
+#ifdef ESP_PLATFORM
+static portMUX_TYPE historyLock = portMUX_INITIALIZER_UNLOCKED;
+#define HISTORY_LOCK() portENTER_CRITICAL(&historyLock)
+#define HISTORY_UNLOCK() portEXIT_CRITICAL(&historyLock)
+#else
+#define HISTORY_LOCK()
+#define HISTORY_UNLOCK()
+#endif
+
+uint32_t recordFlashRun(FlashRun& run) {
+    HISTORY_LOCK();
+    run.id = nextRunId++;
+    history[historyHead] = run;
+    historyHead = (historyHead + 1) % FLASH_METRICS_RUNS;
+    if (historyCount < FLASH_METRICS_RUNS) {
+        historyCount++;
+    }
+    if (run.success) {
+        runsOk++;
+    } else {
+        runsFailed++;
+    }
+    HISTORY_UNLOCK();
+    return run.id;
+}
+
+uint8_t flashRunHistory(FlashRun* runs) {
+    HISTORY_LOCK();
+    uint8_t count = historyCount;
+    for (uint8_t i = 0; i < count; ++i) {
+        runs[i] = history[(historyHead + FLASH_METRICS_RUNS - count + i) % FLASH_METRICS_RUNS];
+    }
+    HISTORY_UNLOCK();
+    return count;
+}
+
+// Microsecondes en secondes, sans passer par les flottants. Sur 64 bits: la
+// durée totale en ms dépasse 2^32 µs au bout de 71 minutes.
+static String seconds(uint64_t us) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%lu.%06lu", (unsigned long)(us / 1000000), (unsigned long)(us % 1000000));
+    return buf;
+}
+
+// Copies statiques plutôt que sur la pile de la tâche async_tcp
+String flashMetricsJson() {
+    static FlashRun runs[FLASH_METRICS_RUNS];
+    uint8_t count = flashRunHistory(runs);
+    String json;
+    json.reserve(count * 900 + 64);
+    json += String("{\"ok\":") + runsOk + ",\"failed\":" + runsFailed + ",\"runs\":[";
+    for (uint8_t i = 0; i < count; ++i) {
+        const FlashRun& r = runs[i];
+        json += String(i ? "," : "") + "{\"id\":" + r.id + ",\"target\":" + r.target +
+                ",\"success\":" + (r.success ? "true" : "false") + ",\"end_ms\":" + r.endMs +
+                ",\"image_bytes\":" + r.imageSize + ",\"baud\":" + r.baud + ",\"write_block\":" + r.writeBlock + ",\"total_ms\":" + r.totalMs +
+                ",\"phases\":{";
+        for (int p = 0; p < FLASH_PHASES; ++p) {
+            json += String(p ? "," : "") + "\"" + flashPhaseName(p) + "\":{\"us\":" + r.phaseUs[p] +
+                    ",\"bytes\":" + r.phaseBytes[p] + "}";
+        }
+        json += "},\"rtt_us\":{";
+        bool first = true;
+        for (int c = 0; c < RTT_COMMANDS; ++c) {
+            if (!r.rtt[c].count) {
+                continue;
+            }
+            json += String(first ? "" : ",") + "\"" + rttCommandName(c) + "\":{\"count\":" + r.rtt[c].count +
+                    ",\"min\":" + r.rtt[c].minUs + ",\"avg\":" + r.rtt[c].avgUs + ",\"max\":" + r.rtt[c].maxUs + "}";
+            first = false;
+        }
+        json += "},\"retries\":{";
+        for (int k = 0; k < FLASH_RETRIES; ++k) {
+            json += String(k ? "," : "") + "\"" + flashRetryName(k) + "\":" + r.retries[k];
+        }
+        json += "}}";
+    }
+    json += "]}";
+    return json;
+}
+
+String flashMetricsPrometheus() {
+    static FlashRun runs[FLASH_METRICS_RUNS];
+    uint8_t count = flashRunHistory(runs);
+    String text;
+    text.reserve(count * 2400 + 512);
+    text += String("# TYPE rp2040_flash_runs_total counter\n"
+                   "rp2040_flash_runs_total{result=\"ok\"} ") + runsOk +
+            "\nrp2040_flash_runs_total{result=\"failed\"} " + runsFailed + "\n";
+    text += "# TYPE rp2040_flash_duration_seconds gauge\n"
+            "# TYPE rp2040_flash_image_bytes gauge\n"
+            "# TYPE rp2040_flash_baud gauge\n"
+            "# TYPE rp2040_flash_write_block_bytes gauge\n"
+            "# TYPE rp2040_flash_phase_seconds gauge\n"
+            "# TYPE rp2040_flash_phase_bytes gauge\n"
+            "# TYPE rp2040_flash_rtt_seconds gauge\n"
+            "# TYPE rp2040_flash_rtt_count gauge\n"
+            "# TYPE rp2040_flash_retries gauge\n";
+    for (uint8_t i = 0; i < count; ++i) {
+        const FlashRun& r = runs[i];
+        String labels = String("run=\"") + r.id + "\",target=\"" + r.target + "\"";
+        text += String("rp2040_flash_duration_seconds{") + labels + ",result=\"" + (r.success ? "ok" : "failed") +
+                "\"} " + seconds((uint64_t)r.totalMs * 1000) + "\n";
+        text += String("rp2040_flash_image_bytes{") + labels + "} " + r.imageSize + "\n";
+        text += String("rp2040_flash_baud{") + labels + "} " + r.baud + "\n";
+        text += String("rp2040_flash_write_block_bytes{") + labels + "} " + r.writeBlock + "\n";
+        for (int p = 0; p < FLASH_PHASES; ++p) {
+            String l = labels + ",phase=\"" + flashPhaseName(p) + "\"} ";
+            text += "rp2040_flash_phase_seconds{" + l + seconds(r.phaseUs[p]) + "\n";
+            text += "rp2040_flash_phase_bytes{" + l + r.phaseBytes[p] + "\n";
+        }
+        for (int c = 0; c < RTT_COMMANDS; ++c) {
+            if (!r.rtt[c].count) {
+                continue;
+            }
+            String l = labels + ",command=\"" + rttCommandName(c) + "\"";
+            text += "rp2040_flash_rtt_count{" + l + "} " + r.rtt[c].count + "\n";
+            text += "rp2040_flash_rtt_seconds{" + l + ",stat=\"min\"} " + seconds(r.rtt[c].minUs) + "\n";
+            text += "rp2040_flash_rtt_seconds{" + l + ",stat=\"avg\"} " + seconds(r.rtt[c].avgUs) + "\n";
+            text += "rp2040_flash_rtt_seconds{" + l + ",stat=\"max\"} " + seconds(r.rtt[c].maxUs) + "\n";
+        }
+        for (int k = 0; k < FLASH_RETRIES; ++k) {
+            text += "rp2040_flash_retries{" + labels + ",kind=\"" + flashRetryName(k) + "\"} " + r.retries[k] + "\n";
+        }
+    }
+    return text;
+}
+
+String flashRunEvent(const FlashRun& run) {
+    String event = String("EVENT:METRICS:") + run.id + ":" + run.target + ":" + (run.success ? 1 : 0) + ":" +
+                   run.totalMs + ":" + run.imageSize + ":";
+    for (int p = 0; p < FLASH_PHASES; ++p) {
+        event += String(p ? "," : "") + run.phaseUs[p];
+    }
+    const auto& w = run.rtt[RTT_WRITE];
+    event += String(":") + w.minUs + "/" + w.avgUs + "/" + w.maxUs + ":";
+    for (int k = 0; k < FLASH_RETRIES; ++k) {
+        event += String(k ? "," : "") + run.retries[k];
+    }
+    return event;
+}
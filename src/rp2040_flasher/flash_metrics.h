@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Arduino.h>
+#include "rp2040_flasher.h"
+
+// Nombre de flashs conservés, toutes cibles confondues
+#ifndef FLASH_METRICS_RUNS
+#define FLASH_METRICS_RUNS 8
+#endif
+
+// Ajoute un bilan à l'historique (le plus ancien est oublié) et lui attribue
+// son numéro. Appelé par le flasheur; la lecture peut venir d'une autre tâche.
+uint32_t recordFlashRun(FlashRun& run);
+// Copie l'historique, du plus ancien au plus récent; renvoie le nombre de bilans
+uint8_t flashRunHistory(FlashRun* runs);
+
+// Historique pour GET /metrics.json et GET /metrics (format texte Prometheus)
+String flashMetricsJson();
+String flashMetricsPrometheus();
+// Bilan sur une ligne, pour une notification BLE:
+// EVENT:METRICS:<n°>:<cible>:<ok>:<ms>:<octets>:<µs par phase>:<RTT WRITE min/moy/max µs>:<reprises>
+String flashRunEvent(const FlashRun& run);
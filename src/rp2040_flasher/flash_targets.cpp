@@ -0,0 +1,392 @@
+#include "flash_targets.h"
+#include "flash_metrics.h"
+#include "config.h"
+#include "uploader.h"
+
+extern Uploader* uploader;
+
+#ifdef RP2040_TARGET2_UART
+extern FlasherEngine target2Flasher;
+#endif
+#ifdef RP2040_TARGET3_UART
+extern FlasherEngine target3Flasher;
+#endif
+
+FlashTarget flashTargets[] = {
+    FlashTarget(1, &rp2040Flasher, RESETRP2040_PIN, BOOTLOADER_PIN),
+#ifdef RP2040_TARGET2_UART
+    FlashTarget(2, &target2Flasher, RP2040_TARGET2_RESET_PIN, RP2040_TARGET2_BOOT_PIN),
+#endif
+#ifdef RP2040_TARGET3_UART
+    FlashTarget(3, &target3Flasher, RP2040_TARGET3_RESET_PIN, RP2040_TARGET3_BOOT_PIN),
+#endif
+};
+const uint8_t flashTargetCount = sizeof(flashTargets) / sizeof(flashTargets[0]);
+static_assert(sizeof(flashTargets) / sizeof(flashTargets[0]) <= MAX_FLASH_TARGETS, "trop de cibles RP2040");
+
+FlasherEngine rp2040Flasher(SerialRP2040, flashTargets[0], BOOTLOADER_PIN);
+#ifdef RP2040_TARGET2_UART
+FlasherEngine target2Flasher(RP2040_TARGET2_UART, flashTargets[1], RP2040_TARGET2_BOOT_PIN);
+#endif
+#ifdef RP2040_TARGET3_UART
+FlasherEngine target3Flasher(RP2040_TARGET3_UART, flashTargets[flashTargetCount - 1], RP2040_TARGET3_BOOT_PIN);
+#endif
+
+// Bit i = flashTargets[i]
+static uint32_t selectedMask = (1u << (sizeof(flashTargets) / sizeof(flashTargets[0]))) - 1;
+
+// Lot en cours: les cibles lancées ensemble par startFlashTargets()
+static bool batchRunning = false;
+static uint8_t batchSize = 0;
+static uint32_t batchStart = 0;
+
+static bool selected(const FlashTarget& t) {
+    return selectedMask & (1u << (&t - flashTargets));
+}
+
+static uint8_t selectedCount() {
+    return __builtin_popcount(selectedMask);
+}
+
+// Commandes transmises à la tâche du flasheur
+enum FlasherRequest : uint8_t {
+    REQUEST_PREPARE,
+    REQUEST_START,
+    REQUEST_START_DIFF,
+    REQUEST_STREAM
+};
+// Flux demandé (REQUEST_STREAM) et résultat, rendu par streamDone
+static FlashTarget* streamTarget = nullptr;
+static uint32_t streamTotal = 0;
+static bool streamStage = false;
+static bool streamStarted = false;
+
+#ifdef ESP_PLATFORM
+static SemaphoreHandle_t streamLock = nullptr;   // une demande de flux à la fois
+static SemaphoreHandle_t streamDone = nullptr;
+static QueueHandle_t flasherRequests = nullptr;
+static TaskHandle_t flasherTask = nullptr;
+static void runFlasherTask(void*);
+#endif
+
+// true si la commande est confiée à la tâche du flasheur, false s'il faut
+// l'exécuter sur place (on est dans cette tâche, ou il n'y en a pas)
+static bool postRequest(FlasherRequest request) {
+#ifdef ESP_PLATFORM
+    if (!flasherTask || xTaskGetCurrentTaskHandle() == flasherTask) {
+        return false;
+    }
+    if (xQueueSend(flasherRequests, &request, pdMS_TO_TICKS(100)) != pdTRUE) {
+        if (uploader) {
+            uploader->notifyClients("error:Flasheur occupé, commande ignorée.");
+        }
+        return true;
+    }
+    xTaskNotifyGive(flasherTask);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void FlashTarget::flasherMessage(const String& message) {
+    if (message == "EVENT:FLASH_COMPLETE") {
+        succeeded = true;
+        if (batchSize > 1) {
+            return; // annoncé une fois pour tout le lot
+        }
+    }
+    if (!uploader) {
+        return;
+    }
+    int colon = message.indexOf(":");
+    if (selectedCount() <= 1 || colon < 0 || message.startsWith("EVENT:")) {
+        uploader->notifyClients(message);
+        return;
+    }
+    uploader->notifyClients(message.substring(0, colon + 1) + "[cible " + number + "] " + message.substring(colon + 1));
+}
+
+void FlashTarget::flasherSynced() {
+    synced = true;
+    rp2040BootloaderActive = true;
+}
+
+// Bilan du flash: historique de /metrics et résumé d'une ligne pour l'interface
+void FlashTarget::flasherRunFinished(const FlashRun& run) {
+    FlashRun r = run;
+    r.target = number;
+    recordFlashRun(r);
+    if (uploader) {
+        uploader->notifyClients(flashRunEvent(r));
+    }
+}
+
+void flasherBegin() {
+#ifdef RP2040_TARGET2_UART
+    RP2040_TARGET2_UART.setTxBufferSize(RP2040_SERIAL_TX_BUFFER);
+    RP2040_TARGET2_UART.begin(RP2040_SERIAL_BAUD, SERIAL_8N1, RP2040_TARGET2_RX_PIN, RP2040_TARGET2_TX_PIN);
+#endif
+#ifdef RP2040_TARGET3_UART
+    RP2040_TARGET3_UART.setTxBufferSize(RP2040_SERIAL_TX_BUFFER);
+    RP2040_TARGET3_UART.begin(RP2040_SERIAL_BAUD, SERIAL_8N1, RP2040_TARGET3_RX_PIN, RP2040_TARGET3_TX_PIN);
+#endif
+    static const char* const checkpointKeys[MAX_FLASH_TARGETS] = { "cible1", "cible2", "cible3" };
+    for (FlashTarget& t : flashTargets) {
+        // Broches de la cible 1 configurées par setup()
+        if (t.number > 1) {
+            pinMode(t.resetPin, OUTPUT);
+            digitalWrite(t.resetPin, HIGH);
+            pinMode(t.bootPin, OUTPUT);
+            digitalWrite(t.bootPin, HIGH);
+        }
+        t.engine->setCheckpointKey(checkpointKeys[t.number - 1]);
+    }
+#ifdef ESP_PLATFORM
+    flasherRequests = xQueueCreate(8, sizeof(FlasherRequest));
+    streamLock = xSemaphoreCreateMutex();
+    streamDone = xSemaphoreCreateBinary();
+    xTaskCreatePinnedToCore(runFlasherTask, "flasher", FLASHER_TASK_STACK, nullptr,
+                            FLASHER_TASK_PRIORITY, &flasherTask, FLASHER_TASK_CORE);
+#else
+    for (FlashTarget& t : flashTargets) {
+        t.engine->begin();
+    }
+#endif
+}
+
+// Dans la tâche du flasheur, seule à lire streamImage: l'anneau n'est remis
+// à zéro que si aucun flux n'est en cours et que la cible est libre
+static bool startStream() {
+    FlashTarget* target = streamTarget;
+    if (target->engine->status().state != IDLE || streamImage.active() ||
+        !streamImage.begin(streamTotal, streamStage)) {
+        return false;
+    }
+    digitalWrite(target->bootPin, HIGH);
+    target->engine->setDifferential(false);
+    target->engine->setSource(&streamImage);
+    target->engine->start(SEND_INFO_COMMAND);
+    return true;
+}
+
+bool startStreamFlash(uint32_t total, bool stage) {
+    // Un seul consommateur pour le flux: la première cible sélectionnée
+    FlashTarget* target = nullptr;
+    for (FlashTarget& t : flashTargets) {
+        if (selected(t)) {
+            target = &t;
+            break;
+        }
+    }
+    if (!target || !total || target->engine->status().state != IDLE || streamImage.active()) {
+        return false;
+    }
+#ifdef ESP_PLATFORM
+    if (streamLock) {
+        xSemaphoreTake(streamLock, portMAX_DELAY);
+    }
+    if (streamDone) {
+        xSemaphoreTake(streamDone, 0); // réponse d'une attente expirée
+    }
+#endif
+    streamTarget = target;
+    streamTotal = total;
+    streamStage = stage;
+    streamStarted = false;
+    bool started;
+    if (!postRequest(REQUEST_STREAM)) {
+        started = startStream();
+    } else {
+#ifdef ESP_PLATFORM
+        // Le transport écrit dans streamImage dès le retour: on attend qu'il
+        // soit ouvert
+        started = xSemaphoreTake(streamDone, pdMS_TO_TICKS(FLASHER_STREAM_START_MS)) == pdTRUE && streamStarted;
+#else
+        started = false;
+#endif
+    }
+#ifdef ESP_PLATFORM
+    if (streamLock) {
+        xSemaphoreGive(streamLock);
+    }
+#endif
+    if (started && selectedCount() > 1 && uploader) {
+        uploader->notifyClients(String("log:Flash en flux: seule la cible ") + target->number + " est flashée.");
+    }
+    return started;
+}
+
+bool selectFlashTargets(uint32_t mask) {
+    mask &= (1u << flashTargetCount) - 1;
+    if (!mask) {
+        return false;
+    }
+    for (FlashTarget& t : flashTargets) {
+        if (t.engine->status().state != IDLE) {
+            return false; // pas pendant un flash
+        }
+    }
+    selectedMask = mask;
+    return true;
+}
+
+uint32_t selectedFlashTargets() {
+    return selectedMask;
+}
+
+String flashTargetsEvent() {
+    return String("EVENT:TARGETS:") + flashTargetCount + ":" + selectedMask;
+}
+
+void prepareFlashTargets() {
+    if (postRequest(REQUEST_PREPARE)) {
+        return;
+    }
+    for (FlashTarget& t : flashTargets) {
+        t.synced = false;
+        if (selected(t)) {
+            digitalWrite(t.bootPin, LOW);
+        }
+    }
+    delay(10);
+    for (FlashTarget& t : flashTargets) {
+        if (selected(t)) {
+            digitalWrite(t.resetPin, LOW);
+        }
+    }
+    delay(100);
+    for (FlashTarget& t : flashTargets) {
+        if (selected(t)) {
+            digitalWrite(t.resetPin, HIGH);
+        }
+    }
+    delay(100);
+    for (FlashTarget& t : flashTargets) {
+        if (selected(t)) {
+            t.engine->start();
+        }
+    }
+}
+
+void startFlashTargets(bool differential) {
+    if (postRequest(differential ? REQUEST_START_DIFF : REQUEST_START)) {
+        return;
+    }
+    uint8_t started = 0;
+    for (FlashTarget& t : flashTargets) {
+        t.running = false;
+        t.succeeded = false;
+        if (!selected(t)) {
+            continue;
+        }
+        if (!t.synced) {
+            t.engine->stop();
+            t.flasherMessage("error:RP2040 pas en mode bootloader, cible ignorée.");
+            continue;
+        }
+        digitalWrite(t.bootPin, HIGH);
+        t.engine->setSource(nullptr);
+        t.engine->setDifferential(differential);
+        t.engine->start(SEND_INFO_COMMAND);
+        t.running = true;
+        started++;
+    }
+    batchRunning = started > 0;
+    batchSize = started;
+    batchStart = millis();
+}
+
+// Fin du lot: une cible n'est plus occupée quand son flash a abouti ou échoué
+static void checkBatch() {
+    uint8_t done = 0;
+    uint8_t succeeded = 0;
+    for (FlashTarget& t : flashTargets) {
+        if (!t.running) {
+            continue;
+        }
+        if (t.engine->busy()) {
+            return;
+        }
+        done++;
+        succeeded += t.succeeded;
+    }
+    batchRunning = false;
+    if (batchSize <= 1 || !uploader) {
+        batchSize = 0;
+        return;
+    }
+    uint32_t elapsed = millis() - batchStart;
+    uint32_t perHour = elapsed ? (uint32_t)((uint64_t)succeeded * 3600000 / elapsed) : 0;
+    uploader->notifyClients(String("log:Lot terminé: ") + succeeded + "/" + done + " cibles flashées en " + elapsed +
+                            " ms (" + perHour + " flashs/heure).");
+    if (succeeded == done) {
+        uploader->notifyClients("EVENT:FLASH_COMPLETE");
+    } else {
+        String failed;
+        for (FlashTarget& t : flashTargets) {
+            if (t.running && !t.succeeded) {
+                failed += String(failed.length() ? ", " : "") + t.number;
+            }
+        }
+        uploader->notifyClients("error:Échec du flash sur la cible " + failed + ".");
+    }
+    for (FlashTarget& t : flashTargets) {
+        t.running = false;
+    }
+    batchSize = 0;
+}
+
+// Fait avancer tous les flasheurs. Si aucun n'a de travail local en cours
+// (STEP_BUSY), on dort jusqu'à la prochaine réception UART (1 ms au plus).
+void handleFlasher() {
+    bool advanced = false;
+    for (FlashTarget& t : flashTargets) {
+        if (t.engine->busy() && t.engine->step() == STEP_BUSY) {
+            advanced = true;
+        }
+    }
+    if (!advanced) {
+        rp2040Flasher.waitForRxEvent();
+    }
+    if (batchRunning) {
+        checkBatch();
+    }
+}
+
+#ifdef ESP_PLATFORM
+static void runFlasherTask(void*) {
+    // Les réceptions UART réveillent la tâche qui a appelé begin()
+    for (FlashTarget& t : flashTargets) {
+        t.engine->begin();
+    }
+    for (;;) {
+        FlasherRequest request;
+        while (xQueueReceive(flasherRequests, &request, 0) == pdTRUE) {
+            switch (request) {
+                case REQUEST_PREPARE:
+                    prepareFlashTargets();
+                    break;
+                case REQUEST_START:
+                case REQUEST_START_DIFF:
+                    startFlashTargets(request == REQUEST_START_DIFF);
+                    break;
+                case REQUEST_STREAM:
+                    streamStarted = startStream();
+                    xSemaphoreGive(streamDone);
+                    break;
+            }
+        }
+        bool busy = batchRunning;
+        for (FlashTarget& t : flashTargets) {
+            busy |= t.engine->busy();
+        }
+        if (!busy) {
+            // Rien en cours: jusqu'à la prochaine commande
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        handleFlasher();
+    }
+}
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Arduino.h>
+#include "rp2040_flasher.h"
+
+#define MAX_FLASH_TARGETS 3
+
+// Sur l'ESP32 les flasheurs tournent dans leur propre tâche, réveillée par
+// les réceptions UART et par les commandes. Priorité 4: au-dessus de loop()
+// (1) et d'async_tcp (3), pour que le trafic HTTP/WebSocket ne retarde pas
+// le traitement des réponses du bootloader; au-dessous de l'hôte NimBLE (21)
+// et du WiFi (23), plus exigeants. La tâche dort dès qu'elle attend le
+// RP2040, et au moins 1 ms quand elle n'avance pas (flux en attente de
+// données, délais): elle n'affame pas les tâches moins prioritaires.
+#ifndef FLASHER_TASK_PRIORITY
+#define FLASHER_TASK_PRIORITY 4
+#endif
+// Cœur de loop(): sur un ESP32-S3, NimBLE et le WiFi restent sur le cœur 0
+#ifndef FLASHER_TASK_CORE
+#define FLASHER_TASK_CORE ARDUINO_RUNNING_CORE
+#endif
+#define FLASHER_TASK_STACK 8192
+// Attente maximale de la tâche par startStreamFlash(), qui y ouvre le flux
+#define FLASHER_STREAM_START_MS 1000
+
+// Un RP2040 relié à l'ESP32: son flasheur, ses broches et le résultat du
+// dernier flash. Relaie les messages du flasheur vers uploader, préfixés du
+// numéro de la cible quand plusieurs cibles sont sélectionnées.
+class FlashTarget : public FlasherEvents {
+    public:
+        FlashTarget(uint8_t number, FlasherEngine* engine, int resetPin, int bootPin)
+            : engine(engine), number(number), resetPin(resetPin), bootPin(bootPin) {}
+        void flasherMessage(const String& message) override;
+        void flasherSynced() override;
+        void flasherRunFinished(const FlashRun& run) override;
+
+        FlasherEngine* const engine;
+        const uint8_t number;         // 1 = SerialRP2040
+        const int resetPin;
+        const int bootPin;
+        bool synced = false;          // depuis le dernier prepareFlashTargets()
+        bool running = false;         // flash en cours dans le lot
+        bool succeeded = false;
+};
+
+extern FlashTarget flashTargets[];
+extern const uint8_t flashTargetCount;
+
+// Sélection des cibles (bit i = flashTargets[i]). Toutes par défaut.
+bool selectFlashTargets(uint32_t mask);
+uint32_t selectedFlashTargets();
+// "EVENT:TARGETS:<nombre de cibles>:<sélection>" pour l'interface
+String flashTargetsEvent();
+
+// Les commandes ci-dessous peuvent venir de n'importe quelle tâche: elles
+// sont transmises à la tâche du flasheur, qui les exécute dans l'ordre.
+
+// Bootloader sur toutes les cibles sélectionnées, puis SYNC sur chacune
+void prepareFlashTargets();
+// Lance le flash de firmwareImagePath() sur les cibles synchronisées; les autres
+// sont abandonnées.
+void startFlashTargets(bool differential);
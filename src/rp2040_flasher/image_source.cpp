@@ -0,0 +1,197 @@
+#include "image_source.h"
+#include "config.h"
+#include "firmware_cache.h"
+#include "crc32.h"
+
+StreamImageSource streamImage;
+
+bool FileImageSource::open(const char* path) {
+    close();
+    // Image du cache: protégée de l'éviction jusqu'à close()
+    firmwareCacheAcquire(path);
+    return openAcquired(path);
+}
+
+bool FileImageSource::openSelected() {
+    close();
+    String path = firmwareImageAcquire();
+    return openAcquired(path.c_str());
+}
+
+bool FileImageSource::openAcquired(const char* path) {
+    openPath = path;
+    file = LittleFS.open(path, "r");
+    if (!file) {
+        close();
+        return false;
+    }
+    ImageDigest digest;
+    hasDigest = file && imageDigestLoad(path, digest);
+    digestCrc = hasDigest ? digest.crc32 : 0;
+    return (bool)file;
+}
+
+bool FileImageSource::expectedCrc(uint32_t* crc) {
+    if (hasDigest) {
+        *crc = digestCrc;
+    }
+    return hasDigest;
+}
+
+uint32_t FileImageSource::size() {
+    return file ? file.size() : 0;
+}
+
+uint32_t FileImageSource::available(uint32_t offset) {
+    uint32_t sz = size();
+    return offset < sz ? sz - offset : 0;
+}
+
+int FileImageSource::read(uint32_t offset, uint8_t* buffer, uint32_t length) {
+    if (!file || !file.seek(offset)) {
+        return -1;
+    }
+    int r = file.read(buffer, length);
+    return r < 0 ? -1 : r;
+}
+
+void FileImageSource::close() {
+    file.close();
+    if (openPath.length()) {
+        firmwareCacheRelease(openPath.c_str());
+        openPath = "";
+    }
+}
+
+bool StreamImageSource::begin(uint32_t totalSize, bool stage) {
+    if (!ring) {
+#ifdef BOARD_HAS_PSRAM
+        ring = (uint8_t*)ps_malloc(STREAM_RING_SIZE);
+#endif
+        if (!ring) {
+            ring = (uint8_t*)malloc(STREAM_RING_SIZE);
+        }
+        if (!ring) {
+            return false;
+        }
+        capacity = STREAM_RING_SIZE;
+    }
+    if (stageFile) {
+        stageFile.close();
+    }
+    total = totalSize;
+    head = 0;
+    tail = 0;
+    reservedEnd = 0;
+    staged = 0;
+    if (stage) {
+        imageDigestRemove("/firmware.bin");
+        stageFile = LittleFS.open("/firmware.bin", "w");
+        stageHash.begin();
+        stageCrc = CRC32_INIT;
+    }
+    isOpen = true;
+    return true;
+}
+
+uint32_t StreamImageSource::freeSpace() const {
+    return capacity - (head - tail);
+}
+
+int StreamImageSource::acceptChunk(uint32_t offset, uint32_t length) {
+    if (!isOpen) {
+        return 410;
+    }
+    // Un morceau interrompu (client déconnecté) peut être renvoyé depuis head
+    if (offset != reservedEnd && !(head < reservedEnd && offset == head)) {
+        return 409;
+    }
+    if (offset + length > total) {
+        return 409;
+    }
+    if (length > freeSpace()) {
+        return 503;
+    }
+    reservedEnd = offset + length;
+    return 200;
+}
+
+uint32_t StreamImageSource::write(const uint8_t* data, uint32_t length) {
+    if (!isOpen) {
+        return 0;
+    }
+    uint32_t h = head;
+    uint32_t room = capacity - (h - tail);
+    if (length > room) {
+        length = room;
+    }
+    if (length > total - h) {
+        length = total - h;
+    }
+    uint32_t pos = h % capacity;
+    uint32_t first = capacity - pos < length ? capacity - pos : length;
+    memcpy(ring + pos, data, first);
+    memcpy(ring, data + first, length - first);
+    __sync_synchronize(); // données visibles avant la nouvelle tête
+    head = h + length;
+    if (reservedEnd < head) {
+        reservedEnd = head;
+    }
+    return length;
+}
+
+uint32_t StreamImageSource::available(uint32_t offset) {
+    uint32_t h = head;
+    if (offset < tail || offset >= h) {
+        return 0;
+    }
+    return h - offset;
+}
+
+int StreamImageSource::read(uint32_t offset, uint8_t* buffer, uint32_t length) {
+    if (offset < tail) {
+        return -1; // déjà libéré
+    }
+    uint32_t avail = available(offset);
+    if (length > avail) {
+        length = avail;
+    }
+    uint32_t pos = offset % capacity;
+    uint32_t first = capacity - pos < length ? capacity - pos : length;
+    memcpy(buffer, ring + pos, first);
+    memcpy(buffer + first, ring, length - first);
+    // Copie optionnelle sur LittleFS, dans l'ordre, une seule fois: le
+    // flasheur relit parfois une partie déjà lue (pages vides sautées), seule
+    // la partie au-delà de staged est copiée
+    if (stageFile && offset <= staged && offset + length > staged) {
+        uint32_t skip = staged - offset;
+        stageFile.write(buffer + skip, length - skip);
+        stageHash.update(buffer + skip, length - skip);
+        stageCrc = crc32Update(stageCrc, buffer + skip, length - skip);
+        staged += length - skip;
+    }
+    return length;
+}
+
+void StreamImageSource::release(uint32_t offset) {
+    if (offset > tail && offset <= head) {
+        tail = offset;
+    }
+}
+
+void StreamImageSource::close() {
+    isOpen = false;
+    if (stageFile) {
+        stageFile.close();
+        if (staged != total) {
+            LittleFS.remove("/firmware.bin"); // copie incomplète
+        } else {
+            ImageDigest digest;
+            stageHash.finish(digest.sha256);
+            digest.size = staged;
+            digest.crc32 = ~stageCrc;
+            imageDigestSave("/firmware.bin", digest);
+            firmwareCacheStore("/firmware.bin");
+        }
+    }
+}
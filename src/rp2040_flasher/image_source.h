@@ -0,0 +1,95 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "sha256.h"
+
+// Source de l'image à flasher. Le flasheur lit par offset absolu dans l'image;
+// une source en flux ne garde que les octets pas encore libérés.
+class ImageSource {
+    public:
+        virtual ~ImageSource() {}
+        virtual uint32_t size() = 0;
+        // Octets lisibles immédiatement à partir de offset
+        virtual uint32_t available(uint32_t offset) = 0;
+        // Copie jusqu'à length octets; renvoie le nombre lu, ou -1 en cas d'erreur
+        virtual int read(uint32_t offset, uint8_t* buffer, uint32_t length) = 0;
+        // Le flasheur ne relira plus rien avant offset
+        virtual void release(uint32_t offset) {}
+        // Relecture arbitraire possible (nécessaire au mode différentiel)
+        virtual bool seekable() { return true; }
+        // CRC attendu de l'image, quand le conteneur le fournit
+        virtual bool expectedCrc(uint32_t* crc) { return false; }
+        // false si l'image ne contient rien dans cette zone (UF2 creux): elle
+        // n'est alors ni effacée ni écrite
+        virtual bool covers(uint32_t offset, uint32_t length) { return true; }
+        virtual void close() {}
+};
+
+// Image stockée sur LittleFS (/firmware.bin). Le CRC attendu est celui
+// calculé à sa réception (.meta, voir firmware_cache.h), s'il est connu.
+class FileImageSource : public ImageSource {
+    public:
+        bool open(const char* path);
+        // Image sélectionnée (firmwareImagePath()), protégée de l'éviction
+        // dès qu'elle est choisie
+        bool openSelected();
+        uint32_t size() override;
+        uint32_t available(uint32_t offset) override;
+        int read(uint32_t offset, uint8_t* buffer, uint32_t length) override;
+        bool expectedCrc(uint32_t* crc) override;
+        void close() override;
+
+    private:
+        bool openAcquired(const char* path);
+        File file;
+        String openPath;               // image acquise dans le cache
+        bool hasDigest = false;
+        uint32_t digestCrc = 0;
+};
+
+// Image reçue pendant le flash: anneau SPSC borné entre le transport
+// (producteur: tâche async du serveur web ou callback NimBLE) et le flasheur
+// (consommateur: loop()). Les offsets sont absolus dans l'image.
+class StreamImageSource : public ImageSource {
+    public:
+        // Prépare un flux de total octets; stage = copie aussi sur
+        // /firmware.bin, rangée dans le cache (firmware_cache.h) à la fin
+        bool begin(uint32_t total, bool stage);
+        bool active() const { return isOpen; }
+        uint32_t received() const { return head; }
+        uint32_t freeSpace() const;
+
+        // Producteur. acceptChunk() réserve la place d'un morceau de length
+        // octets commençant à offset et renvoie un code HTTP: 200 accepté,
+        // 409 offset inattendu (voir expectedOffset()), 503 anneau plein,
+        // 410 flux fermé.
+        int acceptChunk(uint32_t offset, uint32_t length);
+        uint32_t expectedOffset() const { return reservedEnd; }
+        // Copie ce qui tient dans l'anneau et renvoie le nombre d'octets pris
+        uint32_t write(const uint8_t* data, uint32_t length);
+
+        uint32_t size() override { return total; }
+        uint32_t available(uint32_t offset) override;
+        int read(uint32_t offset, uint8_t* buffer, uint32_t length) override;
+        void release(uint32_t offset) override;
+        bool seekable() override { return false; }
+        void close() override;
+
+    private:
+        uint8_t* ring = nullptr;
+        uint32_t capacity = 0;
+        uint32_t total = 0;
+        volatile uint32_t head = 0;        // fin des octets reçus (écrit par le producteur)
+        volatile uint32_t tail = 0;        // plus ancien octet conservé (écrit par le flasheur)
+        uint32_t reservedEnd = 0;          // fin du dernier morceau accepté
+        volatile bool isOpen = false;
+        File stageFile;
+        uint32_t staged = 0;
+        Sha256 stageHash;                  // empreinte de la copie, rangée avec elle
+        uint32_t stageCrc = 0;
+};
+
+#define STREAM_RING_SIZE (32 * 1024)
+
+extern StreamImageSource streamImage;
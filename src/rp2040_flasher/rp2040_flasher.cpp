@@ -1,37 +1,272 @@
 #include "rp2040_flasher.h"
 #include "config.h"
-#include "uploader.h"
+#include "firmware_cache.h"
+#include <Preferences.h>
 
-#define VTOR 0x10004000
 #define ALIGN_UP(val, align) (((val) + ((align) - 1)) & ~((align) - 1))
-// Variables globales pour le processus de flashage
-FlasherState flasherState = IDLE;
-
-File binFile;
-uint32_t fileSize = 0;
-uint8_t filebuffer[4096];
-uint32_t currentFilePosition = 0;
-uint32_t currentEraseAddress = 0;
-uint32_t flashStart = 0;
-uint32_t stateStartTime = 0;
-uint32_t eraseSize = 0;
-uint32_t writeSize = 0;
-uint32_t currentWriteOffset = 0;
-uint32_t commandSentTime = 0;
-int lastProgress = 0;
-extern Uploader* uploader;
-// Variables pour le calcul du CRC
-uint32_t calculatedCrc = 0;
+
+// Montée en débit de l'UART
+static const uint32_t baudLadder[] = { FLASHER_BAUD_LADDER };
+
+const char* rttCommandName(int command) {
+    static const char* const names[RTT_COMMANDS] = { "SYNC", "INFO", "CRC", "ERASE", "WRITE", "SEAL" };
+    return (command >= 0 && command < RTT_COMMANDS) ? names[command] : "?";
+}
+
+const char* flashPhaseName(int phase) {
+    static const char* const names[FLASH_PHASES] = { "sync", "info", "erase", "write", "crc", "seal", "go" };
+    return (phase >= 0 && phase < FLASH_PHASES) ? names[phase] : "?";
+}
+
+const char* flashRetryName(int retry) {
+    static const char* const names[FLASH_RETRIES] = { "sync", "baud", "pipeline", "resync", "block_crc", "write", "erase" };
+    return (retry >= 0 && retry < FLASH_RETRIES) ? names[retry] : "?";
+}
+
+// Phase à laquelle est imputé le temps passé dans un état (FLASH_PHASES = aucune:
+// délai après reset, attente du lancement)
+static int phaseOf(FlasherState state) {
+    switch (state) {
+        case WAIT_SYNC_RESPONSE:
+        case BAUD_STEP:
+        case WAIT_BAUD_RESPONSE:
+        case WAIT_BAUD_SYNC:
+        case BAUD_FALLBACK:
+        case RESYNC:
+        case WAIT_RESYNC_RESPONSE:
+            return PHASE_SYNC;
+        case SEND_INFO_COMMAND:
+        case WAIT_INFO_RESPONSE:
+            return PHASE_INFO;
+        case RESUME_CHECK:
+        case WAIT_RESUME_RESPONSE:
+        case DIFF_SECTOR:
+        case WAIT_DIFF_RESPONSE:
+        case CALCULATE_CRC:
+        case WAIT_GAP_CRC_RESPONSE:
+            return PHASE_CRC;
+        case WRITE_BLOCK:
+        case WRITE_DRAIN:
+            return PHASE_WRITE;
+        case SEAL_FLASH:
+        case WAIT_SEAL_RESPONSE:
+            return PHASE_SEAL;
+        case DONE:
+            return PHASE_GO;
+        default:
+            return FLASH_PHASES;
+    }
+}
+
+// Impute à la phase de l'état donné le temps écoulé depuis le dernier appel.
+// Pendant l'écriture, l'attente d'un ERASE en tête du pipeline est comptée
+// comme effacement.
+void FlasherEngine::accountPhase(FlasherState state) {
+    uint32_t now = micros();
+    int phase = phaseOf(state);
+    if (phase == PHASE_WRITE && inflightCount && inflight[inflightHead].erase) {
+        phase = PHASE_ERASE;
+    }
+    if (phase < FLASH_PHASES) {
+        currentRun.phaseUs[phase] += now - phaseClock;
+    }
+    phaseClock = now;
+}
+
+// Clôt les mesures du flash lancé par start(SEND_INFO_COMMAND)
+void FlasherEngine::finishRun(bool success) {
+    if (!runActive) {
+        return;
+    }
+    runActive = false;
+    currentRun.endMs = millis();
+    currentRun.success = success;
+    currentRun.imageSize = fileSize;
+    currentRun.baud = flasherBaud;
+    currentRun.totalMs = millis() - flashProcessStart;
+    currentRun.phaseBytes[PHASE_WRITE] = bytesWritten;
+    currentRun.writeBlock = blockSize;
+    for (int c = 0; c < RTT_COMMANDS; ++c) {
+        const RttStats& st = rttStats[c];
+        currentRun.rtt[c].count = st.count;
+        currentRun.rtt[c].minUs = st.minUs;
+        currentRun.rtt[c].avgUs = st.count ? (uint32_t)(st.totalUs / st.count) : 0;
+        currentRun.rtt[c].maxUs = st.maxUs;
+    }
+    events.flasherRunFinished(currentRun);
+}
+
+// Un seul écrivain (la tâche du flasheur), lecteurs sans verrou
+void FlasherEngine::publishStatus() {
+    uint32_t seq = statusSeq.load(std::memory_order_relaxed);
+    statusSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    publishedStatus.state = flasherState;
+    publishedStatus.phase = phaseOf(flasherState);
+    publishedStatus.progress = lastProgress;
+    publishedStatus.imageSize = fileSize;
+    publishedStatus.ackedBytes = ackedFilePosition;
+    publishedStatus.elapsedMs = runActive ? millis() - flashProcessStart : 0;
+    statusSeq.store(seq + 2, std::memory_order_release);
+}
+
+FlasherStatus FlasherEngine::status() const {
+    FlasherStatus copy;
+    uint32_t before;
+    uint32_t after;
+    do {
+        before = statusSeq.load(std::memory_order_acquire);
+        copy = publishedStatus;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = statusSeq.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return copy;
+}
+
+void FlasherEngine::resetRttStats() {
+    memset(rttStats, 0, sizeof(rttStats));
+}
+
+void FlasherEngine::recordRtt(RttCommand command, uint32_t sentMicros) {
+    uint32_t rtt = micros() - sentMicros;
+    RttStats& st = rttStats[command];
+    if (!st.count || rtt < st.minUs) {
+        st.minUs = rtt;
+    }
+    if (rtt > st.maxUs) {
+        st.maxUs = rtt;
+    }
+    st.count++;
+    st.totalUs += rtt;
+    int bucket = 0;
+    while (bucket < RTT_BUCKETS - 1 && rtt >= (500u << bucket)) {
+        bucket++;
+    }
+    st.buckets[bucket]++;
+}
+
+void FlasherEngine::reportRttStats() {
+    uint64_t waited = 0;
+    for (int c = 0; c < RTT_COMMANDS; ++c) {
+        const RttStats& st = rttStats[c];
+        if (!st.count) {
+            continue;
+        }
+        String histo;
+        for (int b = 0; b < RTT_BUCKETS; ++b) {
+            histo += String(b ? "/" : "") + st.buckets[b];
+        }
+        notify(String("log:RTT ") + rttCommandName(c) + ": " + st.count + " cmd, min/moy/max " +
+                                st.minUs + "/" + (uint32_t)(st.totalUs / st.count) + "/" + st.maxUs +
+                                " µs, histo <0.5..>=32 ms: " + histo);
+        if (c != RTT_WRITE) {
+            waited += st.totalUs;
+        }
+    }
+    notify(String("log:Attente des réponses (hors WRITE pipelinés): ") + (uint32_t)(waited / 1000) + " ms");
+}
+
+FlasherEngine::FlasherEngine(HardwareSerial& uart, FlasherEvents& events, int bootPin)
+    : port(&uart), uart(&uart), events(events), bootPin(bootPin),
+      flasherBaud(RP2040_SERIAL_BAUD), baudGood(RP2040_SERIAL_BAUD) {
+}
+
+FlasherEngine::FlasherEngine(Stream& port, FlasherEvents& events)
+    : port(&port), uart(nullptr), events(events), bootPin(-1),
+      flasherBaud(RP2040_SERIAL_BAUD), baudGood(RP2040_SERIAL_BAUD) {
+}
+
+FlasherEngine::~FlasherEngine() {
+    free(filebuffer);
+}
+
+void FlasherEngine::begin() {
+    if (!uart) {
+        return;
+    }
+#ifdef ESP_PLATFORM
+    wakeTask = xTaskGetCurrentTaskHandle();
+    uartMutex = xSemaphoreCreateMutex();
+#endif
+    // Remonter les octets dès 1 symbole de silence plutôt qu'au seuil du FIFO
+    uart->setRxTimeout(1);
+    // Appelé par la tâche d'événements UART à chaque réception
+    uart->onReceive([this]() { wake(); });
+}
+
+bool FlasherEngine::setIdleBaud(uint32_t baud) {
+    if (!uart) {
+        return false;
+    }
+#ifdef ESP_PLATFORM
+    if (uartMutex) {
+        xSemaphoreTake(uartMutex, portMAX_DELAY);
+    }
+#endif
+    bool idle = status().state == IDLE;
+    if (idle) {
+        uart->updateBaudRate(baud);
+    }
+#ifdef ESP_PLATFORM
+    if (uartMutex) {
+        xSemaphoreGive(uartMutex);
+    }
+#endif
+    return idle;
+}
+
+// Réveille le flasheur s'il attend une réponse
+void FlasherEngine::wake() {
+#ifdef ESP_PLATFORM
+    TaskHandle_t task = wakeTask;
+    if (task) {
+        xTaskNotifyGive(task);
+    }
+#endif
+}
+
+// Attend (au plus 1 ms) qu'une réception UART réveille le flasheur
+void FlasherEngine::waitForRxEvent() {
+#ifdef ESP_PLATFORM
+    if (wakeTask && wakeTask == xTaskGetCurrentTaskHandle()) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1));
+    }
+#endif
+}
+
+uint32_t FlasherEngine::responseWord(int index) {
+    uint32_t w;
+    memcpy(&w, responseFrame + 4 * index, 4);
+    return w;
+}
+
+// Accumule les octets de la réponse en cours. Renvoie true quand une trame
+// complète est dans responseFrame: 'expected' octets, ou un RSP_ERR seul.
+bool FlasherEngine::readResponseFrame(uint8_t expected) {
+    while (responseLength < expected && port->available() > 0) {
+        responseFrame[responseLength++] = port->read();
+        if (responseLength == 4 && responseWord(0) == RSP_ERR) {
+            break;
+        }
+    }
+    if (responseLength < expected && !(responseLength == 4 && responseWord(0) == RSP_ERR)) {
+        responsePending = true;
+        return false;
+    }
+    responseLength = 0;
+    return true;
+}
 
 // Fonction pour vider le buffer série d'entrée
-void flushSerial() {
-    while (SerialRP2040.available()) {
-        SerialRP2040.read();
+void FlasherEngine::flushSerial() {
+    while (port->available()) {
+        port->read();
     }
+    responseLength = 0;
 }
 
 // Nouvelle fonction non bloquante pour envoyer une commande
-void sendCommandNonBlocking(const uint8_t* command, size_t len, const String& debugMessage = "") {
+void FlasherEngine::sendCommandNonBlocking(const uint8_t* command, size_t len) {
     flushSerial();
     if (command && len > 0) {
         DEBUG(printf("Sending command: 0x%08X", *(uint32_t*)command));
@@ -42,60 +277,572 @@ void sendCommandNonBlocking(const uint8_t* command, size_t len, const String& de
             }
         }
         DEBUG(println());
-        SerialRP2040.write(command, len);
-        SerialRP2040.flush();
+        port->write(command, len);
+        port->flush();
     }
     commandSentTime = millis();
+    commandSentMicros = micros();
 }
 
-// Fonction utilitaire de calcul du CRC32 (implémentation simple)
-uint32_t calculateCrc32(const uint8_t* data, size_t length, uint32_t crc = 0xFFFFFFFF) {
-    for (size_t i = 0; i < length; ++i) {
-        crc ^= data[i];
-        for (int j = 0; j < 8; ++j) {
-            if (crc & 1) {
-                crc = (crc >> 1) ^ 0xEDB88320;
-            } else {
-                crc >>= 1;
-            }
+// Fonction utilitaire de calcul du CRC32 (voir crc32.h pour les variantes)
+uint32_t calculateCrc32(const uint8_t* data, size_t length, uint32_t crc = CRC32_INIT) {
+    return crc32Update(crc, data, length);
+}
+
+// Ajoute au CRC les octets lus à l'offset donné, s'ils prolongent exactement
+// la zone déjà couverte (une relecture après repli ne compte pas deux fois).
+void FlasherEngine::accumulateCrc(uint32_t offset, const uint8_t* data, uint32_t length) {
+    if (offset != crcFilePosition) {
+        return;
+    }
+    crcState = calculateCrc32(data, length, crcState);
+    crcFilePosition += length;
+}
+
+static uint32_t bytesPerSecond(uint32_t bytes, uint32_t elapsedMs) {
+    return elapsedMs ? (uint32_t)((uint64_t)bytes * 1000 / elapsedMs) : bytes;
+}
+
+uint32_t FlasherEngine::sectorIndex(uint32_t address) {
+    return (address - flashStart) / eraseSize;
+}
+
+bool FlasherEngine::sectorNeedsFlash(uint32_t address) {
+    uint32_t offset = address - flashStart;
+    if (!imageSource->covers(offset - offset % eraseSize, eraseSize)) {
+        return false;
+    }
+    if (!differentialActive) {
+        return true;
+    }
+    uint32_t index = sectorIndex(address);
+    return sectorDirty[index >> 3] & (1 << (index & 7));
+}
+
+// Longueur comparée/écrite pour le secteur commençant à offset: le secteur
+// entier, ou la fin de l'image arrondie à une page de 256 octets.
+uint32_t FlasherEngine::sectorImageLength(uint32_t offset) {
+    uint32_t remaining = ALIGN_UP(fileSize - offset, FLASH_PAGE_SIZE);
+    return remaining < eraseSize ? remaining : eraseSize;
+}
+
+// Vrai si la page (FLASH_PAGE_SIZE octets alignés sur 4) ne contient que des
+// 0xFF. Parcours par mots de 32 bits, 8 à la fois, sans sortie anticipée
+// à l'intérieur d'un groupe.
+static bool pageBlank(const uint8_t* page) {
+    const uint32_t* w = (const uint32_t*)page;
+    for (uint32_t i = 0; i < FLASH_PAGE_SIZE / 4; i += 8) {
+        if ((w[i] & w[i + 1] & w[i + 2] & w[i + 3] & w[i + 4] & w[i + 5] & w[i + 6] & w[i + 7]) != 0xFFFFFFFF) {
+            return false;
         }
     }
-    return crc;
+    return true;
 }
 
-// Fonction qui calcule le CRC32 d'un fichier entier
-uint32_t calculateCrc32FromFile(File& file) {
-    uint32_t crc = 0xFFFFFFFF;
-    uint8_t buffer[512]; // Buffer de lecture
-    uint32_t bytesRead = 0;
-    
-    file.seek(0);
+// Lit le prochain bloc de l'image dans filebuffer pendant que l'UART vide le
+// précédent (le tampon TX du driver sert de second tampon). Le dernier bloc
+// est complété à 256 octets avec 0xFF, l'état effacé de la flash.
+// Les pages entièrement à 0xFF ne sont pas envoyées: le bloc préparé est la
+// première suite de pages non vides, jusqu'à blockSize octets.
+// prefetchLength reste à 0 si l'image est finie ou si le flux n'a pas encore
+// livré le bloc.
+bool FlasherEngine::prefetchBlock() {
+    for (;;) {
+        while (currentFilePosition < fileSize && !sectorNeedsFlash(flashStart + currentFilePosition)) {
+            currentFilePosition += eraseSize - (currentFilePosition % eraseSize);
+        }
+        if (currentFilePosition >= fileSize) {
+            prefetchLength = 0;
+            return true;
+        }
+        // Un bloc ne chevauche jamais deux secteurs d'effacement
+        uint32_t length = eraseSize - (currentFilePosition % eraseSize);
+        if (length > blockSize) {
+            length = blockSize;
+        }
+        // Flux: on attend que le bloc complet soit arrivé
+        uint32_t wanted = length < fileSize - currentFilePosition ? length : fileSize - currentFilePosition;
+        if (imageSource->available(currentFilePosition) < wanted) {
+            prefetchLength = 0;
+            return true;
+        }
+        int r = imageSource->read(currentFilePosition, filebuffer, wanted);
+        if (r <= 0) {
+            return false;
+        }
+        accumulateCrc(currentFilePosition, filebuffer, r);
+        uint32_t aligned = ALIGN_UP((uint32_t)r, FLASH_PAGE_SIZE);
+        memset(filebuffer + r, 0xFF, aligned - r);
 
-    while(file.position() < file.size()) {
-        bytesRead = file.read(buffer, sizeof(buffer));
-        if (bytesRead > 0) {
-            crc = calculateCrc32(buffer, bytesRead, crc);
-        } else {
-            // Fin du fichier ou erreur de lecture
-            break;
+        uint32_t first = 0;
+        while (first < aligned && pageBlank(filebuffer + first)) {
+            first += FLASH_PAGE_SIZE;
+        }
+        blankBytesSkipped += first;
+        if (first == aligned) {
+            currentFilePosition += r; // tout le bloc est vide
+            continue;
+        }
+        uint32_t end = first + FLASH_PAGE_SIZE;
+        while (end < aligned && !pageBlank(filebuffer + end)) {
+            end += FLASH_PAGE_SIZE;
         }
+        // Les pages après la première page vide seront relues au bloc suivant
+        if (first) {
+            memmove(filebuffer, filebuffer + first, end - first);
+            currentFilePosition += first;
+        }
+        prefetchLength = end - first;
+        return true;
     }
-    
-    return ~crc;
 }
 
-// Fonction pour initialiser le processus de flashage
-void startFlashProcess(FlasherState fs, bool resetInactivity) {
+// Autorise un nouvel essai à cette adresse (voir FLASHER_BLOCK_RETRIES) et
+// fixe l'attente qui le précède
+bool FlasherEngine::allowRetry(uint32_t address, FlashRetry kind) {
+    if (address != retryAddress) {
+        retryAddress = address;
+        retryAttempts = 0;
+    }
+    if (retryAttempts >= FLASHER_BLOCK_RETRIES || retryTotal >= FLASHER_MAX_RETRIES) {
+        return false;
+    }
+    retryAttempts++;
+    retryTotal++;
+    currentRun.retries[kind]++;
+    retryWait = FLASHER_RETRY_BACKOFF_MS << (retryAttempts - 1);
+    return true;
+}
+
+// Échec dans le pipeline d'écriture. Avec plusieurs blocs en vol, on suppose
+// que le bootloader ne suit pas: on repasse en stop-and-wait. Sinon c'est un
+// nouvel essai, s'il en reste. Dans les deux cas on se resynchronise et on
+// réécrit depuis le secteur du premier bloc non acquitté.
+void FlasherEngine::writePipelineFailure(const String& message) {
+    uint32_t rewind = ackedFilePosition - (ackedFilePosition % eraseSize);
+    if (writeWindow > 1) {
+        notify("log:Le bootloader ne suit pas le pipeline, repli en mode stop-and-wait.");
+        currentRun.retries[RETRY_PIPELINE]++;
+        writeWindow = 1;
+        retryWait = 0;
+    } else if (allowRetry(flashStart + rewind, RETRY_WRITE)) {
+        notify("log:" + message.substring(6) + " Nouvel essai (" + retryAttempts + "/" + FLASHER_BLOCK_RETRIES + ").");
+    } else {
+        notify(message);
+        flasherState = ERROR;
+        return;
+    }
+    // Le débit mesuré pendant un repli ne veut rien dire
+    if (tuning()) {
+        tuneBlockSize(true);
+    }
+    DEBUG(printf("Write pipeline failure, rewinding to 0x%08X\n", flashStart + rewind));
+    currentEraseAddress = flashStart + rewind;
+    currentFilePosition = rewind;
+    ackedFilePosition = rewind;
+    prefetchLength = 0;
+    inflightCount = 0;
+    resyncAttempts = 0;
+    stateStartTime = millis();
+    flasherState = RESYNC;
+}
+
+// ERASE en erreur: après ERR! (ou une commande perdue) le bootloader attend
+// un SYNC. Tout ce qui précède le secteur est acquitté: effacement et
+// écriture reprennent à ce secteur.
+void FlasherEngine::eraseFailure(const String& message, uint32_t address) {
+    if (!allowRetry(address, RETRY_ERASE)) {
+        notify(message);
+        flasherState = ERROR;
+        return;
+    }
+    notify("log:" + message.substring(6) + " Nouvel essai (" + retryAttempts + "/" + FLASHER_BLOCK_RETRIES + ").");
+    currentEraseAddress = address;
+    currentFilePosition = address - flashStart;
+    ackedFilePosition = currentFilePosition;
+    prefetchLength = 0;
+    inflightCount = 0;
+    resyncAttempts = 0;
+    stateStartTime = millis();
+    flasherState = RESYNC;
+}
+
+// Change le débit côté ESP32 après avoir laissé partir les octets en attente
+void FlasherEngine::setFlasherBaud(uint32_t baud) {
+    if (baud == flasherBaud || !uart) {
+        return;
+    }
+    uart->flush();
+    uart->updateBaudRate(baud);
+    flasherBaud = baud;
+    DEBUG(printf("RP2040 UART baudrate: %lu\n", (unsigned long)baud));
+}
+
+void FlasherEngine::sendSync() {
+    uint32_t syncCmd = CMD_SYNC;
+    sendCommandNonBlocking((uint8_t*)&syncCmd, sizeof(syncCmd));
+}
+
+// Géométrie annoncée par INFO: tampon de transfert à la taille du plus grand
+// bloc (gardé d'un flash à l'autre) et tailles de bloc à essayer.
+bool FlasherEngine::setupTransfer() {
+    if (eraseSize < FLASH_PAGE_SIZE || (eraseSize & (eraseSize - 1)) || flashStart % eraseSize ||
+        writeSize < FLASH_PAGE_SIZE || writeSize % FLASH_PAGE_SIZE) {
+        notify("error:Géométrie de flash invalide annoncée par le bootloader.");
+        return false;
+    }
+    // Un bloc ne chevauche jamais deux secteurs d'effacement
+    uint32_t limit = writeSize < eraseSize ? writeSize : eraseSize;
+    if (limit > FLASHER_MAX_BLOCK) {
+        limit = FLASHER_MAX_BLOCK;
+    }
+    uint32_t needed = limit > FLASHER_SCRATCH_SIZE ? limit : FLASHER_SCRATCH_SIZE;
+    if (filebufferSize < needed) {
+        uint8_t* buffer = (uint8_t*)realloc(filebuffer, needed);
+        if (!buffer) {
+            notify(String("error:Mémoire insuffisante pour des blocs de ") + limit + " octets.");
+            return false;
+        }
+        filebuffer = buffer;
+        filebufferSize = needed;
+    }
+    writeSize = limit;
+    blockSize = limit;
+    tuneStep = 0;
+    tuneAckStep = 0;
+    tuneSteps = 0;
+    tuneBytes = 0;
+    tuneAckBlocks = 0;
+    tuneAckBytes = 0;
+    tuneEraseUs = 0;
+    tuneRttTotal = 0;
+    tuneRttSamples = 0;
+    memset(tuneRate, 0, sizeof(tuneRate));
+#if FLASHER_ADAPTIVE_WRITE
+    // En flux, le débit mesuré serait celui du téléversement
+    if (imageSource->seekable()) {
+        uint8_t steps = 0;
+        while (steps < FLASHER_TUNE_SIZES && (limit >> steps) >= FLASHER_TUNE_MIN_BLOCK) {
+            steps++;
+        }
+        for (uint8_t i = 0; i < steps; ++i) {
+            tuneSize[i] = (limit >> (steps - 1 - i)) & ~(FLASH_PAGE_SIZE - 1);
+        }
+        if (steps > 1) {
+            tuneSteps = steps;
+            blockSize = tuneSize[0];
+        }
+    }
+#endif
+    return true;
+}
+
+// Acquittement d'un WRITE pendant les essais. Le débit d'une taille est
+// mesuré du premier au dernier acquittement de ses blocs, la fenêtre étant
+// pleine; le RTT ne retient que les blocs qui n'ont pas attendu un ERASE.
+void FlasherEngine::tuneAcked(const InflightWrite& w) {
+    uint32_t now = micros();
+    if (w.tune >= tuneSteps) {
+        // Toutes les tailles ont été essayées: choix
+        tuneBlockSize(false);
+        return;
+    }
+    if (w.tune != tuneAckStep) {
+        tuneMeasured();
+        tuneAckStep = w.tune;
+    }
+    if (!tuneAckBlocks) {
+        tuneFirstAck = now;
+        tuneEraseUs = 0;
+    } else {
+        tuneAckBytes += w.length;
+    }
+    tuneAckBlocks++;
+    tuneLastAck = now;
+    if ((int32_t)(tuneLastErase - w.sentMicros) < 0) {
+        tuneRttTotal += now - w.sentMicros;
+        tuneRttSamples++;
+    }
+}
+
+// Débit de la taille tuneAckStep avec ce qui a été acquitté
+void FlasherEngine::tuneMeasured() {
+    uint32_t us = tuneLastAck - tuneFirstAck - tuneEraseUs;
+    if (tuneAckBlocks > 1 && us) {
+        tuneRate[tuneAckStep] = (uint32_t)((uint64_t)tuneAckBytes * 1000000 / us);
+        tuneRttUs[tuneAckStep] = tuneRttSamples ? tuneRttTotal / tuneRttSamples : 0;
+    }
+    tuneAckBlocks = 0;
+    tuneAckBytes = 0;
+    tuneEraseUs = 0;
+    tuneRttTotal = 0;
+    tuneRttSamples = 0;
+}
+
+// Fin des essais: après la dernière taille ou en fin d'image (stop = false,
+// la taille en cours de mesure compte), ou sur repli (stop = true). On garde
+// la meilleure taille mesurée.
+void FlasherEngine::tuneBlockSize(bool stop) {
+    if (!stop) {
+        tuneMeasured();
+    }
+    blockSize = writeSize;
+    uint32_t best = 0;
+    String curve;
+    for (uint8_t i = 0; i < tuneSteps; ++i) {
+        if (!tuneRate[i]) {
+            continue;
+        }
+        if (tuneRate[i] > best) {
+            best = tuneRate[i];
+            blockSize = tuneSize[i];
+        }
+        // Pas de RTT si chaque bloc a attendu un ERASE
+        curve += String(curve.length() ? ", " : "") + tuneSize[i] + ": " + tuneRate[i] + " o/s" +
+                 (tuneRttUs[i] ? String(", RTT ") + tuneRttUs[i] + " µs" : String(""));
+    }
+    tuneStep = tuneSteps;
+    tuneAckStep = tuneSteps;
+    notify(String("log:Blocs WRITE de ") + blockSize + " octets" + (curve.length() ? " (" + curve + ")" : String("")));
+    DEBUG(printf("WRITE block size: %lu\n", (unsigned long)blockSize));
+}
+
+// Après INFO, avant tout effacement: une image tronquée, trop grande ou qui
+// n'est pas une application RP2040 (binaire ESP32 par exemple) est refusée
+// sans toucher à la flash de la cible.
+bool FlasherEngine::validateImage(uint32_t flashSize) {
+    if (fileSize > flashSize) {
+        notify(String("error:Image refusée: ") + fileSize + " octets pour une zone applicative de " +
+               flashSize + " octets.");
+        return false;
+    }
+    // Table des vecteurs: absente d'un UF2 qui ne commence pas à flashStart,
+    // pas encore arrivée d'un flux lent; on ne contrôle alors que la taille.
+    uint32_t length = FLASH_IMAGE_HEADER_OFFSET + sizeof(FlashImageHeader);
+    if (length > fileSize) {
+        length = fileSize < 8 ? 0 : 8;
+    }
+    if (!length || !imageSource->covers(0, 8) || imageSource->available(0) < length) {
+        DEBUG(printf("Image validation: vector table not available, size check only\n"));
+        return true;
+    }
+    if (imageSource->read(0, filebuffer, length) != (int)length) {
+        notify("error:Impossible de lire le début de l'image.");
+        return false;
+    }
+    uint32_t vectors[2];
+    memcpy(vectors, filebuffer, sizeof(vectors));
+    // En-tête d'image ESP: 0xE9, nombre de segments, mode SPI
+    if (filebuffer[0] == 0xE9 && filebuffer[1] <= 16 && filebuffer[2] <= 5) {
+        notify("error:Image refusée: c'est un binaire ESP32, pas une application RP2040.");
+        return false;
+    }
+    if (vectors[0] <= RP2040_SRAM_START || vectors[0] > RP2040_SRAM_END || vectors[0] % 4) {
+        notify(String("error:Image refusée: pile initiale 0x") + String(vectors[0], HEX) +
+               " hors de la SRAM du RP2040.");
+        return false;
+    }
+    if (!(vectors[1] & 1) || vectors[1] < flashStart || vectors[1] >= flashStart + fileSize) {
+        notify(String("error:Image refusée: vecteur reset 0x") + String(vectors[1], HEX) +
+               " hors de l'image (attendu dans 0x" + String(flashStart, HEX) + " + " + fileSize + ").");
+        return false;
+    }
+
+    FlashImageHeader header = {};
+    if (length > FLASH_IMAGE_HEADER_OFFSET) {
+        memcpy(&header, filebuffer + FLASH_IMAGE_HEADER_OFFSET, sizeof(header));
+    }
+    if (header.magic != FLASH_IMAGE_HEADER_MAGIC) {
+#ifdef FLASHER_REQUIRE_IMAGE_HEADER
+        notify("error:Image refusée: en-tête d'image absent.");
+        return false;
+#else
+        return true;
+#endif
+    }
+    if (header.imageSize != fileSize) {
+        notify(String("error:Image refusée: tronquée ou modifiée (") + fileSize + " octets reçus, " +
+               header.imageSize + " annoncés par l'en-tête).");
+        return false;
+    }
+#ifdef FLASHER_IMAGE_BOARD_ID
+    if (header.boardId && header.boardId != FLASHER_IMAGE_BOARD_ID) {
+        notify(String("error:Image refusée: construite pour la carte ") + header.boardId + ".");
+        return false;
+    }
+#endif
+    notify(String("log:Image version ") + header.version + " vérifiée.");
+    return true;
+}
 
+// Point de reprise tel que stocké en NVS
+struct FlashCheckpoint {
+    uint32_t imageSize;
+    uint32_t imageId;      // CRC des 4 premiers Kio de l'image
+    uint32_t flashStart;
+    uint32_t verified;     // octets écrits et acquittés, multiple de eraseSize
+};
+
+// Après INFO: identifie l'image et cherche un flash interrompu de la même
+// image. Seulement pour un flash complet d'une image relisible et contiguë:
+// le différentiel a son propre saut, le flux ne peut pas relire le début.
+void FlasherEngine::beginCheckpoint() {
+    checkpointActive = false;
+    checkpointSaved = 0;
+    resumeLength = 0;
+    if (!checkpointKey || differentialFlash || !imageSource->seekable() || imageSource == &uf2Image) {
+        return;
+    }
+    uint32_t length = fileSize < FLASHER_SCRATCH_SIZE ? fileSize : FLASHER_SCRATCH_SIZE;
+    if (imageSource->read(0, filebuffer, length) != (int)length) {
+        return;
+    }
+    imageId = ~calculateCrc32(filebuffer, length);
+    checkpointActive = true;
+
+    FlashCheckpoint cp;
+    Preferences prefs;
+    prefs.begin("flasher", true);
+    bool found = prefs.getBytes(checkpointKey, &cp, sizeof(cp)) == sizeof(cp);
+    prefs.end();
+    if (found && cp.imageSize == fileSize && cp.imageId == imageId && cp.flashStart == flashStart &&
+        cp.verified && cp.verified < fileSize && cp.verified % eraseSize == 0) {
+        resumeLength = cp.verified;
+    }
+}
+
+// Appelé à chaque bloc acquitté; n'écrit en NVS qu'après
+// FLASHER_CHECKPOINT_INTERVAL octets de plus, en limite de secteur
+void FlasherEngine::saveCheckpoint() {
+    uint32_t verified = ackedFilePosition - (ackedFilePosition % eraseSize);
+    if (!checkpointActive || verified < checkpointSaved + FLASHER_CHECKPOINT_INTERVAL) {
+        return;
+    }
+    FlashCheckpoint cp = { fileSize, imageId, flashStart, verified };
+    Preferences prefs;
+    prefs.begin("flasher", false);
+    prefs.putBytes(checkpointKey, &cp, sizeof(cp));
+    prefs.end();
+    checkpointSaved = verified;
+}
+
+void FlasherEngine::clearCheckpoint() {
+    if (!checkpointActive) {
+        return;
+    }
+    Preferences prefs;
+    prefs.begin("flasher", false);
+    prefs.remove(checkpointKey);
+    prefs.end();
+    checkpointActive = false;
+}
+
+void FlasherEngine::closeImageSource() {
+    if (imageSource) {
+        imageSource->close();
+    }
+    imageSource = nullptr;
+    requestedSource = nullptr;
+}
+
+// Fonction pour initialiser le processus de flashage
+void FlasherEngine::start(FlasherState fs, bool resetInactivity) {
+    bool wasIdle = flasherState == IDLE;
     flasherState = fs;
     stateStartTime = millis();
+    phaseClock = micros();
+    if (fs == INIT) {
+        resetRttStats();
+        memset(&currentRun, 0, sizeof(currentRun));
+    }
+    if (fs == SEND_INFO_COMMAND) {
+        imageSource = nullptr; // ouverte au premier passage dans SEND_INFO_COMMAND
+        flashProcessStart = millis();
+        // Le temps et les reprises de la synchronisation initiale sont conservés
+        for (int p = PHASE_INFO; p < FLASH_PHASES; ++p) {
+            currentRun.phaseUs[p] = 0;
+        }
+        memset(currentRun.phaseBytes, 0, sizeof(currentRun.phaseBytes));
+        for (int k = RETRY_PIPELINE; k < FLASH_RETRIES; ++k) {
+            currentRun.retries[k] = 0;
+        }
+        currentRun.success = false;
+        runActive = true;
+        baudGood = flasherBaud;
+        baudStep = 0;
+        // Sans UART (lien de test), pas de changement de débit
+        if (FLASHER_BAUD_ESCALATION && uart) {
+            flasherState = BAUD_STEP;
+        }
+    }
     lastProgress = 0;
     if (resetInactivity)
         resetInactivityTimer();
+    publishStatus();
+    if (wasIdle && uart) {
+        // La console série a pu changer le débit: retour au nominal, une
+        // fois le flash publié pour que setIdleBaud() ne passe plus
+#ifdef ESP_PLATFORM
+        if (uartMutex) {
+            xSemaphoreTake(uartMutex, portMAX_DELAY);
+        }
+#endif
+        uart->updateBaudRate(RP2040_SERIAL_BAUD);
+        flasherBaud = RP2040_SERIAL_BAUD;
+#ifdef ESP_PLATFORM
+        if (uartMutex) {
+            xSemaphoreGive(uartMutex);
+        }
+#endif
+    }
+}
+
+void FlasherEngine::stop() {
+    finishRun(false);
+    closeImageSource();
+    if (flasherState != IDLE) {
+        setFlasherBaud(RP2040_SERIAL_BAUD);
+    }
+    flasherState = IDLE;
+    publishStatus();
+}
+
+FlasherStep FlasherEngine::step() {
+    responsePending = false;
+    localWork = false;
+    // Le temps depuis l'appel précédent et celui du traitement reviennent à
+    // l'état dans lequel on était (runState() ne change d'état qu'en sortant)
+    FlasherState state = flasherState;
+    accountPhase(state);
+    runState();
+    accountPhase(state);
+    publishStatus();
+    if (localWork || flasherState != state) {
+        return STEP_BUSY;
+    }
+    return responsePending ? STEP_WAITING : STEP_STALLED;
 }
 
 // Machine à états pour le flashage non bloquant
-void handleFlasher() {
+void FlasherEngine::loop() {
+    if (step() != STEP_BUSY) {
+        waitForRxEvent();
+    }
+}
+
+void startFlashProcess(FlasherState fs, bool resetInactivity) {
+    rp2040Flasher.start(fs, resetInactivity);
+}
+
+void setFlashSource(ImageSource* source) {
+    rp2040Flasher.setSource(source);
+}
+
+void setDifferentialFlash(bool enabled) {
+    rp2040Flasher.setDifferential(enabled);
+}
+
+void FlasherEngine::runState() {
     switch (flasherState) {
         case IDLE:
             break;
@@ -104,53 +851,213 @@ void handleFlasher() {
             if (millis() - stateStartTime < 1000) {
                 return;
             }
-            //SerialRP2040.begin(RP2040_SERIAL_BAUD, SERIAL_8N1, RP2040_SERIAL_RX_PIN, RP2040_SERIAL_TX_PIN);
-            binFile = LittleFS.open("/firmware.bin", "r");
-            if (!binFile) {
-                uploader->notifyClients("error:Fichier firmware.bin introuvable.");
-                flasherState = ERROR;
-                return;
-            }
-
-            fileSize = binFile.size();
-            currentFilePosition = 0;
-            uploader->notifyClients("log:Synchronisation avec le bootloader du RP2040...");
+            //port->begin(RP2040_SERIAL_BAUD, SERIAL_8N1, RP2040_SERIAL_RX_PIN, RP2040_SERIAL_TX_PIN);
+            notify("log:Synchronisation avec le bootloader du RP2040...");
             uint32_t syncCmd = CMD_SYNC;
             sendCommandNonBlocking((uint8_t*)&syncCmd, sizeof(syncCmd));
             flasherState = WAIT_SYNC_RESPONSE;
+            stateStartTime = millis(); // délai de réponse compté depuis l'envoi
             break;
         }
         case WAIT_SYNC_RESPONSE: {
-            if (millis() - commandSentTime < BOOTLOADER_RESPONSE_DELAY) {
-                return;
-            }
-            if (SerialRP2040.available() >= 4) {
-                uint32_t response;
-                SerialRP2040.readBytes((uint8_t*)&response, 4);
+            if (readResponseFrame(4)) {
+                uint32_t response = responseWord(0);
+                recordRtt(RTT_SYNC, commandSentMicros);
                 if (response != RSP_SYNC) {
-                    uploader->notifyClients("error:Réponse de synchronisation inattendue.");
+                    currentRun.retries[RETRY_SYNC]++;
+                    notify("error:Réponse de synchronisation inattendue.");
                     DEBUG(printf("Error: Unexpected SYNC response. Expected: 0x%08X, Received: 0x%08X\n", RSP_SYNC, response));
                     flasherState = INIT;
                 } else {
-                    uploader->notifyClients("log:Synchronisation réussie.");
+                    notify("log:Synchronisation réussie.");
                     DEBUG(printf("Response OK: 0x%08X\n", response));
                     flasherState = IDLE; //une fois synchronisé, on attend le début du flashage
-                    // Relâcher la broche BOOTLOADER_PIN
-                    digitalWrite(BOOTLOADER_PIN, HIGH);
-                    rp2040BootloaderActive = true;
-                    uploader->notifyClients("EVENT:RP2040_SYNCED");
+                    // Relâcher la broche de boot
+                    if (bootPin >= 0) {
+                        digitalWrite(bootPin, HIGH);
+                    }
+                    events.flasherSynced();
+                    notify("EVENT:RP2040_SYNCED");
                 }
-            } else if (millis() - stateStartTime > 1000) { // on se laisse 60 secondes pour la réponse
-                 uploader->notifyClients("error:Timeout lors de l'attente de la réponse de synchronisation.");
+            } else if (millis() - stateStartTime > 1000) { // on se laisse 1 seconde pour la réponse
+                 notify("error:Timeout lors de l'attente de la réponse de synchronisation.");
                  DEBUG(println("Error: Timeout waiting for SYNC response."));
-                 startFlashProcess(INIT, false); // Recommencer l'initialisation
-                 // TODO : passer en mode erreur après xx tentatives
+                 if (currentRun.retries[RETRY_SYNC] + 1 >= FLASHER_SYNC_ATTEMPTS) {
+                     notify(String("error:Pas de bootloader RP2040 après ") + FLASHER_SYNC_ATTEMPTS + " tentatives.");
+                     flasherState = ERROR;
+                     break;
+                 }
+                 FlashRun attempts = currentRun;
+                 start(INIT, false); // Recommencer l'initialisation
+                 currentRun = attempts; // sans perdre les tentatives déjà faites
+                 currentRun.retries[RETRY_SYNC]++;
+            }
+            break;
+        }
+
+        case BAUD_STEP: {
+            // Candidat suivant strictement au-dessus du débit validé
+            while (baudStep < sizeof(baudLadder) / sizeof(baudLadder[0]) && baudLadder[baudStep] <= baudGood) {
+                baudStep++;
+            }
+            if (baudStep >= sizeof(baudLadder) / sizeof(baudLadder[0])) {
+                if (baudGood != RP2040_SERIAL_BAUD) {
+                    notify(String("log:UART RP2040 à ") + baudGood + " bauds.");
+                }
+                flasherState = SEND_INFO_COMMAND;
+                return;
+            }
+            uint32_t baudCmd[2];
+            baudCmd[0] = CMD_BAUD;
+            baudCmd[1] = baudLadder[baudStep];
+            sendCommandNonBlocking((uint8_t*)&baudCmd, sizeof(baudCmd));
+            flasherState = WAIT_BAUD_RESPONSE;
+            break;
+        }
+
+        case WAIT_BAUD_RESPONSE: {
+            if (readResponseFrame(4)) {
+                uint32_t response = responseWord(0);
+                if (response != RSP_OK) {
+                    // Bootloader sans commande BAUD (ou débit refusé): on s'arrête là
+                    DEBUG(printf("BAUD %lu rejected: 0x%08X\n", (unsigned long)baudLadder[baudStep], response));
+                    if (baudStep == 0 && baudGood == RP2040_SERIAL_BAUD) {
+                        notify("log:Changement de débit non supporté par le bootloader.");
+                    }
+                    // Après ERR! le bootloader attend un nouveau SYNC
+                    baudStep = sizeof(baudLadder) / sizeof(baudLadder[0]);
+                    baudSyncAttempts = 0;
+                    sendSync();
+                    flasherState = WAIT_BAUD_SYNC;
+                    return;
+                }
+                setFlasherBaud(baudLadder[baudStep]);
+                delay(2); // le RP2040 reconfigure son UART
+                baudSyncAttempts = 0;
+                sendSync();
+                flasherState = WAIT_BAUD_SYNC;
+            } else if (millis() - commandSentTime > 200) {
+                DEBUG(println("No BAUD response, keeping current baudrate."));
+                baudStep = sizeof(baudLadder) / sizeof(baudLadder[0]);
+                flasherState = BAUD_STEP;
+            }
+            break;
+        }
+
+        case WAIT_BAUD_SYNC: {
+            bool synced = false;
+            if (readResponseFrame(4)) {
+                recordRtt(RTT_SYNC, commandSentMicros);
+                synced = (responseWord(0) == RSP_SYNC);
+            } else if (millis() - commandSentTime < 100) {
+                return;
+            }
+            if (synced) {
+                DEBUG(printf("Baudrate %lu verified.\n", (unsigned long)flasherBaud));
+                baudGood = flasherBaud;
+                baudStep++;
+                flasherState = BAUD_STEP;
+            } else if (++baudSyncAttempts < 3) {
+                currentRun.retries[RETRY_SYNC]++;
+                sendSync();
+            } else {
+                currentRun.retries[RETRY_BAUD]++;
+                // Le lien ne tient pas: retour au dernier débit validé, le
+                // bootloader y revient seul faute de SYNC
+                notify(String("log:Échec à ") + flasherBaud + " bauds, retour à " + baudGood + ".");
+                setFlasherBaud(baudGood);
+                stateStartTime = millis();
+                baudSyncAttempts = 0;
+                flasherState = BAUD_FALLBACK;
+            }
+            break;
+        }
+
+        case BAUD_FALLBACK: {
+            if (millis() - stateStartTime < FLASHER_BAUD_REVERT_MS + 50) {
+                return;
+            }
+            if (baudSyncAttempts == 0) {
+                baudSyncAttempts = 1;
+                sendSync();
+                return;
+            }
+            if (readResponseFrame(4)) {
+                recordRtt(RTT_SYNC, commandSentMicros);
+                if (responseWord(0) == RSP_SYNC) {
+                    baudStep = sizeof(baudLadder) / sizeof(baudLadder[0]);
+                    flasherState = BAUD_STEP;
+                    return;
+                }
+            } else if (millis() - commandSentTime < 200) {
+                return;
+            }
+            if (++baudSyncAttempts > 3) {
+                notify("error:Bootloader perdu après le changement de débit.");
+                flasherState = ERROR;
+            } else {
+                sendSync();
             }
             break;
         }
 
         case SEND_INFO_COMMAND: {
-            uploader->notifyClients("log:Récupération des informations sur la flash...");
+            if (!imageSource) {
+                imageSource = requestedSource;
+                if (!imageSource) {
+                    if (!fileImage.openSelected()) {
+                        notify("error:Fichier firmware.bin introuvable.");
+                        flasherState = ERROR;
+                        return;
+                    }
+                    imageSource = &fileImage;
+                }
+                streamWaitStart = millis();
+            }
+            // En flux, il faut l'en-tête pour savoir si l'image est compressée
+            uint32_t headLength = imageSource->available(0);
+            if (headLength < sizeof(CompressedImageHeader) && headLength < imageSource->size()) {
+                if (millis() - streamWaitStart > 30000) {
+                    notify("error:Flux interrompu: aucune donnée reçue.");
+                    flasherState = ERROR;
+                }
+                return;
+            }
+            streamWaitStart = 0;
+            CompressedImageHeader header;
+            if (readCompressedHeader(imageSource, &header)) {
+                if (!inflateImage.open(imageSource, header)) {
+                    notify("error:Image compressée non supportée.");
+                    flasherState = ERROR;
+                    return;
+                }
+                notify(String("log:Image compressée: ") + inflateImage.compressedSize() +
+                                        " octets, " + header.rawSize + " octets une fois décompressée.");
+                imageSource = &inflateImage;
+            }
+            if (isUf2Image(imageSource)) {
+                if (!imageSource->seekable()) {
+                    notify("error:UF2 en flux non supporté, téléversez d'abord le fichier.");
+                    flasherState = ERROR;
+                    return;
+                }
+                resetInactivityTimer();
+                if (!uf2Image.open(imageSource)) {
+                    notify("error:UF2 refusé: " + uf2Image.error() + ".");
+                    flasherState = ERROR;
+                    return;
+                }
+                notify(String("log:UF2: ") + uf2Image.blockCount() + " blocs à partir de 0x" +
+                                        String(uf2Image.lowAddress(), HEX) + ", " + uf2Image.sectorCount() + " secteurs couverts.");
+                imageSource = &uf2Image;
+            }
+            fileSize = imageSource->size();
+            if (!fileSize) {
+                notify("error:Image vide.");
+                flasherState = ERROR;
+                return;
+            }
+            notify("log:Récupération des informations sur la flash...");
             uint32_t infoCmd = CMD_INFO;
             sendCommandNonBlocking((uint8_t*)&infoCmd, sizeof(infoCmd));
             resetInactivityTimer();
@@ -159,23 +1066,20 @@ void handleFlasher() {
         }
 
         case WAIT_INFO_RESPONSE: {
-            if (millis() - commandSentTime < BOOTLOADER_RESPONSE_DELAY) {
-                return;
-            }
-            if (SerialRP2040.available() >= (4 + 5 * sizeof(uint32_t))) {
-                uint32_t response;
+            if (readResponseFrame(sizeof(responseFrame))) {
+                uint32_t response = responseWord(0);
                 uint32_t infoData[5];
-                SerialRP2040.readBytes((uint8_t*)&response, 4);
-                SerialRP2040.readBytes((uint8_t*)&infoData, 5 * sizeof(uint32_t));
+                memcpy(infoData, responseFrame + 4, sizeof(infoData));
+                recordRtt(RTT_INFO, commandSentMicros);
                 if (response != RSP_OK) {
-                    uploader->notifyClients("error:Erreur lors de la récupération des informations sur la flash.");
+                    notify("error:Erreur lors de la récupération des informations sur la flash.");
                     DEBUG(printf("Error: Unexpected INFO response. Expected: 0x%08X, Received: 0x%08X\n", RSP_OK, response));
                     flasherState = ERROR;
                 } else {
                     eraseSize = infoData[2];
                     writeSize = infoData[4];
                     
-                    uploader->notifyClients(String("log:Flash info: Flash Start: 0x") + String(infoData[0], HEX) +
+                    notify(String("log:Flash info: Flash Start: 0x") + String(infoData[0], HEX) +
                                   ", Flash Size: " + String(infoData[1], HEX) + 
                                   ", Erase Size: " + String(eraseSize, HEX) + 
                                   ", Write Size: " + String(writeSize, HEX) + 
@@ -184,142 +1088,574 @@ void handleFlasher() {
                     DEBUG(printf("Flash info: Flash Start: 0x%08X, Flash Size: 0x%08X, Erase Size: 0x%08X, Write Size: 0x%08X, Max Data Len: 0x%08X\n",
                                     infoData[0], infoData[1], eraseSize, writeSize, infoData[4]));
                     flashStart = infoData[0];
+                    if (imageSource == &uf2Image) {
+                        if (!uf2Image.placeAt(flashStart)) {
+                            notify("error:UF2 refusé: " + uf2Image.error() + ".");
+                            flasherState = ERROR;
+                            return;
+                        }
+                        fileSize = uf2Image.size();
+                    }
+                    if (!setupTransfer() || !validateImage(infoData[1])) {
+                        flasherState = ERROR;
+                        return;
+                    }
                     currentEraseAddress = flashStart;
-                    flasherState = ERASE_SECTOR;
+                    currentFilePosition = 0;
+                    ackedFilePosition = 0;
+                    prefetchLength = 0;
+                    inflightCount = 0;
+                    writeWindow = FLASHER_WRITE_WINDOW;
+                    retryAddress = 0;
+                    retryAttempts = 0;
+                    retryTotal = 0;
+                    writePhaseStart = 0;
+                    bytesWritten = 0;
+                    blankBytesSkipped = 0;
+                    crcState = CRC32_INIT;
+                    crcFilePosition = 0;
+                    sectorsTotal = ALIGN_UP(fileSize, eraseSize) / eraseSize;
+                    sectorsSkipped = 0;
+                    differentialActive = false;
+                    lastProgress = 0;
+                    flasherState = WRITE_BLOCK;
+                    beginCheckpoint();
+                    if (resumeLength) {
+                        notify(String("log:Flash interrompu de cette image: vérification des ") + resumeLength +
+                               " octets déjà écrits...");
+                        flasherState = RESUME_CHECK;
+                    }
+                    if (differentialFlash) {
+                        if (!imageSource->seekable()) {
+                            notify("log:Mode différentiel indisponible en flux, flash complet.");
+                        } else if (sectorsTotal > MAX_DIFF_SECTORS) {
+                            notify("log:Image trop grande pour le mode différentiel, flash complet.");
+                        } else if (eraseSize > filebufferSize) {
+                            // La comparaison relit un secteur entier dans filebuffer
+                            notify("log:Secteurs trop grands pour le mode différentiel, flash complet.");
+                        } else {
+                            memset(sectorDirty, 0, sizeof(sectorDirty));
+                            differentialActive = true;
+                            diffAddress = flashStart;
+                            lastProgress = 0;
+                            notify("log:Comparaison des secteurs avec le RP2040...");
+                            flasherState = DIFF_SECTOR;
+                        }
+                    }
                 }
             } else if (millis() - stateStartTime > 5000) {
-                 uploader->notifyClients("error:Timeout lors de l'attente des informations sur la flash.");
+                 notify("error:Timeout lors de l'attente des informations sur la flash.");
                  DEBUG(println("Error: Timeout waiting for INFO response."));
                  flasherState = ERROR;
             }
             break;
         }
 
-        case ERASE_SECTOR: {
-            if (currentEraseAddress >= (flashStart + fileSize)) {
+        case RESUME_CHECK: {
+            // CRC local de la zone déjà écrite, par tranches pour ne pas
+            // bloquer loop(); il amorce aussi le CRC de l'image entière
+            if (crcFilePosition < resumeLength) {
+                uint32_t length = resumeLength - crcFilePosition;
+                if (length > filebufferSize) {
+                    length = filebufferSize;
+                }
+                int r = imageSource->read(crcFilePosition, filebuffer, length);
+                if (r <= 0) {
+                    notify("error:Erreur de lecture du fichier BIN.");
+                    flasherState = ERROR;
+                    return;
+                }
+                accumulateCrc(crcFilePosition, filebuffer, r);
                 resetInactivityTimer();
-                uploader->notifyClients("log:Effacement terminé.");
-                DEBUG(println("Flash erase complete."));
-                currentFilePosition = 0;
-                lastProgress = 0;
-                flasherState = WRITE_BLOCK;
+                localWork = true;
                 return;
             }
-            
-            uint32_t eraseCmd[3];
-            eraseCmd[0] = CMD_ERASE;
-            eraseCmd[1] = currentEraseAddress;
-            eraseCmd[2] = eraseSize;
-            sendCommandNonBlocking((uint8_t*)&eraseCmd, sizeof(eraseCmd));
-            flasherState = WAIT_ERASE_RESPONSE;
+            uint32_t crcCmd[3];
+            crcCmd[0] = CMD_CRC;
+            crcCmd[1] = flashStart;
+            crcCmd[2] = resumeLength;
+            sendCommandNonBlocking((uint8_t*)&crcCmd, sizeof(crcCmd));
+            flasherState = WAIT_RESUME_RESPONSE;
+            break;
+        }
+
+        case WAIT_RESUME_RESPONSE: {
+            if (readResponseFrame(8)) {
+                uint32_t response = responseWord(0);
+                recordRtt(RTT_CRC, commandSentMicros);
+                if (response == RSP_OK && responseWord(1) == ~crcState) {
+                    notify(String("log:Reprise du flash à 0x") + String(flashStart + resumeLength, HEX) + ": " +
+                           resumeLength + " octets déjà écrits et vérifiés.");
+                    currentRun.phaseBytes[PHASE_CRC] += resumeLength;
+                    currentEraseAddress = flashStart + resumeLength;
+                    currentFilePosition = resumeLength;
+                    ackedFilePosition = resumeLength;
+                    checkpointSaved = resumeLength;
+                    flasherState = WRITE_BLOCK;
+                    return;
+                }
+                notify("log:Zone déjà écrite différente, flash complet.");
+                DEBUG(printf("Resume CRC: response 0x%08X, remote 0x%08X, local 0x%08X\n", response, responseWord(1), ~crcState));
+                resumeLength = 0;
+                crcState = CRC32_INIT;
+                crcFilePosition = 0;
+                flasherState = WRITE_BLOCK;
+                if (response == RSP_ERR) {
+                    // CRC non supporté: après ERR! le bootloader attend un SYNC
+                    resyncAttempts = 0;
+                    retryWait = 0;
+                    stateStartTime = millis();
+                    flasherState = RESYNC;
+                }
+            } else if (millis() - commandSentTime > 5000) {
+                notify("error:Timeout lors de l'attente de la réponse CRC.");
+                DEBUG(println("Error: Timeout waiting for CRC response."));
+                flasherState = ERROR;
+            }
             break;
         }
 
-        case WAIT_ERASE_RESPONSE: {
-            if (millis() - commandSentTime < BOOTLOADER_RESPONSE_DELAY) {
+        case DIFF_SECTOR: {
+            uint32_t offset = diffAddress - flashStart;
+            // Secteurs absents de l'image (UF2): rien à comparer
+            while (offset < fileSize && !imageSource->covers(offset, eraseSize)) {
+                diffAddress += eraseSize;
+                offset += eraseSize;
+            }
+            if (offset >= fileSize) {
+                notify(String("log:Différentiel: ") + sectorsSkipped + "/" + sectorsTotal +
+                                        " secteurs identiques ignorés.");
+                lastProgress = 0;
+                flasherState = WRITE_BLOCK;
+                return;
+            }
+            uint32_t length = sectorImageLength(offset);
+            uint32_t crcCmd[3];
+            crcCmd[0] = CMD_CRC;
+            crcCmd[1] = diffAddress;
+            crcCmd[2] = length;
+            sendCommandNonBlocking((uint8_t*)&crcCmd, sizeof(crcCmd));
+
+            // Le CRC local se calcule pendant que le RP2040 calcule le sien.
+            // La lecture séquentielle sert aussi au CRC global de l'image.
+            int r = imageSource->read(offset, filebuffer, length < fileSize - offset ? length : fileSize - offset);
+            if (r <= 0) {
+                notify("error:Erreur de lecture du fichier BIN.");
+                flasherState = ERROR;
                 return;
             }
-            if (SerialRP2040.available() >= 4) {
-                uint32_t response;
-                SerialRP2040.readBytes((uint8_t*)&response, 4);
+            accumulateCrc(offset, filebuffer, r);
+            memset(filebuffer + r, 0xFF, length - r);
+            diffLocalCrc = ~calculateCrc32(filebuffer, length);
+            flasherState = WAIT_DIFF_RESPONSE;
+            break;
+        }
+
+        case WAIT_DIFF_RESPONSE: {
+            if (readResponseFrame(8)) {
+                uint32_t response = responseWord(0);
+                recordRtt(RTT_CRC, commandSentMicros);
+                if (response == RSP_ERR) {
+                    notify("log:CRC non supporté par le bootloader, flash complet.");
+                    differentialActive = false;
+                    sectorsSkipped = 0;
+                    // Après ERR! le bootloader attend un nouveau SYNC
+                    resyncAttempts = 0;
+                    retryWait = 0;
+                    stateStartTime = millis();
+                    flasherState = RESYNC;
+                    return;
+                }
+                uint32_t remoteCrc = responseWord(1);
                 if (response != RSP_OK) {
-                    uploader->notifyClients(String("error:Erreur lors de l'effacement à l'adresse 0x") + String(currentEraseAddress, HEX));
-                    DEBUG(printf("Error: Unexpected ERASE response. Expected: 0x%08X, Received: 0x%08X\n", RSP_OK, response));
+                    notify(String("error:Réponse CRC inattendue à l'adresse 0x") + String(diffAddress, HEX));
+                    DEBUG(printf("Error: Unexpected CRC response. Expected: 0x%08X, Received: 0x%08X\n", RSP_OK, response));
                     flasherState = ERROR;
+                    return;
+                }
+                uint32_t index = sectorIndex(diffAddress);
+                currentRun.phaseBytes[PHASE_CRC] += sectorImageLength(diffAddress - flashStart);
+                if (remoteCrc == diffLocalCrc) {
+                    sectorsSkipped++;
                 } else {
-                    currentEraseAddress += eraseSize;
-                    int progress = ((currentEraseAddress - flashStart) * 100) / fileSize;
-                    if (progress > lastProgress) {
-                        lastProgress = progress;
-                        uploader->notifyClients(String("log:Effacement en cours: ") + progress + "%");
-                    }
-                    DEBUG(printf("Erase block OK. Progress: %d%%\n", progress));
-                    flasherState = ERASE_SECTOR;
+                    sectorDirty[index >> 3] |= 1 << (index & 7);
+                }
+                DEBUG(printf("Sector 0x%08X: local 0x%08X, remote 0x%08X\n", diffAddress, diffLocalCrc, remoteCrc));
+                diffAddress += eraseSize;
+                int progress = ((index + 1) * 100) / sectorsTotal;
+                if (progress > lastProgress) {
+                    lastProgress = progress;
+                    notify(String("log:Comparaison en cours: ") + progress + "%");
                 }
+                flasherState = DIFF_SECTOR;
             } else if (millis() - commandSentTime > 5000) {
-                 uploader->notifyClients("error:Timeout lors de l'attente de la réponse de l'effacement.");
-                 DEBUG(println("Error: Timeout waiting for ERASE response."));
-                 flasherState = ERROR;
+                notify("error:Timeout lors de l'attente de la réponse CRC.");
+                DEBUG(println("Error: Timeout waiting for CRC response."));
+                flasherState = ERROR;
             }
             break;
         }
-        
+
         case WRITE_BLOCK: {
-            if (currentFilePosition >= fileSize) {
+            if (!writePhaseStart) {
+                writePhaseStart = millis();
+            }
+
+            // 1) Réponses reçues, associées aux commandes dans l'ordre d'envoi
+            while (inflightCount && readResponseFrame(inflight[inflightHead].erase ? 4 : 8)) {
+                uint32_t response = responseWord(0);
+                InflightWrite& w = inflight[inflightHead];
+                if (w.erase) {
+                    recordRtt(RTT_ERASE, w.sentMicros);
+                    if (response != RSP_OK) {
+                        DEBUG(printf("Error: Unexpected ERASE response. Expected: 0x%08X, Received: 0x%08X\n", RSP_OK, response));
+                        eraseFailure(String("error:Erreur lors de l'effacement à l'adresse 0x") + String(w.address, HEX) + ".", w.address);
+                        return;
+                    }
+                    inflightHead = (inflightHead + 1) % FLASHER_WRITE_WINDOW;
+                    inflightCount--;
+                    if (tuning()) {
+                        // Temps de l'effacement, retiré de la mesure du débit
+                        uint32_t now = micros();
+                        if (tuneAckBlocks) {
+                            tuneEraseUs += now - tuneLastAck;
+                            tuneLastAck = now;
+                        }
+                        tuneLastErase = now;
+                    }
+                    currentRun.phaseBytes[PHASE_ERASE] += eraseSize;
+                    // Les blocs des secteurs précédents sont tous acquittés
+                    if (w.address - flashStart > ackedFilePosition) {
+                        ackedFilePosition = w.address - flashStart;
+                    }
+                    DEBUG(printf("Erase sector 0x%08X OK\n", w.address));
+                    continue;
+                }
+                recordRtt(RTT_WRITE, w.sentMicros);
+                if (response != RSP_OK) {
+                    DEBUG(printf("Error: Unexpected WRITE response at 0x%08X. Expected: 0x%08X, Received: 0x%08X with crc : 0x%08X\n", w.address, RSP_OK, response, responseWord(1)));
+                    writePipelineFailure("error:Erreur lors de l'écriture du bloc.");
+                    return;
+                }
+                if (responseWord(1) != w.crc) {
+                    // Bloc abîmé en route et déjà programmé: la flash ne repasse
+                    // à 0xFF que par effacement, on réécrit tout son secteur
+                    DEBUG(printf("WRITE CRC mismatch at 0x%08X: local 0x%08X, remote 0x%08X\n", w.address, w.crc, responseWord(1)));
+                    uint32_t sector = w.address - (w.address - flashStart) % eraseSize;
+                    if (!allowRetry(sector, RETRY_BLOCK_CRC)) {
+                        notify(String("error:Bloc 0x") + String(w.address, HEX) + " toujours corrompu après " +
+                               FLASHER_BLOCK_RETRIES + " essais.");
+                        flasherState = ERROR;
+                        return;
+                    }
+                    notify(String("log:CRC du bloc 0x") + String(w.address, HEX) + " incorrect, réécriture du secteur (" +
+                           retryAttempts + "/" + FLASHER_BLOCK_RETRIES + ").");
+                    inflightHead = (inflightHead + 1) % FLASHER_WRITE_WINDOW;
+                    inflightCount--;
+                    if (tuning()) {
+                        tuneBlockSize(true);
+                    }
+                    stateStartTime = millis();
+                    flasherState = WRITE_DRAIN;
+                    return;
+                }
+                inflightHead = (inflightHead + 1) % FLASHER_WRITE_WINDOW;
+                inflightCount--;
+                if (tuning()) {
+                    tuneAcked(w);
+                }
+                ackedFilePosition = w.address + w.length - flashStart;
+                bytesWritten += w.length;
+                // Un repli peut réécrire depuis le début du secteur courant
+                imageSource->release(ackedFilePosition - (ackedFilePosition % eraseSize));
+                saveCheckpoint();
+                resetInactivityTimer();
+
+                int progress = ((uint64_t)ackedFilePosition * 100) / fileSize;
+                if (progress > lastProgress) {
+                    lastProgress = progress;
+                    notify(String("log:Flashage en cours: ") + progress + "%");
+                }
+                DEBUG(printf("Write block 0x%08X OK. Progress: %d%%\n", w.address, progress));
+            }
+
+            if (inflightCount && millis() - inflight[inflightHead].sentTime > 5000) {
+                InflightWrite& w = inflight[inflightHead];
+                if (w.erase) {
+                    DEBUG(printf("Error: Timeout waiting for ERASE response at 0x%08X.\n", w.address));
+                    eraseFailure("error:Timeout lors de l'attente de la réponse de l'effacement.", w.address);
+                } else {
+                    DEBUG(printf("Error: Timeout waiting for WRITE response at 0x%08X.\n", w.address));
+                    writePipelineFailure("error:Timeout lors de l'attente de la réponse de l'écriture.");
+                }
+                return;
+            }
+
+            // 2) Remplir la fenêtre; pendant le choix de la taille de bloc, la
+            // taille change tous les FLASHER_TUNE_BYTES octets envoyés.
+            // Un secteur n'est effacé qu'au moment d'y écrire son premier bloc:
+            // l'ERASE part dans la même fenêtre, juste devant. Les secteurs sans
+            // rien à flasher (différentiel, trous d'un UF2) ne sont jamais effacés.
+            while (inflightCount < writeWindow) {
+                if (!prefetchLength && !prefetchBlock()) {
+                    notify("error:Erreur de lecture du fichier BIN.");
+                    flasherState = ERROR;
+                    return;
+                }
+                // Secteurs à effacer avant le bloc, ou en fin d'image ceux qui
+                // restent (entièrement vides, mais l'ancien contenu doit partir)
+                uint32_t eraseLimit;
+                if (prefetchLength) {
+                    eraseLimit = flashStart + currentFilePosition + 1; // secteur du bloc compris
+                } else if (currentFilePosition >= fileSize) {
+                    eraseLimit = flashStart + fileSize;
+                } else {
+                    break; // flux en retard
+                }
+                while (currentEraseAddress < eraseLimit && !sectorNeedsFlash(currentEraseAddress)) {
+                    currentEraseAddress += eraseSize;
+                }
+                if (currentEraseAddress < eraseLimit) {
+                    uint32_t eraseCmd[3];
+                    eraseCmd[0] = CMD_ERASE;
+                    eraseCmd[1] = currentEraseAddress;
+                    eraseCmd[2] = eraseSize;
+                    DEBUG(printf("Sending ERASE command. Address: 0x%08X, in flight: %u\n", eraseCmd[1], inflightCount + 1));
+                    port->write((uint8_t*)&eraseCmd, sizeof(eraseCmd));
+                    InflightWrite& e = inflight[(inflightHead + inflightCount) % FLASHER_WRITE_WINDOW];
+                    e.erase = true;
+                    e.address = currentEraseAddress;
+                    e.length = 0;
+                    e.sentTime = millis();
+                    e.sentMicros = micros();
+                    inflightCount++;
+                    currentEraseAddress += eraseSize;
+                    continue;
+                }
+                if (!prefetchLength) {
+                    break; // plus rien à écrire
+                }
+                uint32_t writeCmd[3];
+                writeCmd[0] = CMD_WRITE;
+                writeCmd[1] = flashStart + currentFilePosition;
+                writeCmd[2] = prefetchLength;
+
+                DEBUG(printf("Sending WRITE command. Address: 0x%08X, Size: 0x%08X, in flight: %u\n", writeCmd[1], writeCmd[2], inflightCount + 1));
+                // write() peut attendre de la place dans le tampon TX
+                port->write((uint8_t*)&writeCmd, sizeof(writeCmd));
+                port->write(filebuffer, prefetchLength);
+
+                InflightWrite& w = inflight[(inflightHead + inflightCount) % FLASHER_WRITE_WINDOW];
+                w.erase = false;
+                w.address = writeCmd[1];
+                w.length = prefetchLength;
+                w.sentTime = millis();
+                w.sentMicros = micros();
+                w.crc = ~calculateCrc32(filebuffer, prefetchLength);
+                w.tune = tuneStep < tuneSteps ? tuneStep : FLASHER_TUNE_SIZES;
+                inflightCount++;
+                if (tuneStep < tuneSteps) {
+                    // Groupe envoyé: taille suivante, ou la plus grande en
+                    // attendant le choix
+                    tuneBytes += prefetchLength;
+                    if (tuneBytes >= FLASHER_TUNE_BYTES && tuneBytes >= FLASHER_TUNE_BLOCKS * prefetchLength) {
+                        tuneBytes = 0;
+                        tuneStep++;
+                        blockSize = tuneStep < tuneSteps ? tuneSize[tuneStep] : writeSize;
+                    }
+                }
+
+                currentFilePosition += prefetchLength;
+                prefetchLength = 0;
+                if (!prefetchBlock()) {
+                    notify("error:Erreur de lecture du fichier BIN.");
+                    flasherState = ERROR;
+                    return;
+                }
+            }
+
+            // Flux en retard: rien à envoyer, on attend les données
+            if (!prefetchLength && currentFilePosition < fileSize) {
+                if (!streamWaitStart) {
+                    streamWaitStart = millis();
+                } else if (millis() - streamWaitStart > 30000) {
+                    notify("error:Flux interrompu: plus de données reçues.");
+                    flasherState = ERROR;
+                }
+                return;
+            }
+            streamWaitStart = 0;
+
+            // 3) Tout est acquitté
+            if (!inflightCount && !prefetchLength) {
+                if (tuning()) {
+                    tuneBlockSize(false); // image plus courte que les essais
+                }
+                uint32_t elapsed = millis() - writePhaseStart;
+                notify(String("log:Écriture: ") + bytesWritten + " octets en " + elapsed + " ms (" +
+                                        bytesPerSecond(bytesWritten, elapsed) + " o/s, fenêtre " + writeWindow + ")");
+                if (blankBytesSkipped) {
+                    notify(String("log:Pages vides (0xFF) non envoyées: ") + blankBytesSkipped + " octets (" +
+                                            blankBytesSkipped / FLASH_PAGE_SIZE + " pages)");
+                }
+                if (differentialActive) {
+                    notify(String("log:Secteurs ignorés (identiques): ") + sectorsSkipped + "/" + sectorsTotal);
+                }
                 flasherState = CALCULATE_CRC;
+            }
+            break;
+        }
+
+        case WRITE_DRAIN: {
+            // Les commandes parties après le bloc corrompu seront renvoyées: on
+            // attend seulement leurs réponses pour garder l'association
+            while (inflightCount && readResponseFrame(inflight[inflightHead].erase ? 4 : 8)) {
+                recordRtt(inflight[inflightHead].erase ? RTT_ERASE : RTT_WRITE, inflight[inflightHead].sentMicros);
+                if (responseWord(0) != RSP_OK) {
+                    writePipelineFailure("error:Erreur lors de l'écriture du bloc.");
+                    return;
+                }
+                inflightHead = (inflightHead + 1) % FLASHER_WRITE_WINDOW;
+                inflightCount--;
+            }
+            if (inflightCount) {
+                if (millis() - inflight[inflightHead].sentTime > 5000) {
+                    writePipelineFailure("error:Timeout lors de l'attente de la réponse de l'écriture.");
+                }
                 return;
             }
-            resetInactivityTimer();
-            binFile.seek(currentFilePosition); 
-            uint32_t r = binFile.read(filebuffer, writeSize); 
-            uint32_t towrite = r;
-            if (r <= 0) 
-            {
-                uploader->notifyClients("error:Erreur de lecture du fichier BIN.");
-                flasherState = ERROR;
+            if (millis() - stateStartTime < retryWait) {
                 return;
             }
-            towrite = ALIGN_UP(towrite, 256);
-            uint32_t writeCmd[3];
-            writeCmd[0] = CMD_WRITE;
-            writeCmd[1] = flashStart + currentFilePosition;
-            writeCmd[2] = towrite;
-            
-            DEBUG(printf("Sending WRITE command. Address: 0x%08X, Size: 0x%08X\n", writeCmd[1], writeCmd[2]));
-            SerialRP2040.write((uint8_t*)&writeCmd, sizeof(writeCmd));
-            SerialRP2040.write(filebuffer, towrite);
-            SerialRP2040.flush();
-            
-            currentFilePosition += towrite;
-            commandSentTime = millis();
-            flasherState = WAIT_WRITE_RESPONSE;
+            // Nouvel effacement du secteur du bloc, puis écriture depuis son début
+            uint32_t rewind = ackedFilePosition - (ackedFilePosition % eraseSize);
+            currentEraseAddress = flashStart + rewind;
+            currentFilePosition = rewind;
+            ackedFilePosition = rewind;
+            prefetchLength = 0;
+            flasherState = WRITE_BLOCK;
             break;
         }
 
-        case WAIT_WRITE_RESPONSE: {
-            if (millis() - commandSentTime < BOOTLOADER_RESPONSE_DELAY) {
+        case RESYNC: {
+            if (millis() - stateStartTime < 100 + retryWait) {
                 return;
             }
-            if (SerialRP2040.available() >= 8) {
-                uint32_t response;
-                uint32_t crc;
-                
-                SerialRP2040.readBytes((uint8_t*)&response, 4);
-                SerialRP2040.readBytes((uint8_t*)&crc, 4);
-                if (response != RSP_OK) {
-                    uploader->notifyClients("error:Erreur lors de l'écriture du bloc.");
-                    DEBUG(printf("Error: Unexpected WRITE response. Expected: 0x%08X, Received: 0x%08X with crc : 0x%08X\n", RSP_OK, response, crc));
-                    flasherState = ERROR;
-                } else {
-                    int progress = (currentFilePosition * 100) / fileSize;
-                    if (progress > lastProgress) {
-                        lastProgress = progress;
-                        uploader->notifyClients(String("log:Flashage en cours: ") + progress + "%");
-                    }
-                    DEBUG(printf("Write block OK. Progress: %d%%\n", progress));
-                    flasherState = WRITE_BLOCK;
-                }
-            } else if (millis() - commandSentTime > 5000) {
-                 uploader->notifyClients("error:Timeout lors de l'attente de la réponse de l'écriture.");
-                 DEBUG(println("Error: Timeout waiting for WRITE response."));
-                 flasherState = ERROR;
+            // Des octets zéro terminent une éventuelle trame WRITE incomplète
+            // (elle tombe dans la zone qui va être réeffacée), puis le
+            // bootloader rejette l'opcode nul et attend un SYNC.
+            currentRun.retries[RETRY_RESYNC]++;
+            static const uint8_t zeros[64] = {0};
+            for (uint32_t n = 0; n < writeSize + 12; n += sizeof(zeros)) {
+                port->write(zeros, sizeof(zeros));
+            }
+            port->flush();
+            delay(BOOTLOADER_RESPONSE_DELAY);
+            uint32_t syncCmd = CMD_SYNC;
+            sendCommandNonBlocking((uint8_t*)&syncCmd, sizeof(syncCmd));
+            flasherState = WAIT_RESYNC_RESPONSE;
+            break;
+        }
+
+        case WAIT_RESYNC_RESPONSE: {
+            bool synced = false;
+            if (readResponseFrame(4)) {
+                uint32_t response = responseWord(0);
+                recordRtt(RTT_SYNC, commandSentMicros);
+                synced = (response == RSP_SYNC);
+                DEBUG(printf("Resync response: 0x%08X\n", response));
+            } else if (millis() - commandSentTime < 1000) {
+                return;
+            }
+            if (synced) {
+                notify(String("log:Resynchronisé, reprise à 0x") + String(currentEraseAddress, HEX));
+                flasherState = WRITE_BLOCK;
+            } else if (++resyncAttempts >= 5) {
+                notify("error:Impossible de resynchroniser le bootloader.");
+                flasherState = ERROR;
+            } else {
+                stateStartTime = millis();
+                flasherState = RESYNC;
             }
             break;
         }
 
         case CALCULATE_CRC: {
-            uploader->notifyClients("log:Calcul du CRC du firmware...");
-            resetInactivityTimer();
-            binFile.seek(0);
-            calculatedCrc = calculateCrc32FromFile(binFile);
-            uploader->notifyClients(String("log:CRC calculé : 0x") + String(calculatedCrc, HEX));
+            // Normalement déjà complet: le CRC est accumulé pendant l'écriture.
+            // Sinon on termine la lecture par tranches pour ne pas bloquer loop().
+            if (crcFilePosition < fileSize) {
+                if (crcFilePosition == 0) {
+                    notify("log:Calcul du CRC du firmware...");
+                }
+                resetInactivityTimer();
+                // Secteurs que l'image ne couvre pas (UF2 creux): leur contenu
+                // n'est connu que du RP2040, on lui en demande le CRC.
+                if (!imageSource->covers(crcFilePosition, eraseSize)) {
+                    uint32_t gapEnd = crcFilePosition;
+                    while (gapEnd < fileSize && !imageSource->covers(gapEnd, eraseSize)) {
+                        gapEnd += eraseSize;
+                    }
+                    crcGapLength = gapEnd - crcFilePosition;
+                    uint32_t crcCmd[3];
+                    crcCmd[0] = CMD_CRC;
+                    crcCmd[1] = flashStart + crcFilePosition;
+                    crcCmd[2] = crcGapLength;
+                    sendCommandNonBlocking((uint8_t*)&crcCmd, sizeof(crcCmd));
+                    flasherState = WAIT_GAP_CRC_RESPONSE;
+                    return;
+                }
+                uint32_t length = eraseSize - crcFilePosition % eraseSize;
+                if (length > filebufferSize) {
+                    length = filebufferSize;
+                }
+                int r = imageSource->read(crcFilePosition, filebuffer, length);
+                if (r <= 0) {
+                    notify("error:Erreur de lecture du fichier BIN.");
+                    flasherState = ERROR;
+                    return;
+                }
+                accumulateCrc(crcFilePosition, filebuffer, r);
+                localWork = true;
+                return;
+            }
+            calculatedCrc = ~crcState;
+            uint32_t expected;
+            if (imageSource->expectedCrc(&expected) && expected != calculatedCrc) {
+                notify(String("error:CRC de l'image incorrect (attendu 0x") + String(expected, HEX) +
+                                        ", obtenu 0x" + String(calculatedCrc, HEX) + ").");
+                flasherState = ERROR;
+                return;
+            }
+            notify(String("log:CRC calculé : 0x") + String(calculatedCrc, HEX));
             flasherState = SEAL_FLASH;
             break;
         }
 
+        case WAIT_GAP_CRC_RESPONSE: {
+            if (readResponseFrame(8)) {
+                uint32_t response = responseWord(0);
+                recordRtt(RTT_CRC, commandSentMicros);
+                if (response != RSP_OK) {
+                    notify("error:Le bootloader ne fournit pas le CRC des zones non couvertes par l'UF2.");
+                    DEBUG(printf("Error: Unexpected CRC response. Expected: 0x%08X, Received: 0x%08X\n", RSP_OK, response));
+                    flasherState = ERROR;
+                    return;
+                }
+                crcState = ~crc32Combine(~crcState, responseWord(1), crcGapLength);
+                currentRun.phaseBytes[PHASE_CRC] += crcGapLength;
+                crcFilePosition += crcGapLength;
+                flasherState = CALCULATE_CRC;
+            } else if (millis() - commandSentTime > 5000) {
+                notify("error:Timeout lors de l'attente de la réponse CRC.");
+                DEBUG(println("Error: Timeout waiting for CRC response."));
+                flasherState = ERROR;
+            }
+            break;
+        }
+
 
         case SEAL_FLASH: {
-            uploader->notifyClients("log:Scellement du firmware...");
+            notify("log:Scellement du firmware...");
             uint32_t sealCmd[4];
             sealCmd[0] = CMD_SEAL;
             sealCmd[1] = flashStart;
@@ -332,43 +1668,62 @@ void handleFlasher() {
         }
 
         case WAIT_SEAL_RESPONSE: {
-            if (millis() - commandSentTime < BOOTLOADER_RESPONSE_DELAY) {
-                return;
-            }
-            if (SerialRP2040.available() >= 4) {
-                uint32_t response;
-                SerialRP2040.readBytes((uint8_t*)&response, 4);
+            if (readResponseFrame(4)) {
+                uint32_t response = responseWord(0);
+                recordRtt(RTT_SEAL, commandSentMicros);
                 if (response != RSP_OK) {
-                    uploader->notifyClients("error:Erreur lors du scellement.");
+                    notify("error:Erreur lors du scellement.");
                     DEBUG(printf("Error: Unexpected SEAL response. Expected: 0x%08X, Received: 0x%08X\n", RSP_OK, response));
                     flasherState = ERROR;
                 } else {
-                    uploader->notifyClients("log:Scellement réussi.");
+                    notify("log:Scellement réussi.");
+                    currentRun.phaseBytes[PHASE_SEAL] = fileSize;
                     DEBUG(printf("Response OK: 0x%08X\n", response));
                     flasherState = DONE;
                 }
             } else if (millis() - commandSentTime > 5000) {
-                 uploader->notifyClients("error:Timeout lors de l'attente de la réponse du scellement.");
+                 notify("error:Timeout lors de l'attente de la réponse du scellement.");
                  DEBUG(println("Error: Timeout waiting for SEAL response."));
                  flasherState = ERROR;
             }
             break;
         }
 
-        case DONE:
-            uploader->notifyClients("log:Flashage terminé ! L'appareil va redémarrer.");
-            uploader->notifyClients("EVENT:FLASH_COMPLETE");
+        case DONE: {
+            uint32_t elapsed = millis() - flashProcessStart;
+            notify(String("log:Flash complet: ") + fileSize + " octets en " + elapsed + " ms (" +
+                                    bytesPerSecond(fileSize, elapsed) + " o/s)");
+            reportRttStats();
+            String retries;
+            for (int k = 0; k < FLASH_RETRIES; ++k) {
+                if (currentRun.retries[k]) {
+                    retries += String(retries.length() ? ", " : "") + flashRetryName(k) + " " + currentRun.retries[k];
+                }
+            }
+            if (retries.length()) {
+                notify("log:Reprises: " + retries);
+            }
+            notify("log:Flashage terminé ! L'appareil va redémarrer.");
+            notify("EVENT:FLASH_COMPLETE");
             resetInactivityTimer();
-            binFile.close();
+            closeImageSource();
             uint32_t goCmd[2];
             goCmd[0] = CMD_GO;
             goCmd[1] = flashStart;
             sendCommandNonBlocking((uint8_t*)&goCmd, sizeof(goCmd));
+            currentRun.phaseBytes[PHASE_GO] = sizeof(goCmd);
+            clearCheckpoint();
+            accountPhase(DONE);
+            finishRun(true);
+            setFlasherBaud(RP2040_SERIAL_BAUD);
             flasherState = IDLE;
             break;
+        }
 
         case ERROR:
-            binFile.close();
+            finishRun(false);
+            closeImageSource();
+            setFlasherBaud(RP2040_SERIAL_BAUD);
             flasherState = IDLE;
             break;
     }
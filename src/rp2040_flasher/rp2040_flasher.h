@@ -2,6 +2,11 @@
 
 #include <Arduino.h>
 #include <LittleFS.h>
+#include <atomic>
+#include "crc32.h"
+#include "image_source.h"
+#include "compressed_image.h"
+#include "uf2_image.h"
 #ifdef USE_WIFI
 #include <ESPAsyncWebServer.h>
 #endif
@@ -16,13 +21,175 @@
 #define CMD_GO (('G' << 0) | ('O' << 8) | ('G' << 16) | ('O' << 24))
 #define RSP_OK (('O' << 0) | ('K' << 8) | ('O' << 16) | ('K' << 24))
 #define RSP_ERR (('E' << 0) | ('R' << 8) | ('R' << 16) | ('!' << 24))
+// Extension optionnelle du bootloader: BAUD <débit> -> OKOK au débit courant,
+// puis bascule. Sans SYNC valide au nouveau débit dans les
+// FLASHER_BAUD_REVERT_MS, le bootloader revient au débit précédent.
+// Un bootloader qui ne la connaît pas répond ERR! et on reste au nominal.
+#define CMD_BAUD (('B' << 0) | ('A' << 8) | ('U' << 16) | ('D' << 24))
 
-// Délai d'attente pour les réponses du bootloader (en ms)
+// Délai laissé au bootloader pour digérer une trame de resynchronisation (en ms).
+// Les réponses normales sont traitées dès qu'une trame complète est reçue.
 #define BOOTLOADER_RESPONSE_DELAY 10
 
-// Prototypes des fonctions
-void flushSerial();
-void sendCommandNonBlocking(const uint8_t* command, size_t len, const String& debugMessage);
+// Unité de programmation de la flash du RP2040: les WRITE en sont des multiples
+#define FLASH_PAGE_SIZE 256
+
+// Nombre maximal de commandes WRITE envoyées sans attendre leur réponse.
+// 1 = stop-and-wait. Le flasheur repasse automatiquement à 1 si le bootloader
+// ne suit pas (réponse invalide ou timeout).
+#ifndef FLASHER_WRITE_WINDOW
+#define FLASHER_WRITE_WINDOW 4
+#endif
+
+// Taille des blocs WRITE: limite annoncée par INFO, bornée à un secteur
+// d'effacement et à FLASHER_MAX_BLOCK. Avec FLASHER_ADAPTIVE_WRITE, les
+// premiers blocs sont envoyés par groupes de FLASHER_TUNE_BYTES octets (au
+// moins FLASHER_TUNE_BLOCKS blocs), une taille par groupe (de
+// FLASHER_TUNE_MIN_BLOCK à la limite, en doublant), sans vider la fenêtre
+// entre deux groupes. Le débit de chaque taille est
+// mesuré entre les acquittements de ses blocs, fenêtre pleine, sans le temps
+// des effacements intercalés; la meilleure sert pour le reste de l'image.
+#ifndef FLASHER_ADAPTIVE_WRITE
+#define FLASHER_ADAPTIVE_WRITE 1
+#endif
+#ifndef FLASHER_MAX_BLOCK
+#define FLASHER_MAX_BLOCK (16 * 1024)
+#endif
+#define FLASHER_TUNE_MIN_BLOCK 1024
+#define FLASHER_TUNE_BYTES (16 * 1024)
+#define FLASHER_TUNE_BLOCKS 4
+#define FLASHER_TUNE_SIZES 5
+// Taille minimale du tampon de lecture (CRC, comparaison, contrôle de l'image)
+#define FLASHER_SCRATCH_SIZE 4096
+
+// Débits essayés dans l'ordre croissant après la synchronisation, pour la
+// durée du flash. Le dernier débit validé est conservé; RP2040_SERIAL_BAUD
+// est rétabli après CMD_GO. Mettre FLASHER_BAUD_ESCALATION à 0 pour désactiver.
+#ifndef FLASHER_BAUD_ESCALATION
+#define FLASHER_BAUD_ESCALATION 1
+#endif
+#ifndef FLASHER_BAUD_LADDER
+#define FLASHER_BAUD_LADDER 1500000, 2000000, 3000000
+#endif
+#define FLASHER_BAUD_REVERT_MS 500
+
+// Bloc ou secteur en échec (CRC renvoyé par WRITE différent du CRC local,
+// ERR!, timeout): nouvel essai de ce seul secteur, au plus
+// FLASHER_BLOCK_RETRIES fois par adresse et FLASHER_MAX_RETRIES fois par
+// flash, après une attente qui double à chaque essai.
+#ifndef FLASHER_BLOCK_RETRIES
+#define FLASHER_BLOCK_RETRIES 3
+#endif
+#ifndef FLASHER_MAX_RETRIES
+#define FLASHER_MAX_RETRIES 16
+#endif
+#ifndef FLASHER_RETRY_BACKOFF_MS
+#define FLASHER_RETRY_BACKOFF_MS 20
+#endif
+// SYNC initial sans réponse (une tentative par seconde): le flasheur passe
+// en erreur au bout de FLASHER_SYNC_ATTEMPTS tentatives
+#ifndef FLASHER_SYNC_ATTEMPTS
+#define FLASHER_SYNC_ATTEMPTS 60
+#endif
+
+// Point de reprise en NVS mis à jour tous les FLASHER_CHECKPOINT_INTERVAL
+// octets acquittés au plus: chaque écriture NVS use la flash de l'ESP32 et
+// bloque le pipeline d'écriture le temps du commit.
+#ifndef FLASHER_CHECKPOINT_INTERVAL
+#define FLASHER_CHECKPOINT_INTERVAL (64 * 1024)
+#endif
+
+// Contrôle de l'image avant tout effacement: taille comparée à la zone
+// applicative annoncée par INFO, pointeur de pile initial en SRAM et vecteur
+// reset Thumb dans l'image (la table des vecteurs est au début de l'image).
+#define RP2040_SRAM_START 0x20000000
+#define RP2040_SRAM_END   0x20042000
+
+// En-tête facultatif placé par le build de l'application juste après la
+// table des vecteurs (48 mots sur Cortex-M0+). S'il est présent, sa taille
+// doit correspondre à l'image; FLASHER_IMAGE_BOARD_ID impose la carte et
+// FLASHER_REQUIRE_IMAGE_HEADER refuse les images qui n'en ont pas.
+#define FLASH_IMAGE_HEADER_MAGIC 0x48495052   // "RPIH"
+#ifndef FLASH_IMAGE_HEADER_OFFSET
+#define FLASH_IMAGE_HEADER_OFFSET 0xC0
+#endif
+
+struct __attribute__((packed)) FlashImageHeader {
+    uint32_t magic;
+    uint32_t imageSize;    // taille de l'image binaire, en-tête compris
+    uint32_t boardId;      // 0: toutes cartes
+    uint32_t version;
+};
+
+// Temps aller-retour (envoi -> trame de réponse complète) par type de commande
+enum RttCommand {
+    RTT_SYNC,
+    RTT_INFO,
+    RTT_CRC,
+    RTT_ERASE,
+    RTT_WRITE,
+    RTT_SEAL,
+    RTT_COMMANDS
+};
+#define RTT_BUCKETS 8 // < 0.5, 1, 2, 4, 8, 16, 32 ms, puis >= 32 ms
+struct RttStats {
+    uint32_t count;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint64_t totalUs;
+    uint32_t buckets[RTT_BUCKETS];
+};
+const char* rttCommandName(int command);
+
+// Phases d'un flash, pour savoir où passe le temps. SYNC comprend la montée
+// en débit et les resynchronisations, CRC la comparaison différentielle et
+// le contrôle final. En flux, l'attente des données compte dans la phase.
+enum FlashPhase {
+    PHASE_SYNC,
+    PHASE_INFO,
+    PHASE_ERASE,
+    PHASE_WRITE,
+    PHASE_CRC,
+    PHASE_SEAL,
+    PHASE_GO,
+    FLASH_PHASES
+};
+const char* flashPhaseName(int phase);
+
+// Reprises comptées pendant un flash
+enum FlashRetry {
+    RETRY_SYNC,        // SYNC sans réponse ou réponse inattendue
+    RETRY_BAUD,        // retour au débit précédent
+    RETRY_PIPELINE,    // repli en stop-and-wait
+    RETRY_RESYNC,      // trame de resynchronisation envoyée
+    RETRY_BLOCK_CRC,   // bloc reçu corrompu par le RP2040, secteur réécrit
+    RETRY_WRITE,       // WRITE en erreur ou sans réponse (stop-and-wait)
+    RETRY_ERASE,       // ERASE en erreur ou sans réponse
+    FLASH_RETRIES
+};
+const char* flashRetryName(int retry);
+
+// Bilan d'un flash, remis à FlasherEvents::flasherRunFinished()
+struct FlashRun {
+    uint32_t id;                       // attribué par recordFlashRun()
+    uint32_t endMs;                    // millis() à la fin
+    uint8_t target;                    // 0 = inconnue
+    bool success;
+    uint32_t imageSize;
+    uint32_t baud;                     // débit UART pendant le flash
+    uint32_t totalMs;                  // du lancement à CMD_GO (hors SYNC initial)
+    uint32_t phaseUs[FLASH_PHASES];
+    uint32_t phaseBytes[FLASH_PHASES]; // octets effacés, écrits, vérifiés par le RP2040, scellés
+    uint16_t retries[FLASH_RETRIES];
+    uint32_t writeBlock;               // taille des blocs WRITE retenue
+    struct {
+        uint32_t count;
+        uint32_t minUs;
+        uint32_t avgUs;
+        uint32_t maxUs;
+    } rtt[RTT_COMMANDS];
+};
+
 uint32_t calculateCrc32(const uint8_t* data, size_t length, uint32_t crc);
 
 // Machine à états pour le flashage non bloquant
@@ -30,20 +197,295 @@ enum FlasherState {
     IDLE,
     INIT,
     WAIT_SYNC_RESPONSE,
+    BAUD_STEP,         // montée en débit de l'UART avant le flash
+    WAIT_BAUD_RESPONSE,
+    WAIT_BAUD_SYNC,
+    BAUD_FALLBACK,
     SEND_INFO_COMMAND,
     WAIT_INFO_RESPONSE,
-    ERASE_SECTOR,
-    WAIT_ERASE_RESPONSE,
-    WRITE_BLOCK,
-    WAIT_WRITE_RESPONSE,
+    RESUME_CHECK,      // flash interrompu: CRC de la zone déjà écrite, des deux côtés
+    WAIT_RESUME_RESPONSE,
+    DIFF_SECTOR,       // mode différentiel: CRC de chaque secteur côté RP2040
+    WAIT_DIFF_RESPONSE,
+    WRITE_BLOCK,       // effacement juste devant l'écriture, envoi des blocs et collecte des réponses (pipeline)
+    WRITE_DRAIN,       // bloc corrompu: réponses des blocs suivants, puis réécriture du secteur
+    RESYNC,            // repli stop-and-wait: resynchronisation du bootloader
+    WAIT_RESYNC_RESPONSE,
     CALCULATE_CRC, // Ajout de l'état
+    WAIT_GAP_CRC_RESPONSE,
     SEAL_FLASH,
     WAIT_SEAL_RESPONSE,
     DONE,
     ERROR
 };
+// Résultat de FlasherEngine::step(): ce que l'appelant fait avant le suivant
+enum FlasherStep {
+    STEP_BUSY,         // changement d'état ou travail local par tranches: rappeler aussitôt
+    STEP_WAITING,      // attend une réponse du RP2040: dormir jusqu'à la prochaine réception
+    STEP_STALLED       // rien à faire pour l'instant (flux en retard, délai): dormir aussi
+};
+
 void resetInactivityTimer();
 extern bool rp2040BootloaderActive; // Indique si le RP2040 est en mode bootloader
-// Prototypes des fonctions pour le processus de flashage
+
+// Destinataire des messages d'un flasheur
+class FlasherEvents {
+    public:
+        virtual ~FlasherEvents() {}
+        // "log:...", "error:..." ou "EVENT:..." pour l'interface
+        virtual void flasherMessage(const String& message) = 0;
+        // Bootloader synchronisé, broche de boot relâchée
+        virtual void flasherSynced() {}
+        // Flash terminé (réussi ou non), juste avant le retour à IDLE
+        virtual void flasherRunFinished(const FlashRun& run) {}
+};
+
+// État d'un flasheur tel que le voient les autres tâches (voir status())
+struct FlasherStatus {
+    FlasherState state;
+    uint8_t phase;             // FlashPhase, FLASH_PHASES hors flash
+    uint8_t progress;          // % de l'étape en cours, comme dans les logs
+    uint32_t imageSize;
+    uint32_t ackedBytes;       // écrits et acquittés
+    uint32_t elapsedMs;        // depuis le lancement du flash
+};
+
+// Mode différentiel: 1 bit par secteur à réécrire (16 MiB en secteurs de 4 KiB)
+#define MAX_DIFF_SECTORS 4096
+
+// Un flasheur par RP2040: tout l'état du flash, le lien série et le
+// destinataire des messages. loop() ne bloque pas; plusieurs instances
+// peuvent avancer en parallèle depuis la même boucle.
+class FlasherEngine {
+    public:
+        // Sur un UART: montée en débit possible, réveil à la réception.
+        // bootPin (-1 = aucune) est relâchée une fois le bootloader synchronisé.
+        FlasherEngine(HardwareSerial& uart, FlasherEvents& events, int bootPin = -1);
+        // Sur un lien quelconque (tests, banc d'essai): débit fixe
+        FlasherEngine(Stream& port, FlasherEvents& events);
+        ~FlasherEngine();
+
+        void begin(); // à appeler dans setup() après uart.begin()
+        void start(FlasherState fs = INIT, bool resetInactivity = true);
+        // Abandonne la synchronisation ou le flash en cours
+        void stop();
+        void loop();
+        // loop() sans l'attente. Sauf STEP_BUSY, l'appelant peut dormir dans
+        // waitForRxEvent() (plusieurs flasheurs: une seule attente quand aucun
+        // n'est STEP_BUSY)
+        FlasherStep step();
+        void waitForRxEvent();
+        // state() et busy() sont réservés à la tâche qui fait avancer le
+        // flasheur; les autres tâches lisent status(), copie cohérente publiée
+        // à chaque step() et lue sans verrou
+        FlasherState state() const { return flasherState; }
+        bool busy() const { return flasherState != IDLE; }
+        FlasherStatus status() const;
+        // Débit de l'UART hors flash (console série, autre tâche). Refusé
+        // (false) pendant un flash; sérialisé avec le démarrage d'un flash,
+        // qui remet l'UART au débit nominal depuis la tâche du flasheur.
+        bool setIdleBaud(uint32_t baud);
+
+        // Image à flasher au prochain start(SEND_INFO_COMMAND);
+        // nullptr (défaut) = firmwareImagePath(), l'image sélectionnée dans le
+        // cache ou /firmware.bin. Remis à nullptr à la fin du flash.
+        void setSource(ImageSource* source) { requestedSource = source; }
+        // Mode différentiel: seuls les secteurs dont le CRC diffère sont
+        // effacés et réécrits. À choisir avant start(SEND_INFO_COMMAND).
+        void setDifferential(bool enabled) { differentialFlash = enabled; }
+        // Clé NVS du point de reprise (nullptr = pas de reprise). Un flash
+        // interrompu de la même image reprend au dernier secteur acquitté,
+        // une fois la zone déjà écrite confirmée par CMD_CRC.
+        void setCheckpointKey(const char* key) { checkpointKey = key; }
+        const RttStats& rtt(int command) const { return rttStats[command]; }
+        // Mesures du flash en cours ou du dernier flash
+        const FlashRun& run() const { return currentRun; }
+
+    private:
+        // Bloc envoyé mais pas encore acquitté, ou effacement d'un secteur
+        struct InflightWrite {
+            bool erase;            // ERASE du secteur address (réponse de 4 octets)
+            uint32_t address;
+            uint32_t length;
+            uint32_t sentTime;
+            uint32_t sentMicros;
+            uint32_t crc;          // CRC des octets envoyés, comparé à celui de la réponse
+            uint8_t tune;          // taille essayée (tuneSize), FLASHER_TUNE_SIZES hors essai
+        };
+
+        void runState();
+        void notify(const String& message) { events.flasherMessage(message); }
+        void wake();
+        uint32_t responseWord(int index);
+        bool readResponseFrame(uint8_t expected);
+        void flushSerial();
+        void sendCommandNonBlocking(const uint8_t* command, size_t len);
+        void sendSync();
+        void setFlasherBaud(uint32_t baud);
+        void resetRttStats();
+        void recordRtt(RttCommand command, uint32_t sentMicros);
+        void reportRttStats();
+        void accountPhase(FlasherState state);
+        void finishRun(bool success);
+        void accumulateCrc(uint32_t offset, const uint8_t* data, uint32_t length);
+        uint32_t sectorIndex(uint32_t address);
+        bool sectorNeedsFlash(uint32_t address);
+        uint32_t sectorImageLength(uint32_t offset);
+        bool prefetchBlock();
+        void writePipelineFailure(const String& message);
+        bool allowRetry(uint32_t address, FlashRetry kind);
+        void eraseFailure(const String& message, uint32_t address);
+        void closeImageSource();
+        void publishStatus();
+        bool setupTransfer();
+        void tuneBlockSize(bool stop);
+        void tuneAcked(const InflightWrite& w);
+        void tuneMeasured();
+        bool tuning() const { return tuneAckStep < tuneSteps; }
+        bool validateImage(uint32_t flashSize);
+        void beginCheckpoint();
+        void saveCheckpoint();
+        void clearCheckpoint();
+
+        Stream* port;
+        HardwareSerial* uart;
+        FlasherEvents& events;
+        int bootPin;
+#ifdef ESP_PLATFORM
+        TaskHandle_t wakeTask = nullptr;
+        SemaphoreHandle_t uartMutex = nullptr;  // voir setIdleBaud()
+#endif
+
+        FlasherState flasherState = IDLE;
+
+        // Image à flasher: firmwareImagePath() par défaut, ou setSource()
+        FileImageSource fileImage;
+        InflateImageSource inflateImage;
+        Uf2ImageSource uf2Image;
+        ImageSource* imageSource = nullptr;
+        ImageSource* requestedSource = nullptr;
+        uint32_t streamWaitStart = 0;
+        uint32_t fileSize = 0;
+        uint8_t* filebuffer = nullptr;     // alloué d'après INFO (setupTransfer())
+        uint32_t filebufferSize = 0;
+
+        uint32_t currentFilePosition = 0;
+        uint32_t currentEraseAddress = 0;  // prochain secteur à effacer, juste devant l'écriture
+        uint32_t flashStart = 0;
+        uint32_t stateStartTime = 0;
+        uint32_t eraseSize = 0;
+        uint32_t writeSize = 0;            // plus grand bloc WRITE accepté
+        uint32_t blockSize = 0;            // taille des blocs WRITE envoyés
+        uint32_t commandSentTime = 0;
+        uint32_t commandSentMicros = 0;
+        int lastProgress = 0;
+
+        // CRC accumulé pendant la lecture des blocs
+        uint32_t calculatedCrc = 0;
+        uint32_t crcState = CRC32_INIT;
+        uint32_t crcFilePosition = 0;      // octets de l'image déjà pris en compte
+        uint32_t crcGapLength = 0;         // zone non couverte (UF2) dont le RP2040 calcule le CRC
+
+        // Pipeline d'écriture: les blocs en vol dans l'ordre d'envoi. Le
+        // bootloader répond dans le même ordre, ce qui permet d'associer
+        // chaque réponse à son adresse.
+        InflightWrite inflight[FLASHER_WRITE_WINDOW];
+        uint8_t inflightHead = 0;
+        uint8_t inflightCount = 0;
+        uint8_t writeWindow = FLASHER_WRITE_WINDOW;
+        uint32_t prefetchLength = 0;       // octets prêts dans filebuffer (0 = rien de préchargé)
+        uint32_t ackedFilePosition = 0;    // tout ce qui précède est écrit et acquitté
+        uint8_t resyncAttempts = 0;
+
+        // Choix de la taille de bloc (FLASHER_ADAPTIVE_WRITE): débit et RTT
+        // moyen mesurés pour chaque taille essayée (0 = pas mesurée)
+        uint8_t tuneStep = 0;              // taille envoyée, tuneSteps: toutes envoyées
+        uint8_t tuneAckStep = 0;           // taille mesurée, tuneSteps: choix fait
+        uint8_t tuneSteps = 0;
+        uint32_t tuneSize[FLASHER_TUNE_SIZES];
+        uint32_t tuneRate[FLASHER_TUNE_SIZES];
+        uint32_t tuneRttUs[FLASHER_TUNE_SIZES];
+        uint32_t tuneBytes = 0;            // envoyés dans le groupe en cours
+        // Acquittements du groupe mesuré: le premier ne fait que lancer le
+        // chronomètre, fenêtre déjà pleine
+        uint32_t tuneAckBlocks = 0;
+        uint32_t tuneAckBytes = 0;
+        uint32_t tuneFirstAck = 0;
+        uint32_t tuneLastAck = 0;
+        uint32_t tuneEraseUs = 0;          // passés sur des ERASE entre deux acquittements
+        uint32_t tuneLastErase = 0;        // dernier ERASE acquitté (micros)
+        uint32_t tuneRttTotal = 0;
+        uint32_t tuneRttSamples = 0;
+
+        // Reprises sur erreur (FLASHER_BLOCK_RETRIES)
+        uint32_t retryAddress = 0;
+        uint8_t retryAttempts = 0;
+        uint8_t retryTotal = 0;
+        uint32_t retryWait = 0;            // attente supplémentaire avant l'essai (ms)
+
+        // Point de reprise en NVS: image (taille, CRC du début) et octets
+        // écrits et acquittés depuis flashStart, en secteurs entiers
+        const char* checkpointKey = nullptr;
+        bool checkpointActive = false;
+        uint32_t imageId = 0;
+        uint32_t checkpointSaved = 0;
+        uint32_t resumeLength = 0;
+
+        // Mode différentiel
+        bool differentialFlash = false;
+        bool differentialActive = false;
+        uint8_t sectorDirty[MAX_DIFF_SECTORS / 8];
+        uint32_t diffAddress = 0;
+        uint32_t diffLocalCrc = 0;
+        uint32_t sectorsSkipped = 0;
+        uint32_t sectorsTotal = 0;
+
+        // Trame de réponse du bootloader en cours de réception
+        uint8_t responseFrame[4 + 5 * sizeof(uint32_t)];
+        uint8_t responseLength = 0;
+        bool responsePending = false;
+        bool localWork = false;      // tranche de CRC local faite, la suite attend le step() suivant
+        RttStats rttStats[RTT_COMMANDS];
+
+        // Copie publiée pour les autres tâches: statusSeq est impair pendant
+        // l'écriture, le lecteur recommence s'il a changé (seqlock)
+        FlasherStatus publishedStatus = {};
+        std::atomic<uint32_t> statusSeq{0};
+
+        // Mesures par phase (step() impute le temps écoulé à la phase de l'état courant)
+        FlashRun currentRun = {};
+        bool runActive = false;
+        uint32_t phaseClock = 0;
+
+        // Montée en débit de l'UART
+        uint32_t flasherBaud;
+        uint32_t baudGood;
+        uint8_t baudStep = 0;
+        uint8_t baudSyncAttempts = 0;
+
+        // Statistiques de débit
+        uint32_t flashProcessStart = 0;
+        uint32_t writePhaseStart = 0;
+        uint32_t bytesWritten = 0;
+        uint32_t blankBytesSkipped = 0;    // pages 0xFF non envoyées (déjà dans cet état après effacement)
+};
+
+// Flasheur du RP2040 branché sur SerialRP2040 (cible 1, voir flash_targets.h).
+// Les fonctions ci-dessous le pilotent, sauf flasherBegin(), handleFlasher()
+// et startStreamFlash() qui tiennent compte de toutes les cibles.
+extern FlasherEngine rp2040Flasher;
+
+// À appeler dans setup() après SerialRP2040.begin(). Sur l'ESP32, lance la
+// tâche qui fait avancer les flasheurs (voir flash_targets.h).
+void flasherBegin();
 void startFlashProcess(FlasherState fs = INIT, bool resetInactivity = true);
+// Un pas de tous les flasheurs: boucle de la tâche du flasheur, ou des tests
 void handleFlasher();
+void setFlashSource(ImageSource* source);
+// Flash en flux: l'image de total octets arrive par streamImage pendant le
+// flash (stage = en garder une copie sur /firmware.bin), sur la première
+// cible sélectionnée. Le RP2040 doit être synchronisé. Refusé (false) si la
+// cible flashe déjà ou qu'un flux est en cours. Le flux est ouvert par la
+// tâche du flasheur; au retour, streamImage accepte les données.
+bool startStreamFlash(uint32_t total, bool stage);
+void setDifferentialFlash(bool enabled);
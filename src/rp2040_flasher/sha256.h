@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+
+// SHA-256 par blocs: begin(), update() autant de fois que nécessaire, puis
+// finish(). Sur l'ESP32 on passe par mbedtls, qui utilise l'accélérateur
+// matériel; sur l'hôte (tests) une implémentation portable.
+#define SHA256_SIZE 32
+
+#if defined(ESP_PLATFORM) && __has_include(<mbedtls/sha256.h>)
+#define SHA256_HAS_MBEDTLS 1
+#include <mbedtls/sha256.h>
+#endif
+
+class Sha256 {
+    public:
+        Sha256() { begin(); }
+        ~Sha256();
+        void begin();
+        void update(const uint8_t* data, size_t length);
+        void finish(uint8_t digest[SHA256_SIZE]);
+        // Empreinte de ce qui a été vu jusqu'ici, le calcul continue
+        void peek(uint8_t digest[SHA256_SIZE]) const;
+
+    private:
+#ifdef SHA256_HAS_MBEDTLS
+        mbedtls_sha256_context ctx;
+        bool started = false;
+#else
+        void transform(const uint8_t* block);
+        uint32_t state[8];
+        uint64_t length = 0;
+        uint8_t block[64];
+#endif
+};
+
+// Empreinte en hexadécimal minuscule (64 caractères) et inverse;
+// sha256FromHex() refuse tout ce qui n'est pas exactement 64 chiffres hexa.
+String sha256Hex(const uint8_t digest[SHA256_SIZE]);
+bool sha256FromHex(const char* hex, uint8_t digest[SHA256_SIZE]);
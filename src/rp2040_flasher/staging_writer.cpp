@@ -0,0 +1,208 @@
+#include "staging_writer.h"
+#include "config.h"
+#include "crc32.h"
+
+#define ALIGN_UP(val, align) (((val) + ((align) - 1)) & ~((align) - 1))
+
+bool StagingWriter::allocate() {
+    if (pool) {
+        return true;
+    }
+#ifdef BOARD_HAS_PSRAM
+    pool = (uint8_t*)ps_malloc(STAGING_BUFFERS * STAGING_BLOCK_SIZE);
+#endif
+    if (!pool) {
+        pool = (uint8_t*)malloc(STAGING_BUFFERS * STAGING_BLOCK_SIZE);
+    }
+    if (!pool) {
+        return false;
+    }
+#ifdef ESP_PLATFORM
+    freeBlocks = xQueueCreate(STAGING_BUFFERS, sizeof(uint8_t));
+    fullBlocks = xQueueCreate(STAGING_BUFFERS, sizeof(StagingBlock));
+    for (uint8_t i = 0; i < STAGING_BUFFERS; ++i) {
+        xQueueSend(freeBlocks, &i, 0);
+    }
+    xTaskCreatePinnedToCore(writerTask, "staging_writer", STAGING_TASK_STACK, this,
+                            STAGING_TASK_PRIORITY, &task, STAGING_TASK_CORE);
+#endif
+    return true;
+}
+
+bool StagingWriter::begin(const char* target, uint32_t expectedSize) {
+    abort();
+    lastError = "";
+    if (!allocate()) {
+        lastError = "mémoire insuffisante";
+        return false;
+    }
+    // LittleFS ne sait pas réserver la place d'un fichier: on vérifie
+    // seulement qu'elle y est, en comptant l'ancien contenu de target et les
+    // images du cache qui peuvent être supprimées. Refusé, le téléversement
+    // laisse target et son empreinte intacts.
+    size_t needed = ALIGN_UP((size_t)expectedSize, STAGING_BLOCK_SIZE);
+    size_t freeBytes = LittleFS.totalBytes() - LittleFS.usedBytes();
+    File old = LittleFS.open(target, "r");
+    if (old) {
+        freeBytes += old.size();
+        old.close();
+    }
+    if (needed > freeBytes && !firmwareCacheReclaim(needed - freeBytes)) {
+        lastError = String("place insuffisante (") + expectedSize + " octets, " + freeBytes + " libres)";
+        return false;
+    }
+    path = target;
+    imageDigestRemove(target);
+    file = LittleFS.open(target, "w");
+    if (!file) {
+        lastError = "ouverture impossible";
+        return false;
+    }
+    current = -1;
+    fill = 0;
+    total = 0;
+    failed = false;
+    elapsed = 0;
+    hash.begin();
+    crcState = CRC32_INIT;
+    startTime = millis();
+    isOpen = true;
+    return true;
+}
+
+// Tampon libre pour la suite des données; sur l'ESP32 on attend que la tâche
+// en rende un si LittleFS est en retard
+bool StagingWriter::acquire() {
+#ifdef ESP_PLATFORM
+    uint8_t index;
+    if (xQueueReceive(freeBlocks, &index, pdMS_TO_TICKS(STAGING_WAIT_MS)) != pdTRUE) {
+        return false;
+    }
+    current = index;
+#else
+    current = 0;
+#endif
+    fill = 0;
+    return true;
+}
+
+// Confie le tampon courant à la tâche d'écriture
+void StagingWriter::submit() {
+#ifdef ESP_PLATFORM
+    StagingBlock block = { (uint8_t)current, (uint16_t)fill };
+    if (fill) {
+        xQueueSend(fullBlocks, &block, portMAX_DELAY);
+    } else {
+        xQueueSend(freeBlocks, &block.index, portMAX_DELAY);
+    }
+#else
+    store(current, fill);
+#endif
+    current = -1;
+    fill = 0;
+}
+
+// Attend que tous les tampons confiés à la tâche soient écrits
+void StagingWriter::drain() {
+#ifdef ESP_PLATFORM
+    while (uxQueueMessagesWaiting(freeBlocks) < STAGING_BUFFERS) {
+        vTaskDelay(1);
+    }
+#endif
+}
+
+void StagingWriter::store(uint8_t index, uint32_t length) {
+    if (!failed && file.write(pool + index * STAGING_BLOCK_SIZE, length) != length) {
+        failed = true;
+    }
+}
+
+#ifdef ESP_PLATFORM
+void StagingWriter::writerTask(void* arg) {
+    StagingWriter* self = (StagingWriter*)arg;
+    StagingBlock block;
+    for (;;) {
+        if (xQueueReceive(self->fullBlocks, &block, portMAX_DELAY) == pdTRUE) {
+            self->store(block.index, block.length);
+            xQueueSend(self->freeBlocks, &block.index, portMAX_DELAY);
+        }
+    }
+}
+#endif
+
+bool StagingWriter::write(const uint8_t* data, uint32_t length) {
+    if (!isOpen) {
+        return false;
+    }
+    while (length) {
+        if (failed) {
+            lastError = "écriture LittleFS en erreur";
+            return false;
+        }
+        if (current < 0 && !acquire()) {
+            lastError = "LittleFS ne suit pas";
+            return false;
+        }
+        uint32_t n = STAGING_BLOCK_SIZE - fill;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(pool + current * STAGING_BLOCK_SIZE + fill, data, n);
+        hash.update(data, n);
+        crcState = crc32Update(crcState, data, n);
+        fill += n;
+        total += n;
+        data += n;
+        length -= n;
+        if (fill == STAGING_BLOCK_SIZE) {
+            submit();
+        }
+    }
+    return true;
+}
+
+void StagingWriter::progress(ImageDigest& digest) const {
+    hash.peek(digest.sha256);
+    digest.size = total;
+    digest.crc32 = ~crcState;
+}
+
+bool StagingWriter::finish() {
+    if (!isOpen) {
+        return false;
+    }
+    if (current >= 0) {
+        submit();
+    }
+    drain();
+    file.close();
+    isOpen = false;
+    elapsed = millis() - startTime;
+    if (failed) {
+        lastError = "écriture LittleFS en erreur";
+        LittleFS.remove(path);
+        return false;
+    }
+    hash.finish(result.sha256);
+    result.size = total;
+    result.crc32 = ~crcState;
+    if (!imageDigestSave(path.c_str(), result)) {
+        DEBUG(println("Staging writer: cannot save digest"));
+    }
+    DEBUG(printf("Staging writer: %lu bytes in %lu ms\n", (unsigned long)total, (unsigned long)elapsed));
+    return true;
+}
+
+void StagingWriter::abort() {
+    if (!isOpen) {
+        return;
+    }
+    if (current >= 0) {
+        fill = 0; // rendu sans être écrit
+        submit();
+    }
+    drain();
+    file.close();
+    isOpen = false;
+    LittleFS.remove(path);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "firmware_cache.h"
+
+// Écriture d'un téléversement sur LittleFS. Les fragments reçus (segments
+// TCP d'environ 1,4 Ko, de taille quelconque) sont regroupés dans des
+// tampons de STAGING_BLOCK_SIZE octets, la taille d'un bloc LittleFS: le
+// fichier ne reçoit que des blocs entiers et LittleFS n'a plus de bloc
+// partiel à relire puis réécrire. Sur l'ESP32 une tâche dédiée écrit les
+// tampons pleins, la tâche qui reçoit ne fait que copier et tenir à jour le
+// SHA-256 et le CRC; sur l'hôte l'écriture est immédiate.
+#define STAGING_BLOCK_SIZE 4096
+#ifndef STAGING_BUFFERS
+#ifdef BOARD_HAS_PSRAM
+#define STAGING_BUFFERS 16     // 64 Kio en PSRAM
+#else
+#define STAGING_BUFFERS 4
+#endif
+#endif
+#define STAGING_TASK_STACK 4096
+#define STAGING_TASK_PRIORITY 2
+#define STAGING_TASK_CORE 1
+// Attente maximale d'un tampon libre (LittleFS en retard) avant abandon
+#define STAGING_WAIT_MS 5000
+
+#ifdef ESP_PLATFORM
+// Tampon plein confié à la tâche d'écriture
+struct StagingBlock {
+    uint8_t index;
+    uint16_t length;
+};
+#endif
+
+class StagingWriter {
+    public:
+        // Ouvre path en écriture (contenu précédent perdu). expectedSize, la
+        // taille annoncée (Content-Length) ou 0, permet de refuser d'emblée
+        // ce qui ne tiendrait pas sur LittleFS, même en supprimant des images
+        // du cache (firmwareCacheReclaim()); path n'est alors pas touché.
+        bool begin(const char* path, uint32_t expectedSize);
+        bool write(const uint8_t* data, uint32_t length);
+        // Écrit le dernier tampon, attend la tâche, ferme le fichier et range
+        // son empreinte à côté (imageDigestSave()). false si une écriture a
+        // échoué: le fichier est alors supprimé.
+        bool finish();
+        // Téléversement interrompu: le fichier partiel est supprimé
+        void abort();
+        bool active() const { return isOpen; }
+        uint32_t size() const { return total; }
+        // Durée du téléversement, de begin() à finish()
+        uint32_t elapsedMs() const { return elapsed; }
+        const String& error() const { return lastError; }
+        // Empreinte du fichier, valide après finish()
+        const ImageDigest& digest() const { return result; }
+        // Empreinte des size() octets reçus jusqu'ici (reprise d'un
+        // téléversement interrompu)
+        void progress(ImageDigest& digest) const;
+
+    private:
+        bool allocate();
+        bool acquire();
+        void submit();
+        void drain();
+        void store(uint8_t index, uint32_t length);
+#ifdef ESP_PLATFORM
+        static void writerTask(void* arg);
+        QueueHandle_t freeBlocks = nullptr;    // index des tampons libres
+        QueueHandle_t fullBlocks = nullptr;    // StagingBlock à écrire, dans l'ordre
+        TaskHandle_t task = nullptr;
+#endif
+
+        uint8_t* pool = nullptr;               // STAGING_BUFFERS tampons contigus
+        int current = -1;                      // tampon en cours de remplissage
+        uint32_t fill = 0;
+        File file;
+        String path;
+        bool isOpen = false;
+        volatile bool failed = false;          // écriture LittleFS en erreur (tâche)
+        uint32_t total = 0;
+        uint32_t startTime = 0;
+        uint32_t elapsed = 0;
+        String lastError;
+        Sha256 hash;                           // des octets reçus, dans l'ordre
+        uint32_t crcState = 0;
+        ImageDigest result;
+};
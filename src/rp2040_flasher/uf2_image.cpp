@@ -0,0 +1,197 @@
+#include "uf2_image.h"
+#include "config.h"
+
+bool isUf2Image(ImageSource* source) {
+    uint32_t magic[2];
+    if (source->size() < UF2_BLOCK_SIZE || source->available(0) < sizeof(magic)) {
+        return false;
+    }
+    if (source->read(0, (uint8_t*)magic, sizeof(magic)) != sizeof(magic)) {
+        return false;
+    }
+    return magic[0] == UF2_MAGIC_START0 && magic[1] == UF2_MAGIC_START1;
+}
+
+bool Uf2ImageSource::open(ImageSource* source) {
+    inner = source;
+    lastError = "";
+    blocks = 0;
+    mainBlocks = 0;
+    lowAddr = 0;
+    highAddr = 0;
+    base = 0;
+    coveredSectors = 0;
+    cursorValid = false;
+    memset(sectorCovered, 0, sizeof(sectorCovered));
+
+    uint32_t total = source->size();
+    if (!total || total % UF2_BLOCK_SIZE) {
+        lastError = "taille qui n'est pas un multiple de 512 octets";
+        return false;
+    }
+    blocks = total / UF2_BLOCK_SIZE;
+    uint32_t previousEnd = 0;
+    for (uint32_t i = 0; i < blocks; ++i) {
+        Uf2BlockHeader h;
+        uint32_t magicEnd;
+        uint32_t offset = i * UF2_BLOCK_SIZE;
+        if (inner->read(offset, (uint8_t*)&h, sizeof(h)) != sizeof(h) ||
+            inner->read(offset + UF2_BLOCK_SIZE - sizeof(magicEnd), (uint8_t*)&magicEnd, sizeof(magicEnd)) != sizeof(magicEnd)) {
+            lastError = String("lecture du bloc ") + i + " impossible";
+            return false;
+        }
+        if (h.magicStart0 != UF2_MAGIC_START0 || h.magicStart1 != UF2_MAGIC_START1 || magicEnd != UF2_MAGIC_END) {
+            lastError = String("bloc ") + i + " invalide";
+            return false;
+        }
+        if (h.flags & UF2_FLAG_NOT_MAIN_FLASH) {
+            continue;
+        }
+        if ((h.flags & UF2_FLAG_FAMILY_ID) && h.familyId != UF2_FAMILY_RP2040) {
+            lastError = String("famille 0x") + String(h.familyId, HEX) + ", ce n'est pas une image RP2040";
+            return false;
+        }
+        if (!h.payloadSize || h.payloadSize > UF2_MAX_PAYLOAD ||
+            h.targetAddr < UF2_FLASH_BASE || h.targetAddr + h.payloadSize > UF2_FLASH_END) {
+            lastError = String("bloc ") + i + " hors de la flash (0x" + String(h.targetAddr, HEX) + ")";
+            return false;
+        }
+        // Lecture séquentielle: les blocs doivent être triés (elf2uf2, picotool)
+        if (h.targetAddr < previousEnd) {
+            lastError = String("blocs non triés ou qui se chevauchent (bloc ") + i + ")";
+            return false;
+        }
+        if (!mainBlocks) {
+            lowAddr = h.targetAddr;
+        }
+        previousEnd = highAddr = h.targetAddr + h.payloadSize;
+        for (uint32_t s = (h.targetAddr - UF2_FLASH_BASE) / UF2_SECTOR_SIZE;
+             s <= (highAddr - 1 - UF2_FLASH_BASE) / UF2_SECTOR_SIZE; ++s) {
+            if (!(sectorCovered[s >> 3] & (1 << (s & 7)))) {
+                sectorCovered[s >> 3] |= 1 << (s & 7);
+                coveredSectors++;
+            }
+        }
+        mainBlocks++;
+    }
+    if (!mainBlocks) {
+        lastError = "aucun bloc à destination de la flash";
+        return false;
+    }
+    DEBUG(printf("UF2: %lu blocks, 0x%08lX-0x%08lX, %lu sectors\n", (unsigned long)mainBlocks,
+                 (unsigned long)lowAddr, (unsigned long)highAddr, (unsigned long)coveredSectors));
+    return true;
+}
+
+bool Uf2ImageSource::placeAt(uint32_t flashStart) {
+    if (lowAddr < flashStart) {
+        lastError = String("image liée pour 0x") + String(lowAddr, HEX) +
+                    ", avant le début de la zone applicative 0x" + String(flashStart, HEX);
+        return false;
+    }
+    base = flashStart;
+    return true;
+}
+
+uint32_t Uf2ImageSource::size() {
+    return highAddr - (base ? base : lowAddr);
+}
+
+uint32_t Uf2ImageSource::available(uint32_t offset) {
+    uint32_t sz = size();
+    return offset < sz ? sz - offset : 0;
+}
+
+bool Uf2ImageSource::covers(uint32_t offset, uint32_t length) {
+    uint32_t start = (base ? base : lowAddr) + offset;
+    uint32_t end = start + length < highAddr ? start + length : highAddr;
+    if (!length || start >= end) {
+        return false;
+    }
+    for (uint32_t s = (start - UF2_FLASH_BASE) / UF2_SECTOR_SIZE; s <= (end - 1 - UF2_FLASH_BASE) / UF2_SECTOR_SIZE; ++s) {
+        if (sectorCovered[s >> 3] & (1 << (s & 7))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Uf2ImageSource::loadBlock(uint32_t index) {
+    cursorValid = inner->read(index * UF2_BLOCK_SIZE, (uint8_t*)&current, sizeof(current)) == sizeof(current);
+    cursor = index;
+    return cursorValid;
+}
+
+// Place le curseur sur le premier bloc flash qui se termine après address.
+// Renvoie 1 si trouvé, 0 s'il n'y en a plus, -1 en cas d'erreur de lecture.
+// Les déplacements sont relatifs au bloc courant: une lecture séquentielle
+// ne relit qu'un en-tête par bloc, et un recul (reprise) reste court.
+int Uf2ImageSource::seekAddress(uint32_t address) {
+    if (!cursorValid && !loadBlock(0)) {
+        return -1;
+    }
+    while (cursor > 0 && ((current.flags & UF2_FLAG_NOT_MAIN_FLASH) || current.targetAddr > address)) {
+        if (!loadBlock(cursor - 1)) {
+            return -1;
+        }
+    }
+    while ((current.flags & UF2_FLAG_NOT_MAIN_FLASH) || current.targetAddr + current.payloadSize <= address) {
+        if (cursor + 1 >= blocks) {
+            return 0;
+        }
+        if (!loadBlock(cursor + 1)) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+int Uf2ImageSource::read(uint32_t offset, uint8_t* buffer, uint32_t length) {
+    if (!inner) {
+        return -1;
+    }
+    uint32_t sz = size();
+    if (offset >= sz) {
+        return 0;
+    }
+    if (length > sz - offset) {
+        length = sz - offset;
+    }
+    // Ce qu'aucun bloc ne couvre reste à l'état effacé
+    memset(buffer, 0xFF, length);
+    uint32_t address = (base ? base : lowAddr) + offset;
+    uint32_t done = 0;
+    while (done < length) {
+        uint32_t a = address + done;
+        int found = seekAddress(a);
+        if (found < 0) {
+            return -1;
+        }
+        if (!found) {
+            break;
+        }
+        if (current.targetAddr > a) {
+            uint32_t gap = current.targetAddr - a;
+            done += gap < length - done ? gap : length - done;
+            continue;
+        }
+        uint32_t n = current.targetAddr + current.payloadSize - a;
+        if (n > length - done) {
+            n = length - done;
+        }
+        int r = inner->read(cursor * UF2_BLOCK_SIZE + UF2_HEADER_SIZE + (a - current.targetAddr), buffer + done, n);
+        if (r != (int)n) {
+            return -1;
+        }
+        done += n;
+    }
+    return length;
+}
+
+void Uf2ImageSource::close() {
+    if (inner) {
+        inner->close();
+    }
+    inner = nullptr;
+    cursorValid = false;
+}
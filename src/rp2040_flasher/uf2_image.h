@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Arduino.h>
+#include "image_source.h"
+
+// Format UF2: blocs de 512 octets, chacun avec son adresse cible
+#define UF2_MAGIC_START0 0x0A324655
+#define UF2_MAGIC_START1 0x9E5D5157
+#define UF2_MAGIC_END 0x0AB16F30
+#define UF2_FLAG_NOT_MAIN_FLASH 0x00000001
+#define UF2_FLAG_FAMILY_ID 0x00002000
+#define UF2_FAMILY_RP2040 0xE48BFF56
+#define UF2_BLOCK_SIZE 512
+#define UF2_HEADER_SIZE 32
+#define UF2_MAX_PAYLOAD 476
+
+// Zone XIP de la flash du RP2040
+#define UF2_FLASH_BASE 0x10000000
+#define UF2_FLASH_END 0x11000000
+
+// Couverture suivie par tranches de 4 KiB (secteur du RP2040)
+#define UF2_SECTOR_SIZE 4096
+#define UF2_MAX_SECTORS ((UF2_FLASH_END - UF2_FLASH_BASE) / UF2_SECTOR_SIZE)
+
+struct __attribute__((packed)) Uf2BlockHeader {
+    uint32_t magicStart0;
+    uint32_t magicStart1;
+    uint32_t flags;
+    uint32_t targetAddr;
+    uint32_t payloadSize;
+    uint32_t blockNo;
+    uint32_t numBlocks;
+    uint32_t familyId;
+};
+
+// Vrai si la source commence par un bloc UF2
+bool isUf2Image(ImageSource* source);
+
+// Présente un UF2 comme une image plate commençant au début de la zone
+// applicative: les octets non couverts par un bloc valent 0xFF et les
+// secteurs sans aucun bloc sont signalés par covers() pour que le flasheur
+// ne les efface ni ne les écrive. Les blocs sont lus un par un dans la
+// source; seule la couverture par secteur est gardée en RAM.
+class Uf2ImageSource : public ImageSource {
+    public:
+        // Parcourt les en-têtes et vérifie la famille, les adresses et l'ordre.
+        // En cas d'échec, error() décrit le problème.
+        bool open(ImageSource* source);
+        const String& error() const { return lastError; }
+        uint32_t blockCount() const { return mainBlocks; }
+        uint32_t sectorCount() const { return coveredSectors; }
+        uint32_t lowAddress() const { return lowAddr; }
+
+        // Cale l'offset 0 sur le début de la zone applicative annoncée par INFO
+        bool placeAt(uint32_t flashStart);
+        uint32_t size() override;
+        uint32_t available(uint32_t offset) override;
+        int read(uint32_t offset, uint8_t* buffer, uint32_t length) override;
+        bool covers(uint32_t offset, uint32_t length) override;
+        void close() override;
+
+    private:
+        bool loadBlock(uint32_t index);
+        int seekAddress(uint32_t address);
+
+        ImageSource* inner = nullptr;
+        String lastError;
+        uint32_t blocks = 0;          // blocs dans le fichier
+        uint32_t mainBlocks = 0;      // blocs à destination de la flash
+        uint32_t lowAddr = 0;
+        uint32_t highAddr = 0;        // fin du dernier bloc
+        uint32_t base = 0;            // adresse de l'offset 0
+        uint32_t coveredSectors = 0;
+        uint8_t sectorCovered[UF2_MAX_SECTORS / 8];
+
+        // Bloc courant de la lecture séquentielle
+        uint32_t cursor = 0;
+        bool cursorValid = false;
+        Uf2BlockHeader current;
+};
+
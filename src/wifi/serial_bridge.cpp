@@ -2,8 +2,6 @@
 #include "config.h"
 #include "rp2040_flasher/rp2040_flasher.h"
 
-extern FlasherState flasherState;
-
 #define UART_BUFFER_SIZE 256
 static WiFiServer tcpServer(4403);
 static WiFiClient client;
@@ -39,6 +37,7 @@ static volatile bool   console_rx_full = false;
 static uint32_t currentBaud = RP2040_SERIAL_BAUD;
 static volatile uint32_t pendingBaud  = 0;
 static volatile bool     pendingReset = false;
+static bool flasherOwnsUart = false;   // flash en cours vu par serialBridgeLoop()
 
 uint32_t serialConsoleBaud() { return currentBaud; }
 
@@ -50,7 +49,11 @@ bool serialConsoleRequestBaud(uint32_t baud) {
 
 static void applyBaud(uint32_t baud) {
   if (baud == currentBaud) return;
-  SerialRP2040.updateBaudRate(baud);
+  // Jamais pendant un flash: le flasheur possède alors l'UART et son débit
+  if (!rp2040Flasher.setIdleBaud(baud)) {
+    consoleWs.textAll("INFO:ERROR:flash en cours, baudrate inchangé");
+    return;
+  }
   currentBaud = baud;
   DEBUG(printf("[Console] baudrate: %lu\n", (unsigned long)baud));
   consoleWs.textAll(String("INFO:BAUD:") + currentBaud);
@@ -199,15 +202,25 @@ void serialBridgeBegin() {
 }
 
 void serialBridgeLoop() {
-  if (flasherState != IDLE) {
-    // Le flasheur exige le baudrate nominal et un accès exclusif à l'UART
+  if (rp2040Flasher.status().state != IDLE) {
+    // Le flasheur a l'accès exclusif à l'UART: il la remet au baudrate
+    // nominal en démarrant, le monte et le rétablit lui-même. On n'y touche
+    // pas, même pour le débit.
+    flasherOwnsUart = true;
     pendingBaud  = 0;
     pendingReset = false;
-    applyBaud(RP2040_SERIAL_BAUD);
     console_tx_len  = 0;
     console_rx_tail = console_rx_head;
     return; // Ne pas faire le pont série pendant le flashage
   }
+  if (flasherOwnsUart) {
+    // Flash terminé: l'UART est restée au nominal
+    flasherOwnsUart = false;
+    if (currentBaud != RP2040_SERIAL_BAUD) {
+      currentBaud = RP2040_SERIAL_BAUD;
+      consoleWs.textAll(String("INFO:BAUD:") + currentBaud);
+    }
+  }
 
   consoleWs.cleanupClients();
   if (pendingBaud)  { applyBaud(pendingBaud); pendingBaud = 0; }
@@ -2,9 +2,51 @@
 #include "config.h"
 #include "main.h"
 #include "rp2040_flasher/rp2040_flasher.h"
+#include "rp2040_flasher/flash_targets.h"
+#include "rp2040_flasher/flash_metrics.h"
+#include "rp2040_flasher/image_source.h"
+#include "rp2040_flasher/firmware_cache.h"
+#include "rp2040_flasher/staging_writer.h"
 #include "esp32_ota/ota_from_spiffs.h"
 #include "serial_bridge.h"
 
+// Image en cours de téléversement (POST / ou POST /upload): fragments
+// regroupés en blocs LittleFS, écrits par une tâche dédiée
+static StagingWriter stagedUpload;
+static uint32_t chunkedTotal = 0;     // taille annoncée par POST /upload
+
+// Fin d'un téléversement: fichier fermé, débit, rangement dans le cache
+static bool finishUpload() {
+    if (!stagedUpload.finish()) {
+        uploader->notifyClients("error:Écriture du fichier impossible: " + stagedUpload.error() + ".");
+        return false;
+    }
+    uint32_t elapsed = stagedUpload.elapsedMs();
+    uploader->notifyClients(String("log:Téléversement: ") + stagedUpload.size() + " octets en " + elapsed + " ms (" +
+                            String(elapsed ? stagedUpload.size() / 1000.0f / elapsed : 0.0f, 2) + " Mo/s)");
+    if (firmwareCacheStore("/firmware.bin")) {
+        uploader->notifyClients("EVENT:CACHED:" + firmwareCacheSelected());
+    }
+    // Empreinte calculée pendant la réception, comparée par le client
+    uploader->notifyClients("EVENT:UPLOAD_COMPLETE:" + imageDigestEvent(stagedUpload.digest()));
+    uploader->notifyClients("log:Fichier reçu. Prêt à préparer le flash.");
+    resetInactivityTimer();
+    return true;
+}
+
+// État du téléversement par morceaux: octets reçus et leur empreinte, pour
+// reprendre après une coupure
+static String uploadStatusJson() {
+    ImageDigest digest;
+    stagedUpload.progress(digest);
+    bool active = stagedUpload.active();
+    return String("{\"active\":") + (active ? "true" : "false") +
+           ",\"committed\":" + (active ? digest.size : 0) +
+           ",\"total\":" + (active ? chunkedTotal : 0) +
+           ",\"sha256\":\"" + (active ? sha256Hex(digest.sha256) : String()) +
+           "\",\"crc32\":\"" + (active ? String(digest.crc32, HEX) : String()) + "\"}";
+}
+
 WifiUpload::WifiUpload() {
     server = new AsyncWebServer(80);
     ws = new AsyncWebSocket("/ws");
@@ -45,6 +87,62 @@ void WifiUpload::Setup() {
         request->send(200);
     }, handleUpload);
 
+    // Téléversement par morceaux, repris après une coupure: POST /upload avec
+    // Content-Range: bytes <début>-<fin>/<total> (ou ?offset=N&total=T) et le
+    // morceau brut. GET /upload donne la longueur reçue et son empreinte.
+    server->on("/upload", HTTP_GET, [](AsyncWebServerRequest *request){
+        request->send(200, "application/json", uploadStatusJson());
+    });
+    server->on("/upload", HTTP_POST, [](AsyncWebServerRequest *request){
+        int* status = (int*)request->_tempObject;
+        if (!status) {
+            request->send(400, "text/plain", "corps vide");
+        } else if (*status == 409) {
+            request->send(409, "text/plain", String(stagedUpload.size()));
+        } else if (*status == 410) {
+            request->send(410, "text/plain", "0");
+        } else {
+            request->send(*status, "application/json", uploadStatusJson());
+        }
+    }, nullptr, handleChunkBody);
+
+    // Flash en flux: morceaux bruts POST /stream?offset=N, état en GET
+    server->on("/stream", HTTP_GET, [](AsyncWebServerRequest *request){
+        request->send(200, "application/json",
+                      String("{\"active\":") + (streamImage.active() ? "true" : "false") +
+                      ",\"offset\":" + streamImage.expectedOffset() +
+                      ",\"total\":" + streamImage.size() +
+                      ",\"free\":" + streamImage.freeSpace() + "}");
+    });
+    server->on("/stream", HTTP_POST, [](AsyncWebServerRequest *request){
+        int* status = (int*)request->_tempObject;
+        if (!status) {
+            request->send(400, "text/plain", "corps vide");
+        } else if (*status == 409) {
+            request->send(409, "text/plain", String(streamImage.expectedOffset()));
+        } else {
+            request->send(*status);
+        }
+    }, nullptr, handleStreamBody);
+
+    // Mesures des derniers flashs (durée et octets par phase, RTT, reprises)
+    server->on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request){
+        request->send(200, "text/plain; version=0.0.4", flashMetricsPrometheus());
+    });
+    server->on("/metrics.json", HTTP_GET, [](AsyncWebServerRequest *request){
+        request->send(200, "application/json", flashMetricsJson());
+    });
+
+    // Cache d'images: contenu, et sélection d'une image par son SHA-256
+    // (POST /cache?sha256=..., 404 si elle n'y est pas: il faut la téléverser)
+    server->on("/cache", HTTP_GET, [](AsyncWebServerRequest *request){
+        request->send(200, "application/json", firmwareCacheJson());
+    });
+    server->on("/cache", HTTP_POST, [](AsyncWebServerRequest *request){
+        const char* hash = request->hasParam("sha256") ? request->getParam("sha256")->value().c_str() : nullptr;
+        request->send(hash && firmwareCacheSelect(hash) ? 200 : 404);
+    });
+
     server->begin();
     serialBridgeBegin();
 }
@@ -55,6 +153,9 @@ int onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType
         DEBUG(printf("WebSocket client #%u connected\n", client->id()));
 
         client->text("EVENT:MODE_UPLOADER");
+        if (flashTargetCount > 1) {
+            client->text(flashTargetsEvent());
+        }
 
     } else if (type == WS_EVT_DISCONNECT) {
         DEBUG(printf("WebSocket client #%u disconnected\n", client->id()));
@@ -85,40 +186,77 @@ int onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType
                 DEBUG(println("PREPARE_FLASH command received. Toggling pins to enter RP2040 bootloader."));
                 uploader->notifyClients("log:Commande reçue. Préparation au mode bootloader du RP2040...");
                 
-                // Mettre la broche BOOTLOADER_PIN à LOW pour activer le mode bootloader
-                digitalWrite(BOOTLOADER_PIN, LOW);
-                delay(10);
-                
-                // Activer le RESET du RP2040
-                digitalWrite(RESETRP2040_PIN, LOW);
-                delay(100);
-                digitalWrite(RESETRP2040_PIN, HIGH);
-                delay(100);
+                // Broche de boot à LOW puis RESET, sur chaque cible sélectionnée,
+                // et démarrage de la synchronisation
+                prepareFlashTargets();
                 uploader->notifyClients("log:En attente de la réponse du RP2040...");
-                startFlashProcess(); // Appel de la nouvelle fonction pour démarrer la machine à états
 
                 uploader->notifyClients("EVENT:RP2040_BOOTLOADER_MODE");
             }
 
-            if (strcmp((char*)data, "CMD:START_FLASH") == 0) {
+            bool diff = strcmp((char*)data, "CMD:START_FLASH_DIFF") == 0;
+            if (diff || strcmp((char*)data, "CMD:START_FLASH") == 0) {
                  if (rp2040BootloaderActive) {
-                    // Relâcher la broche BOOTLOADER_PIN
-                    digitalWrite(BOOTLOADER_PIN, HIGH);
-                    uploader->notifyClients("log:Démarrage du processus de flashage...");
-                    startFlashProcess(SEND_INFO_COMMAND); // Appel de la nouvelle fonction pour démarrer la machine à états
+                    uploader->notifyClients(diff ? "log:Démarrage du flashage différentiel..."
+                                                 : "log:Démarrage du processus de flashage...");
+                    // Relâche la broche de boot et lance le flash sur les cibles synchronisées
+                    startFlashTargets(diff);
                  } else {
                     uploader->notifyClients("error:Le RP2040 n'est pas en mode bootloader.");
                  }
             }
 
+            // CMD:TARGETS:<masque> - cibles RP2040 à flasher (bit 0 = première)
+            if (strncmp((char*)data, "CMD:TARGETS:", 12) == 0) {
+                // 0 = simple consultation
+                uint32_t mask = strtoul((char*)data + 12, nullptr, 10);
+                if (mask && !selectFlashTargets(mask)) {
+                    uploader->notifyClients("error:Sélection de cibles refusée.");
+                }
+                uploader->notifyClients(flashTargetsEvent());
+                return 0;
+            }
+
+            // CMD:STREAM_FLASH:<taille>[:KEEP] - flash pendant le téléversement
+            if (strncmp((char*)data, "CMD:STREAM_FLASH:", 17) == 0) {
+                if (!rp2040BootloaderActive) {
+                    uploader->notifyClients("error:Le RP2040 n'est pas en mode bootloader.");
+                    return 0;
+                }
+                char* end = nullptr;
+                uint32_t total = strtoul((char*)data + 17, &end, 10);
+                bool keep = end && strcmp(end, ":KEEP") == 0;
+                if (!startStreamFlash(total, keep)) {
+                    uploader->notifyClients("error:Impossible de démarrer le flash en flux.");
+                } else {
+                    uploader->notifyClients(String("log:Flash en flux de ") + total + " octets...");
+                    uploader->notifyClients("EVENT:STREAM_READY");
+                }
+                return 0;
+            }
+
+            // CMD:CACHE:<sha256> - image déjà en cache? Si oui elle est
+            // sélectionnée et le téléversement peut être sauté
+            if (strncmp((char*)data, "CMD:CACHE:", 10) == 0) {
+                const char* hash = (char*)data + 10;
+                if (firmwareCacheSelect(hash)) {
+                    uploader->notifyClients(String("EVENT:CACHE_HIT:") + hash);
+                } else {
+                    uploader->notifyClients(String("EVENT:CACHE_MISS:") + hash);
+                }
+                return 0;
+            }
+
             if (strcmp((char*)data, "CMD:APPLY_OTA") == 0) {
                 auto cb = [](int pct, const char* msg){
                     if (msg && *msg) uploader->notifyClients(String("log:") + msg);
                     else             uploader->notifyClients(String("log:OTA en cours: ") + pct + "%");
                 };
 
+                // Image protégée de l'éviction jusqu'à la fin de la tâche
+                String image = firmwareImageAcquire();
                 BaseType_t ok = ota_start_task(
-                    "/firmware.bin",
+                    image.c_str(),
                     cb,                         // ← virgule ici
                     false,                      // delete_after_success
                     "wifi_ota_task",
@@ -136,27 +274,112 @@ int onWsEvent(AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType
 }
 
 void WifiUpload::handleUpload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
-    static File binFile;
     if (!index) {
         resetInactivityTimer();
         uploader->notifyClients("log:Début du téléversement...");
-        binFile = LittleFS.open("/firmware.bin", "w");
-        if (!binFile) {
-            uploader->notifyClients("error:Impossible d'ouvrir le fichier sur l'ESP32.");
+        chunkedTotal = 0;
+        // Content-Length couvre aussi l'enveloppe multipart: c'est un majorant
+        if (!stagedUpload.begin("/firmware.bin", request->contentLength())) {
+            uploader->notifyClients("error:Impossible d'ouvrir le fichier sur l'ESP32: " + stagedUpload.error() + ".");
             return;
         }
     }
-    if (len) {
-        binFile.write(data, len);
+    if (!stagedUpload.active()) {
+        return;
+    }
+    if (len && !stagedUpload.write(data, len)) {
+        uploader->notifyClients("error:Écriture du fichier impossible: " + stagedUpload.error() + ".");
+        stagedUpload.abort();
+        return;
     }
     if (final) {
-        binFile.close();
-        uploader->notifyClients("EVENT:UPLOAD_COMPLETE");
-        uploader->notifyClients("log:Fichier reçu. Prêt à préparer le flash.");
+        finishUpload();
+    }
+
+}
+
+// Corps d'un POST /upload. Un morceau commençant à 0 démarre un nouveau
+// téléversement; les suivants doivent commencer là où le précédent s'est
+// arrêté, même s'il a été coupé en route (409 sinon, avec la longueur
+// reçue). Sans téléversement en cours de la même taille, rien à reprendre:
+// 410, le client doit recommencer à 0. Le dernier octet reçu termine le
+// téléversement.
+void WifiUpload::handleChunkBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    if (!index) {
+        int* status = (int*)malloc(sizeof(int)); // libéré par AsyncWebServerRequest
+        if (!status) {
+            return;
+        }
+        request->_tempObject = status;
         resetInactivityTimer();
+        unsigned long first = 0, last = 0, imageTotal = 0;
+        if (request->hasHeader("Content-Range")) {
+            if (sscanf(request->header("Content-Range").c_str(), "bytes %lu-%lu/%lu", &first, &last, &imageTotal) != 3 ||
+                last + 1 - first != total) {
+                *status = 400;
+                return;
+            }
+        } else if (request->hasParam("offset") && request->hasParam("total")) {
+            first = request->getParam("offset")->value().toInt();
+            imageTotal = request->getParam("total")->value().toInt();
+        } else {
+            *status = 400;
+            return;
+        }
+        if (!imageTotal || first + total > imageTotal) {
+            *status = 416;
+        } else if (!first) {
+            uploader->notifyClients(String("log:Début du téléversement par morceaux (") + imageTotal + " octets)...");
+            chunkedTotal = imageTotal;
+            if (!stagedUpload.begin("/firmware.bin", imageTotal)) {
+                uploader->notifyClients("error:Impossible d'ouvrir le fichier sur l'ESP32: " + stagedUpload.error() + ".");
+                *status = 507;
+                return;
+            }
+            *status = 200;
+        } else if (!stagedUpload.active() || imageTotal != chunkedTotal) {
+            *status = 410;
+        } else if (first != stagedUpload.size()) {
+            *status = 409;
+        } else {
+            *status = 200;
+        }
+    }
+    int* status = (int*)request->_tempObject;
+    if (!status || *status != 200) {
+        return;
+    }
+    if (!stagedUpload.write(data, len)) {
+        uploader->notifyClients("error:Écriture du fichier impossible: " + stagedUpload.error() + ".");
+        stagedUpload.abort();
+        *status = 500;
+        return;
+    }
+    if (stagedUpload.size() == chunkedTotal && !finishUpload()) {
+        *status = 500;
     }
+}
 
+// Corps d'un POST /stream. La place est réservée dans l'anneau dès le premier
+// fragment; s'il n'y en a pas assez, tout le morceau est refusé (503) et le
+// client le renverra.
+void WifiUpload::handleStreamBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+    if (!index) {
+        int* status = (int*)malloc(sizeof(int)); // libéré par AsyncWebServerRequest
+        if (!status) {
+            return;
+        }
+        uint32_t offset = request->hasParam("offset") ? request->getParam("offset")->value().toInt() : 0;
+        *status = streamImage.acceptChunk(offset, total);
+        request->_tempObject = status;
+        resetInactivityTimer();
+    }
+    int* status = (int*)request->_tempObject;
+    if (status && *status == 200) {
+        streamImage.write(data, len);
+    }
 }
+
 void WifiUpload::loop() {
     ws->cleanupClients();
     serialBridgeLoop();
@@ -16,6 +16,8 @@ class WifiUpload : public Uploader {
     void notifyClients(const String &message);  
     void loop();
     static void handleUpload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final);
+    static void handleStreamBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+    static void handleChunkBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
     
     private:    
     AsyncWebServer *server;
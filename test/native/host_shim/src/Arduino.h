@@ -0,0 +1,157 @@
+#pragma once
+// Sous-ensemble de l'API Arduino-ESP32 utilisé par le flasheur, pour les
+// tests sur l'hôte (env native). Le temps est virtuel: millis()/micros()
+// ne bougent que par delay(), hostClockAdvance() ou une écriture série qui
+// attend de la place dans le tampon d'émission.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <functional>
+#include <type_traits>
+
+#define HEX 16
+#define DEC 10
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define SERIAL_8N1 0x800001c
+#define TX 1
+#define RX 3
+
+typedef enum {
+    GPIO_NUM_0 = 0, GPIO_NUM_1, GPIO_NUM_2, GPIO_NUM_3, GPIO_NUM_4, GPIO_NUM_5,
+    GPIO_NUM_6, GPIO_NUM_7, GPIO_NUM_8, GPIO_NUM_9, GPIO_NUM_10
+} gpio_num_t;
+
+// Horloge virtuelle en microsecondes
+extern uint64_t hostClockUs;
+inline void hostClockAdvance(uint64_t us) { hostClockUs += us; }
+inline uint32_t millis() { return (uint32_t)(hostClockUs / 1000); }
+inline uint32_t micros() { return (uint32_t)hostClockUs; }
+inline void delay(uint32_t ms) { hostClockAdvance((uint64_t)ms * 1000); }
+inline void delayMicroseconds(uint32_t us) { hostClockAdvance(us); }
+inline void yield() {}
+
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+inline int digitalRead(int) { return LOW; }
+
+class String {
+    public:
+        String() {}
+        String(const char* c) : s(c ? c : "") {}
+        String(const std::string& x) : s(x) {}
+        String(char c) : s(1, c) {}
+        template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+        String(T v, int base = DEC) {
+            char b[40];
+            if (base == HEX) {
+                snprintf(b, sizeof(b), "%llx", (unsigned long long)v);
+            } else if (std::is_floating_point<T>::value) {
+                snprintf(b, sizeof(b), "%.2f", (double)v);
+            } else if (std::is_signed<T>::value) {
+                snprintf(b, sizeof(b), "%lld", (long long)v);
+            } else {
+                snprintf(b, sizeof(b), "%llu", (unsigned long long)v);
+            }
+            s = b;
+        }
+        const char* c_str() const { return s.c_str(); }
+        unsigned int length() const { return s.size(); }
+        bool startsWith(const String& p) const { return s.rfind(p.s, 0) == 0; }
+        int indexOf(const String& p) const { size_t i = s.find(p.s); return i == std::string::npos ? -1 : (int)i; }
+        long toInt() const { return strtol(s.c_str(), nullptr, 10); }
+        String substring(unsigned int from, unsigned int to = (unsigned int)-1) const {
+            return from < s.size() ? String(s.substr(from, to > from ? to - from : 0)) : String();
+        }
+        bool reserve(unsigned int n) { s.reserve(n); return true; }
+        String& operator+=(const String& o) { s += o.s; return *this; }
+        bool operator==(const String& o) const { return s == o.s; }
+        bool operator!=(const String& o) const { return s != o.s; }
+        std::string s;
+};
+inline String operator+(const String& a, const String& b) { return String(a.s + b.s); }
+inline String operator+(const String& a, const char* b) { return String(a.s + b); }
+inline String operator+(const char* a, const String& b) { return String(a + b.s); }
+template <typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+inline String operator+(const String& a, T v) { return a + String(v); }
+
+class Stream {
+    public:
+        virtual ~Stream() {}
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+        virtual size_t write(const uint8_t* data, size_t length) = 0;
+        virtual void flush() {}
+        size_t write(uint8_t b) { return write(&b, 1); }
+        size_t readBytes(uint8_t* data, size_t length) {
+            size_t n = 0;
+            while (n < length && available() > 0) {
+                data[n++] = (uint8_t)read();
+            }
+            return n;
+        }
+        int printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+        size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+        size_t println(const String& s = String()) { return print(s + "\n"); }
+};
+
+// Autre extrémité d'un port série: le simulateur de bootloader en test
+class SerialPeer {
+    public:
+        virtual ~SerialPeer() {}
+        virtual void hostWrite(const uint8_t* data, size_t length) = 0;
+        virtual int hostAvailable() = 0;
+        virtual int hostRead() = 0;
+        virtual int hostPeek() = 0;
+        virtual void hostFlush() {}
+        virtual void hostBaud(uint32_t baud) {}
+};
+
+class HardwareSerial : public Stream {
+    public:
+        void attach(SerialPeer* p) { peer = p; }
+        void begin(uint32_t baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1) { updateBaudRate(baud); }
+        void end() {}
+        void updateBaudRate(uint32_t baud) {
+            baudRate = baud;
+            if (peer) {
+                peer->hostBaud(baud);
+            }
+        }
+        uint32_t baudRate = 0;
+        size_t setTxBufferSize(size_t size) { return size; }
+        size_t setRxBufferSize(size_t size) { return size; }
+        bool setRxTimeout(uint8_t symbols) { return true; }
+        void onReceive(std::function<void(void)> callback, bool onlyOnTimeout = false) { receiveCallback = callback; }
+
+        int available() override { return peer ? peer->hostAvailable() : 0; }
+        int read() override { return peer ? peer->hostRead() : -1; }
+        int peek() override { return peer ? peer->hostPeek() : -1; }
+        size_t write(const uint8_t* data, size_t length) override {
+            if (peer) {
+                peer->hostWrite(data, length);
+            } else if (this == console()) {
+                fwrite(data, 1, length, stdout);
+            }
+            return length;
+        }
+        using Stream::write;
+        void flush() override {
+            if (peer) {
+                peer->hostFlush();
+            }
+        }
+
+    private:
+        static HardwareSerial* console();
+        SerialPeer* peer = nullptr;
+        std::function<void(void)> receiveCallback;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
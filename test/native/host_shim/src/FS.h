@@ -0,0 +1,112 @@
+#pragma once
+// Système de fichiers en mémoire, même interface que fs::FS/fs::File
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace fs {
+
+struct FileData {
+    std::vector<uint8_t> bytes;
+};
+
+class File {
+    public:
+        File() {}
+        File(std::shared_ptr<FileData> d, size_t p) : data(d), pos(p) {}
+        explicit operator bool() const { return (bool)data; }
+        size_t size() const { return data ? data->bytes.size() : 0; }
+        size_t position() const { return pos; }
+        bool seek(uint32_t p) {
+            if (!data || p > size()) {
+                return false;
+            }
+            pos = p;
+            return true;
+        }
+        int available() { return (int)(size() - pos); }
+        int read(uint8_t* buffer, size_t length) {
+            if (!data || pos >= size()) {
+                return 0;
+            }
+            size_t n = length < size() - pos ? length : size() - pos;
+            memcpy(buffer, data->bytes.data() + pos, n);
+            pos += n;
+            return (int)n;
+        }
+        size_t write(const uint8_t* buffer, size_t length) {
+            if (!data || !length) {
+                return 0;
+            }
+            if (data->bytes.size() < pos + length) {
+                data->bytes.resize(pos + length);
+            }
+            memcpy(data->bytes.data() + pos, buffer, length);
+            pos += length;
+            return length;
+        }
+        void flush() {}
+        void close() {
+            data.reset();
+            pos = 0;
+        }
+
+    private:
+        std::shared_ptr<FileData> data;
+        size_t pos = 0;
+};
+
+class FS {
+    public:
+        bool begin(bool formatOnFail = false) { return true; }
+        bool exists(const char* path) { return files.count(path) > 0; }
+        bool exists(const String& path) { return exists(path.c_str()); }
+        bool remove(const char* path) { return files.erase(path) > 0; }
+        bool remove(const String& path) { return remove(path.c_str()); }
+        bool mkdir(const char* path) { return true; }
+        bool rename(const char* from, const char* to) {
+            auto it = files.find(from);
+            if (it == files.end()) {
+                return false;
+            }
+            files[to] = it->second;
+            files.erase(it);
+            return true;
+        }
+        File open(const char* path, const char* mode = "r", bool create = false) {
+            std::string m(mode);
+            if (m == "w") {
+                files[path] = std::make_shared<FileData>();
+            } else if ((m == "a" || m == "r+" || create) && !files.count(path)) {
+                files[path] = std::make_shared<FileData>();
+            }
+            auto it = files.find(path);
+            if (it == files.end()) {
+                return File();
+            }
+            return File(it->second, m == "a" ? it->second->bytes.size() : 0);
+        }
+        File open(const String& path, const char* mode = "r", bool create = false) { return open(path.c_str(), mode, create); }
+        size_t totalBytes() { return 1536 * 1024; }
+        size_t usedBytes() {
+            size_t n = 0;
+            for (auto& f : files) {
+                n += f.second->bytes.size();
+            }
+            return n;
+        }
+        // Accès direct pour les tests
+        std::vector<uint8_t>* contents(const char* path) {
+            auto it = files.find(path);
+            return it == files.end() ? nullptr : &it->second->bytes;
+        }
+
+    private:
+        std::map<std::string, std::shared_ptr<FileData>> files;
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
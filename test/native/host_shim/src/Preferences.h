@@ -0,0 +1,43 @@
+#pragma once
+// Preferences (NVS) en mémoire: les valeurs survivent aux instances, comme
+// sur l'ESP32 elles survivent aux redémarrages.
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class Preferences {
+    public:
+        bool begin(const char* name, bool readOnly = false) {
+            space = name;
+            return true;
+        }
+        void end() {}
+        size_t putBytes(const char* key, const void* value, size_t len) {
+            const uint8_t* p = (const uint8_t*)value;
+            store()[space + "/" + key].assign(p, p + len);
+            return len;
+        }
+        size_t getBytesLength(const char* key) {
+            auto it = store().find(space + "/" + key);
+            return it == store().end() ? 0 : it->second.size();
+        }
+        size_t getBytes(const char* key, void* buf, size_t maxLen) {
+            auto it = store().find(space + "/" + key);
+            if (it == store().end() || it->second.size() > maxLen) {
+                return 0;
+            }
+            memcpy(buf, it->second.data(), it->second.size());
+            return it->second.size();
+        }
+        bool remove(const char* key) {
+            return store().erase(space + "/" + key) > 0;
+        }
+
+    private:
+        static std::map<std::string, std::vector<uint8_t>>& store() {
+            static std::map<std::string, std::vector<uint8_t>> values;
+            return values;
+        }
+        std::string space;
+};
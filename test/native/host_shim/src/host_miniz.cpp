@@ -0,0 +1,383 @@
+#include "rom/miniz.h"
+#include <string.h>
+#include <map>
+#include <vector>
+
+namespace {
+
+enum InflateResult {
+    INFLATE_DONE,
+    INFLATE_NEEDS_INPUT,
+    INFLATE_ERROR,
+    INFLATE_BAD_ADLER
+};
+
+// Bits lus du poids faible au poids fort; eof dès qu'il en manque
+struct BitReader {
+    const uint8_t* data;
+    size_t size;
+    size_t pos = 0;
+    uint32_t buffer = 0;
+    int count = 0;
+    bool eof = false;
+
+    BitReader(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+    int bits(int need) {
+        while (count < need) {
+            if (pos == size) {
+                eof = true;
+                return -1;
+            }
+            buffer |= (uint32_t)data[pos++] << count;
+            count += 8;
+        }
+        int value = buffer & ((1u << need) - 1);
+        buffer >>= need;
+        count -= need;
+        return value;
+    }
+
+    void alignToByte() {
+        buffer = 0;
+        count = 0;
+    }
+};
+
+// Code de Huffman canonique, décodé bit à bit (comme puff.c de zlib)
+struct Huffman {
+    short count[16];
+    short symbol[288];
+};
+
+// 0 si le code est complet, > 0 s'il est incomplet, < 0 s'il est sursouscrit
+int buildHuffman(Huffman& h, const short* length, int n) {
+    memset(h.count, 0, sizeof(h.count));
+    for (int i = 0; i < n; ++i) {
+        h.count[length[i]]++;
+    }
+    if (h.count[0] == n) {
+        return 0;
+    }
+    int left = 1;
+    for (int len = 1; len < 16; ++len) {
+        left <<= 1;
+        left -= h.count[len];
+        if (left < 0) {
+            return left;
+        }
+    }
+    short offsets[16];
+    offsets[1] = 0;
+    for (int len = 1; len < 15; ++len) {
+        offsets[len + 1] = offsets[len] + h.count[len];
+    }
+    for (int i = 0; i < n; ++i) {
+        if (length[i]) {
+            h.symbol[offsets[length[i]]++] = i;
+        }
+    }
+    return left;
+}
+
+// Symbole, -1 s'il manque des bits, -2 pour un code invalide
+int decodeSymbol(BitReader& in, const Huffman& h) {
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len = 1; len < 16; ++len) {
+        int bit = in.bits(1);
+        if (bit < 0) {
+            return -1;
+        }
+        code |= bit;
+        int count = h.count[len];
+        if (code - count < first) {
+            return h.symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -2;
+}
+
+const short LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const short LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const short DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                              257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const short DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                               7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+InflateResult inflateCodes(BitReader& in, std::vector<uint8_t>& out, const Huffman& lengths, const Huffman& distances) {
+    for (;;) {
+        int symbol = decodeSymbol(in, lengths);
+        if (symbol == -1) {
+            return INFLATE_NEEDS_INPUT;
+        }
+        if (symbol < 0) {
+            return INFLATE_ERROR;
+        }
+        if (symbol < 256) {
+            out.push_back(symbol);
+            continue;
+        }
+        if (symbol == 256) {
+            return INFLATE_DONE;
+        }
+        symbol -= 257;
+        if (symbol >= 29) {
+            return INFLATE_ERROR;
+        }
+        int extra = in.bits(LENGTH_EXTRA[symbol]);
+        if (extra < 0) {
+            return INFLATE_NEEDS_INPUT;
+        }
+        int length = LENGTH_BASE[symbol] + extra;
+        symbol = decodeSymbol(in, distances);
+        if (symbol == -1) {
+            return INFLATE_NEEDS_INPUT;
+        }
+        if (symbol < 0 || symbol >= 30) {
+            return INFLATE_ERROR;
+        }
+        extra = in.bits(DIST_EXTRA[symbol]);
+        if (extra < 0) {
+            return INFLATE_NEEDS_INPUT;
+        }
+        size_t distance = DIST_BASE[symbol] + extra;
+        if (distance > out.size()) {
+            return INFLATE_ERROR;
+        }
+        while (length--) {
+            out.push_back(out[out.size() - distance]);
+        }
+    }
+}
+
+InflateResult inflateFixed(BitReader& in, std::vector<uint8_t>& out) {
+    static Huffman lengths;
+    static Huffman distances;
+    static bool built = false;
+    if (!built) {
+        short length[288];
+        int i = 0;
+        for (; i < 144; ++i) length[i] = 8;
+        for (; i < 256; ++i) length[i] = 9;
+        for (; i < 280; ++i) length[i] = 7;
+        for (; i < 288; ++i) length[i] = 8;
+        buildHuffman(lengths, length, 288);
+        for (i = 0; i < 30; ++i) length[i] = 5;
+        buildHuffman(distances, length, 30);
+        built = true;
+    }
+    return inflateCodes(in, out, lengths, distances);
+}
+
+InflateResult inflateDynamic(BitReader& in, std::vector<uint8_t>& out) {
+    static const uint8_t ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    int nlen = in.bits(5);
+    int ndist = in.bits(5);
+    int ncode = in.bits(4);
+    if (in.eof) {
+        return INFLATE_NEEDS_INPUT;
+    }
+    nlen += 257;
+    ndist += 1;
+    ncode += 4;
+    if (nlen > 286 || ndist > 30) {
+        return INFLATE_ERROR;
+    }
+    short length[320] = {};
+    for (int i = 0; i < ncode; ++i) {
+        int l = in.bits(3);
+        if (l < 0) {
+            return INFLATE_NEEDS_INPUT;
+        }
+        length[ORDER[i]] = l;
+    }
+    Huffman lengths;
+    Huffman distances;
+    if (buildHuffman(lengths, length, 19) != 0) {
+        return INFLATE_ERROR;
+    }
+    int index = 0;
+    while (index < nlen + ndist) {
+        int symbol = decodeSymbol(in, lengths);
+        if (symbol == -1) {
+            return INFLATE_NEEDS_INPUT;
+        }
+        if (symbol < 0) {
+            return INFLATE_ERROR;
+        }
+        if (symbol < 16) {
+            length[index++] = symbol;
+            continue;
+        }
+        short repeated = 0;
+        int copies;
+        if (symbol == 16) {
+            if (index == 0) {
+                return INFLATE_ERROR;
+            }
+            repeated = length[index - 1];
+            copies = 3 + in.bits(2);
+        } else if (symbol == 17) {
+            copies = 3 + in.bits(3);
+        } else {
+            copies = 11 + in.bits(7);
+        }
+        if (in.eof) {
+            return INFLATE_NEEDS_INPUT;
+        }
+        if (index + copies > nlen + ndist) {
+            return INFLATE_ERROR;
+        }
+        while (copies--) {
+            length[index++] = repeated;
+        }
+    }
+    if (length[256] == 0) {
+        return INFLATE_ERROR;
+    }
+    int left = buildHuffman(lengths, length, nlen);
+    if (left < 0 || (left > 0 && nlen - lengths.count[0] != 1)) {
+        return INFLATE_ERROR;
+    }
+    left = buildHuffman(distances, length + nlen, ndist);
+    if (left < 0 || (left > 0 && ndist - distances.count[0] != 1)) {
+        return INFLATE_ERROR;
+    }
+    return inflateCodes(in, out, lengths, distances);
+}
+
+InflateResult inflateStored(BitReader& in, std::vector<uint8_t>& out) {
+    in.alignToByte();
+    if (in.size - in.pos < 4) {
+        return INFLATE_NEEDS_INPUT;
+    }
+    const uint8_t* p = in.data + in.pos;
+    uint16_t length = p[0] | p[1] << 8;
+    uint16_t check = p[2] | p[3] << 8;
+    if ((uint16_t)~check != length) {
+        return INFLATE_ERROR;
+    }
+    if (in.size - in.pos - 4 < length) {
+        return INFLATE_NEEDS_INPUT;
+    }
+    out.insert(out.end(), p + 4, p + 4 + length);
+    in.pos += 4 + length;
+    return INFLATE_DONE;
+}
+
+uint32_t adler32(const std::vector<uint8_t>& data) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (uint8_t byte : data) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    return b << 16 | a;
+}
+
+// Décode tout ce qui a été reçu; out contient la sortie, même partielle
+InflateResult inflateAll(const std::vector<uint8_t>& input, bool zlib, std::vector<uint8_t>& out) {
+    out.clear();
+    BitReader in(input.data(), input.size());
+    if (zlib) {
+        if (input.size() < 2) {
+            return INFLATE_NEEDS_INPUT;
+        }
+        if ((input[0] & 0x0F) != 8 || (input[0] << 8 | input[1]) % 31 || (input[1] & 0x20)) {
+            return INFLATE_ERROR;
+        }
+        in.pos = 2;
+    }
+    int last;
+    do {
+        last = in.bits(1);
+        int type = in.bits(2);
+        if (in.eof) {
+            return INFLATE_NEEDS_INPUT;
+        }
+        InflateResult result;
+        switch (type) {
+            case 0: result = inflateStored(in, out); break;
+            case 1: result = inflateFixed(in, out); break;
+            case 2: result = inflateDynamic(in, out); break;
+            default: return INFLATE_ERROR;
+        }
+        if (result != INFLATE_DONE) {
+            return result;
+        }
+    } while (!last);
+    if (zlib) {
+        in.alignToByte();
+        if (in.size - in.pos < 4) {
+            return INFLATE_NEEDS_INPUT;
+        }
+        const uint8_t* p = in.data + in.pos;
+        uint32_t expected = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+        if (expected != adler32(out)) {
+            return INFLATE_BAD_ADLER;
+        }
+    }
+    return INFLATE_DONE;
+}
+
+struct HostInflate {
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> output;
+    size_t delivered = 0;
+    bool decoded = false;
+    InflateResult result = INFLATE_NEEDS_INPUT;
+};
+
+std::map<const tinfl_decompressor*, HostInflate> decompressors;
+
+}
+
+void tinfl_init(tinfl_decompressor* r) {
+    decompressors[r] = HostInflate();
+}
+
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const mz_uint8* pIn_buf_next, size_t* pIn_buf_size,
+                              mz_uint8* pOut_buf_start, mz_uint8* pOut_buf_next, size_t* pOut_buf_size,
+                              const mz_uint32 decomp_flags) {
+    auto it = decompressors.find(r);
+    if (it == decompressors.end() || pOut_buf_next < pOut_buf_start) {
+        return TINFL_STATUS_BAD_PARAM;
+    }
+    HostInflate& s = it->second;
+    if (*pIn_buf_size || !s.decoded) {
+        s.input.insert(s.input.end(), pIn_buf_next, pIn_buf_next + *pIn_buf_size);
+        s.result = inflateAll(s.input, decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER, s.output);
+        s.decoded = true;
+    }
+    if (s.result == INFLATE_ERROR) {
+        *pOut_buf_size = 0;
+        return TINFL_STATUS_FAILED;
+    }
+    size_t n = s.output.size() - s.delivered;
+    if (n > *pOut_buf_size) {
+        n = *pOut_buf_size;
+    }
+    memcpy(pOut_buf_next, s.output.data() + s.delivered, n);
+    s.delivered += n;
+    *pOut_buf_size = n;
+    if (s.delivered < s.output.size()) {
+        return TINFL_STATUS_HAS_MORE_OUTPUT;
+    }
+    switch (s.result) {
+        case INFLATE_DONE:
+            return TINFL_STATUS_DONE;
+        case INFLATE_BAD_ADLER:
+            return TINFL_STATUS_ADLER32_MISMATCH;
+        default:
+            return decomp_flags & TINFL_FLAG_HAS_MORE_INPUT ? TINFL_STATUS_NEEDS_MORE_INPUT
+                                                             : TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS;
+    }
+}
@@ -0,0 +1,32 @@
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <stdarg.h>
+
+uint64_t hostClockUs = 0;
+HardwareSerial Serial;
+HardwareSerial Serial1;
+fs::FS LittleFS;
+
+HardwareSerial* HardwareSerial::console() {
+    return &Serial;
+}
+
+int Stream::printf(const char* format, ...) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    write((const uint8_t*)buffer, n < (int)sizeof(buffer) ? n : sizeof(buffer) - 1);
+    return n;
+}
+
+// Symboles fournis par main.cpp sur la cible
+class Uploader;
+Uploader* uploader = nullptr;
+bool rp2040BootloaderActive = false;
+uint32_t lastActivityTime = 0;
+
+void resetInactivityTimer() {
+    lastActivityTime = millis();
+}
@@ -0,0 +1,42 @@
+#pragma once
+// Inflateur de miniz (tinfl) tel qu'exposé par la ROM des ESP32, pour les
+// tests sur l'hôte. Même interface et même contrat de sortie: dictionnaire
+// circulaire de TINFL_LZ_DICT_SIZE octets, rempli au plus jusqu'à sa fin à
+// chaque appel. L'entrée est toujours consommée en entier; le décodage
+// reprend depuis le début du flux à chaque nouvelle donnée, ce qui suffit
+// pour des images de test.
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t mz_uint8;
+typedef uint32_t mz_uint32;
+
+#define TINFL_LZ_DICT_SIZE 32768
+
+enum {
+    TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+    TINFL_FLAG_HAS_MORE_INPUT = 2,
+    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+    TINFL_FLAG_COMPUTE_ADLER32 = 8
+};
+
+typedef enum {
+    TINFL_STATUS_FAILED_CANNOT_MAKE_PROGRESS = -4,
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2
+} tinfl_status;
+
+// Alloué sans constructeur par l'appelant (malloc): l'état du décodage est
+// rangé à part, sous l'adresse du décompresseur
+struct tinfl_decompressor {
+    uint32_t reserved;
+};
+
+void tinfl_init(tinfl_decompressor* r);
+tinfl_status tinfl_decompress(tinfl_decompressor* r, const mz_uint8* pIn_buf_next, size_t* pIn_buf_size,
+                              mz_uint8* pOut_buf_start, mz_uint8* pOut_buf_next, size_t* pOut_buf_size,
+                              const mz_uint32 decomp_flags);
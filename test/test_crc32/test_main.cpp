@@ -0,0 +1,117 @@
+// Vérifie les variantes CRC32 et compare leur débit.
+//   pio test -e native -f test_crc32 -v
+// Sur une carte (pio test -e esp32s3-xiao -f test_crc32) la variante ROM est
+// aussi mesurée.
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include "rp2040_flasher/crc32.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+static uint32_t nowUs() { return micros(); }
+#define BENCH_BYTES (256u * 1024u)
+#else
+#include <chrono>
+static uint32_t nowUs() {
+    using namespace std::chrono;
+    return (uint32_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+#define BENCH_BYTES (16u * 1024u * 1024u)
+#endif
+
+static uint8_t block[4096];
+
+void setUp() {}
+void tearDown() {}
+
+// Référence bit à bit (l'ancienne implémentation du flasheur)
+static uint32_t crc32Bitwise(uint32_t crc, const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static void test_check_value() {
+    const char* check = "123456789";
+    for (size_t v = 0; v < crc32VariantCount; ++v) {
+        uint32_t crc = ~crc32Variants[v].update(CRC32_INIT, (const uint8_t*)check, 9);
+        TEST_ASSERT_EQUAL_HEX32_MESSAGE(0xCBF43926, crc, crc32Variants[v].name);
+    }
+}
+
+// Découpage irrégulier: le chaînage doit donner le même résultat qu'en une passe
+static void test_incremental_matches_reference() {
+    uint32_t ref = crc32Bitwise(CRC32_INIT, block, sizeof(block));
+    for (size_t v = 0; v < crc32VariantCount; ++v) {
+        uint32_t crc = CRC32_INIT;
+        size_t pos = 0;
+        size_t step = 1;
+        while (pos < sizeof(block)) {
+            size_t n = step < sizeof(block) - pos ? step : sizeof(block) - pos;
+            crc = crc32Variants[v].update(crc, block + pos, n);
+            pos += n;
+            step = step * 3 + 1;
+        }
+        TEST_ASSERT_EQUAL_HEX32_MESSAGE(ref, crc, crc32Variants[v].name);
+    }
+}
+
+// Sert au flasheur pour les zones non relues (CRC fourni par le bootloader)
+static void test_combine() {
+    uint32_t whole = ~crc32Bitwise(CRC32_INIT, block, sizeof(block));
+    const size_t splits[] = { 0, 1, 4, 1000, 4095, sizeof(block) };
+    for (size_t s : splits) {
+        uint32_t a = ~crc32Bitwise(CRC32_INIT, block, s);
+        uint32_t b = ~crc32Bitwise(CRC32_INIT, block + s, sizeof(block) - s);
+        TEST_ASSERT_EQUAL_HEX32(whole, crc32Combine(a, b, sizeof(block) - s));
+    }
+}
+
+static void bench(const char* name, Crc32UpdateFn update) {
+    uint32_t crc = CRC32_INIT;
+    uint32_t start = nowUs();
+    for (uint32_t done = 0; done < BENCH_BYTES; done += sizeof(block)) {
+        crc = update(crc, block, sizeof(block));
+    }
+    uint32_t elapsed = nowUs() - start;
+    char line[96];
+    snprintf(line, sizeof(line), "crc32 %-8s %8.2f MB/s (crc 0x%08X)", name,
+             elapsed ? (double)BENCH_BYTES / elapsed : 0.0, (unsigned)~crc);
+    TEST_MESSAGE(line);
+}
+
+static void test_benchmark() {
+    bench("bitwise", crc32Bitwise);
+    for (size_t v = 0; v < crc32VariantCount; ++v) {
+        bench(crc32Variants[v].name, crc32Variants[v].update);
+    }
+}
+
+static int runAll() {
+    for (size_t i = 0; i < sizeof(block); ++i) {
+        block[i] = (uint8_t)(i * 31 + (i >> 7));
+    }
+    UNITY_BEGIN();
+    RUN_TEST(test_check_value);
+    RUN_TEST(test_incremental_matches_reference);
+    RUN_TEST(test_combine);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+    delay(2000);
+    runAll();
+}
+void loop() {}
+#else
+int main() {
+    return runAll();
+}
+#endif
@@ -0,0 +1,349 @@
+#include "bootloader_sim.h"
+#include "rp2040_flasher/rp2040_flasher.h"
+#include "rp2040_flasher/crc32.h"
+
+static uint32_t crcOf(const uint8_t* data, size_t length) {
+    return ~crc32Update(CRC32_INIT, data, length);
+}
+
+BootloaderSim::BootloaderSim(const SimConfig& c) : config(c), deviceBaud(c.baud), hostBaudRate(c.baud) {
+    // Contenu quelconque laissé par un firmware précédent
+    flash.resize(config.flashSize);
+    uint32_t x = 0x12345678;
+    for (auto& b : flash) {
+        x = x * 1103515245 + 12345;
+        b = x >> 24;
+    }
+}
+
+uint32_t BootloaderSim::arg(int index) const {
+    uint32_t w;
+    memcpy(&w, frame.data() + 4 + 4 * index, 4);
+    return w;
+}
+
+void BootloaderSim::hostBaud(uint32_t baud) {
+    run();
+    hostBaudRate = baud;
+}
+
+void BootloaderSim::hostWrite(const uint8_t* data, size_t length) {
+    run();
+    uint64_t now = hostClockUs;
+    uint64_t perByte = byteUs(hostBaudRate);
+    for (size_t i = 0; i < length; ++i) {
+        hostLineFree = (hostLineFree > now ? hostLineFree : now) + perByte;
+        if (hostBaudRate != deviceBaud) {
+            garbled++;
+        } else {
+            incoming.push_back({ hostLineFree, data[i] });
+        }
+        // Tampon TX plein: write() bloque jusqu'à ce qu'un octet parte
+        uint64_t backlog = config.hostTxBuffer * perByte;
+        if (hostLineFree > hostClockUs + backlog) {
+            hostClockUs = hostLineFree - backlog;
+            now = hostClockUs;
+        }
+    }
+}
+
+void BootloaderSim::hostFlush() {
+    if (hostLineFree > hostClockUs) {
+        hostClockUs = hostLineFree;
+    }
+    run();
+}
+
+int BootloaderSim::hostAvailable() {
+    run();
+    int n = 0;
+    for (const auto& b : outgoing) {
+        if (b.time > hostClockUs) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+int BootloaderSim::hostRead() {
+    run();
+    if (outgoing.empty() || outgoing.front().time > hostClockUs) {
+        return -1;
+    }
+    uint8_t v = outgoing.front().value;
+    outgoing.pop_front();
+    return v;
+}
+
+int BootloaderSim::hostPeek() {
+    run();
+    if (outgoing.empty() || outgoing.front().time > hostClockUs) {
+        return -1;
+    }
+    return outgoing.front().value;
+}
+
+uint64_t BootloaderSim::nextEventUs() {
+    uint64_t now = hostClockUs;
+    uint64_t next = 0;
+    auto consider = [&](uint64_t t) {
+        if (t > now && (!next || t < next)) {
+            next = t;
+        }
+    };
+    if (!incoming.empty()) {
+        consider(incoming.front().time);
+    }
+    if (!rxFifo.empty()) {
+        consider(busyUntil);
+    }
+    if (!outgoing.empty()) {
+        consider(outgoing.front().time);
+    }
+    if (baudRevertAt) {
+        consider(baudRevertAt);
+    }
+    return next;
+}
+
+// Déroule la simulation jusqu'à l'instant courant
+void BootloaderSim::run() {
+    uint64_t now = hostClockUs;
+    if (baudRevertAt && now >= baudRevertAt) {
+        deviceBaud = previousBaud;
+        baudRevertAt = 0;
+        synced = false;
+        frame.clear();
+    }
+    for (;;) {
+        bool arrival = !incoming.empty() && incoming.front().time <= now;
+        bool drain = !rxFifo.empty() && busyUntil <= now;
+        if (!arrival && !drain) {
+            break;
+        }
+        if (arrival && (!drain || incoming.front().time <= busyUntil)) {
+            TimedByte b = incoming.front();
+            incoming.pop_front();
+            if (b.time < busyUntil || !rxFifo.empty()) {
+                if (rxFifo.size() < config.rxBuffer) {
+                    rxFifo.push_back(b.value);
+                } else {
+                    overruns++;
+                }
+            } else {
+                feed(b.value, b.time);
+            }
+        } else {
+            uint8_t v = rxFifo.front();
+            rxFifo.pop_front();
+            feed(v, busyUntil);
+        }
+    }
+}
+
+void BootloaderSim::feed(uint8_t value, uint64_t time) {
+    if (!synced) {
+        syncWindow = (syncWindow >> 8) | ((uint32_t)value << 24);
+        if (syncWindow == CMD_SYNC) {
+            synced = true;
+            syncWindow = 0;
+            frame.clear();
+            baudRevertAt = 0;
+            commandCount[CMD_SYNC]++;
+            uint32_t pico = RSP_SYNC;
+            busyUntil = time + config.commandUs;
+            respond(&pico, 1, busyUntil);
+        }
+        return;
+    }
+    frame.push_back(value);
+    if (frame.size() < 4) {
+        return;
+    }
+    uint32_t opcode;
+    memcpy(&opcode, frame.data(), 4);
+    size_t args;
+    switch (opcode) {
+        case CMD_SYNC: case CMD_INFO: args = 0; break;
+        case CMD_GO: case CMD_BAUD: args = 1; break;
+        case CMD_ERASE: case CMD_WRITE: case CMD_CRC: args = 2; break;
+        case CMD_SEAL: args = 3; break;
+        default:
+            fail(time);
+            return;
+    }
+    size_t needed = 4 + 4 * args;
+    if (opcode == CMD_WRITE && frame.size() >= needed) {
+        uint32_t length = arg(1);
+        if (length > config.maxDataLen || length % config.writeSize) {
+            fail(time);
+            return;
+        }
+        needed += length;
+    }
+    if (frame.size() == needed) {
+        execute(time);
+        frame.clear();
+    }
+}
+
+void BootloaderSim::fail(uint64_t time) {
+    uint32_t err = RSP_ERR;
+    busyUntil = time + config.commandUs;
+    respond(&err, 1, busyUntil);
+    synced = false;
+    syncWindow = 0;
+    frame.clear();
+}
+
+void BootloaderSim::respond(const uint32_t* words, size_t count, uint64_t readyTime) {
+    const uint8_t* bytes = (const uint8_t*)words;
+    uint64_t perByte = byteUs(deviceBaud);
+    uint64_t t = readyTime > deviceLineFree ? readyTime : deviceLineFree;
+    for (size_t i = 0; i < count * 4; ++i) {
+        t += perByte;
+        if (hostBaudRate != deviceBaud) {
+            garbled++;
+        } else {
+            outgoing.push_back({ t, bytes[i] });
+        }
+    }
+    deviceLineFree = t;
+}
+
+void BootloaderSim::execute(uint64_t time) {
+    uint32_t opcode;
+    memcpy(&opcode, frame.data(), 4);
+    uint32_t occurrence = ++commandCount[opcode];
+    for (const SimFault& f : config.faults) {
+        if (f.opcode != opcode || f.occurrence != occurrence) {
+            continue;
+        }
+        if (f.kind == SIM_FAULT_ERR) {
+            fail(time);
+            return;
+        }
+        if (f.kind == SIM_FAULT_DROP) {
+            return;
+        }
+        if (f.kind == SIM_FAULT_CORRUPT && opcode == CMD_WRITE) {
+            frame[12] ^= 0x01;
+        }
+    }
+
+    uint64_t latency = config.commandUs;
+    uint32_t start = config.flashStart;
+    uint32_t end = config.flashStart + config.flashSize;
+    auto inFlash = [&](uint32_t addr, uint32_t len) {
+        return addr >= start && addr <= end && len <= end - addr;
+    };
+    uint32_t rsp[6] = { RSP_OK };
+
+    switch (opcode) {
+        case CMD_SYNC:
+            rsp[0] = RSP_SYNC;
+            busyUntil = time + latency;
+            respond(rsp, 1, busyUntil);
+            return;
+
+        case CMD_INFO:
+            rsp[1] = config.flashStart;
+            rsp[2] = config.flashSize;
+            rsp[3] = config.eraseSize;
+            rsp[4] = config.writeSize;
+            rsp[5] = config.maxDataLen;
+            busyUntil = time + latency;
+            respond(rsp, 6, busyUntil);
+            return;
+
+        case CMD_ERASE: {
+            uint32_t addr = arg(0);
+            uint32_t len = arg(1);
+            if (!len || !inFlash(addr, len) || (addr - start) % config.eraseSize || len % config.eraseSize) {
+                fail(time);
+                return;
+            }
+            memset(flash.data() + (addr - start), 0xFF, len);
+            for (uint32_t a = addr; a < addr + len; a += config.eraseSize) {
+                erasedSectors.push_back(a);
+            }
+            latency += (uint64_t)(len / config.eraseSize) * config.eraseSectorUs;
+            busyUntil = time + latency;
+            respond(rsp, 1, busyUntil);
+            return;
+        }
+
+        case CMD_WRITE: {
+            uint32_t addr = arg(0);
+            uint32_t len = arg(1);
+            if (!inFlash(addr, len) || (addr - start) % config.writeSize) {
+                fail(time);
+                return;
+            }
+            const uint8_t* data = frame.data() + 12;
+            uint8_t* dest = flash.data() + (addr - start);
+            for (uint32_t i = 0; i < len; ++i) {
+                dest[i] &= data[i]; // la programmation ne fait que passer des bits à 0
+            }
+            writtenBytes += len;
+            latency += (uint64_t)(len / config.writeSize) * config.programPageUs;
+            rsp[1] = crcOf(data, len);
+            busyUntil = time + latency;
+            respond(rsp, 2, busyUntil);
+            return;
+        }
+
+        case CMD_CRC: {
+            uint32_t addr = arg(0);
+            uint32_t len = arg(1);
+            if (!config.supportsCrc || !inFlash(addr, len) || len % 4) {
+                fail(time);
+                return;
+            }
+            rsp[1] = crcOf(flash.data() + (addr - start), len);
+            latency += (uint64_t)(len / 1024) * config.crcKiBUs;
+            busyUntil = time + latency;
+            respond(rsp, 2, busyUntil);
+            return;
+        }
+
+        case CMD_SEAL: {
+            uint32_t addr = arg(0);
+            uint32_t size = arg(1);
+            uint32_t crc = arg(2);
+            if (addr != start || !inFlash(addr, size) || crcOf(flash.data(), size) != crc) {
+                fail(time);
+                return;
+            }
+            sealed = true;
+            sealedSize = size;
+            sealedCrc = crc;
+            latency += (uint64_t)(size / 1024) * config.crcKiBUs;
+            busyUntil = time + latency;
+            respond(rsp, 1, busyUntil);
+            return;
+        }
+
+        case CMD_GO:
+            booted = true;
+            synced = false;
+            return;
+
+        case CMD_BAUD: {
+            uint32_t baud = arg(0);
+            if (!config.supportsBaud || baud > config.maxBaud) {
+                fail(time);
+                return;
+            }
+            busyUntil = time + latency;
+            respond(rsp, 1, busyUntil);
+            // Bascule une fois OKOK parti, retour en arrière sans SYNC
+            previousBaud = deviceBaud;
+            deviceBaud = baud;
+            baudRevertAt = deviceLineFree + (uint64_t)config.baudRevertMs * 1000;
+            synced = false;
+            return;
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+// Simulateur du bootloader série du RP2040, branché sur Serial1 à la place
+// du vrai câble. Protocole: SYNC/INFO/ERAS/WRIT/CRCC/SEAL/GOGO (+ BAUD en
+// option), mots de 32 bits little-endian. Le temps est celui de l'horloge
+// virtuelle du shim: chaque octet occupe la ligne 10 bits au débit courant,
+// chaque commande a une latence, et le RP2040 ne tamponne qu'un nombre
+// limité d'octets pendant qu'il efface ou programme.
+#include <Arduino.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+enum SimFaultKind {
+    SIM_FAULT_ERR,       // répond ERR! sans exécuter la commande
+    SIM_FAULT_DROP,      // n'exécute pas et ne répond pas
+    SIM_FAULT_CORRUPT    // WRIT: programme un octet faux (le CRC renvoyé le reflète)
+};
+
+struct SimFault {
+    uint32_t opcode;
+    uint32_t occurrence;  // 1 = première commande de ce type
+    SimFaultKind kind;
+};
+
+struct SimConfig {
+    // Géométrie annoncée par INFO
+    uint32_t flashStart = 0x10004000;
+    uint32_t flashSize = 2 * 1024 * 1024 - 0x4000;
+    uint32_t eraseSize = 4096;
+    uint32_t writeSize = 256;
+    uint32_t maxDataLen = 4096;
+
+    // Lien série
+    uint32_t baud = 921600;
+    size_t hostTxBuffer = 8448;          // tampon TX du driver côté ESP32
+    size_t rxBuffer = 16 * 1024;         // octets tamponnés par le RP2040 quand il est occupé
+    bool supportsBaud = false;
+    uint32_t maxBaud = 3000000;          // au-delà, BAUD est refusé
+    uint32_t baudRevertMs = 500;
+    bool supportsCrc = true;
+
+    // Latences en microsecondes
+    uint32_t commandUs = 30;
+    uint32_t eraseSectorUs = 45000;
+    uint32_t programPageUs = 700;
+    uint32_t crcKiBUs = 60;
+
+    std::vector<SimFault> faults;
+};
+
+class BootloaderSim : public SerialPeer {
+    public:
+        explicit BootloaderSim(const SimConfig& config = SimConfig());
+
+        // Côté ESP32 (appelés par Serial1)
+        void hostWrite(const uint8_t* data, size_t length) override;
+        int hostAvailable() override;
+        int hostRead() override;
+        int hostPeek() override;
+        void hostFlush() override;
+        void hostBaud(uint32_t baud) override;
+
+        // Prochain instant où il se passe quelque chose (0 si rien de prévu)
+        uint64_t nextEventUs();
+
+        SimConfig config;
+        std::vector<uint8_t> flash;          // zone applicative, à partir de flashStart
+
+        // Observations
+        std::map<uint32_t, uint32_t> commandCount;
+        std::vector<uint32_t> erasedSectors; // adresses, dans l'ordre
+        uint64_t writtenBytes = 0;
+        uint32_t overruns = 0;               // octets perdus, tampon RX plein
+        uint32_t garbled = 0;                // octets perdus, débits différents
+        bool sealed = false;
+        uint32_t sealedSize = 0;
+        uint32_t sealedCrc = 0;
+        bool booted = false;
+        uint32_t deviceBaud;
+
+    private:
+        struct TimedByte {
+            uint64_t time;
+            uint8_t value;
+        };
+
+        void run();
+        void feed(uint8_t value, uint64_t time);
+        void execute(uint64_t time);
+        void respond(const uint32_t* words, size_t count, uint64_t readyTime);
+        void fail(uint64_t time);
+        uint32_t arg(int index) const;
+        uint64_t byteUs(uint32_t baud) const { return (10ull * 1000000 + baud - 1) / baud; }
+
+        uint32_t hostBaudRate;
+        uint64_t hostLineFree = 0;           // fin d'émission du dernier octet de l'ESP32
+        uint64_t deviceLineFree = 0;
+        uint64_t busyUntil = 0;
+        std::deque<TimedByte> incoming;      // ESP32 -> RP2040, horodatés à l'arrivée
+        std::deque<uint8_t> rxFifo;          // reçus pendant une opération
+        std::deque<TimedByte> outgoing;      // RP2040 -> ESP32, horodatés à l'arrivée
+
+        bool synced = false;
+        uint32_t syncWindow = 0;
+        std::vector<uint8_t> frame;
+        uint32_t previousBaud = 0;
+        uint64_t baudRevertAt = 0;
+};
@@ -0,0 +1,146 @@
+#include "deflate_encoder.h"
+#include "rp2040_flasher/crc32.h"
+
+// Bits écrits du poids faible au poids fort, codes de Huffman inversés
+class BitWriter {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& out) : out(out) {}
+
+        void bits(uint32_t value, int count) {
+            buffer |= value << used;
+            used += count;
+            while (used >= 8) {
+                out.push_back(buffer);
+                buffer >>= 8;
+                used -= 8;
+            }
+        }
+
+        void code(uint32_t value, int count) {
+            uint32_t reversed = 0;
+            for (int i = 0; i < count; ++i) {
+                reversed |= ((value >> i) & 1) << (count - 1 - i);
+            }
+            bits(reversed, count);
+        }
+
+        void flush() {
+            if (used) {
+                out.push_back(buffer);
+            }
+            buffer = 0;
+            used = 0;
+        }
+
+    private:
+        std::vector<uint8_t>& out;
+        uint32_t buffer = 0;
+        int used = 0;
+};
+
+static const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                          35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                          3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// Code fixe du symbole littéral/longueur (RFC 1951, 3.2.6)
+static void literalLength(BitWriter& out, uint32_t symbol) {
+    if (symbol < 144) {
+        out.code(0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        out.code(0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        out.code(symbol - 256, 7);
+    } else {
+        out.code(0xC0 + symbol - 280, 8);
+    }
+}
+
+static void match(BitWriter& out, uint32_t length, uint32_t distance) {
+    int l = 28;
+    while (LENGTH_BASE[l] > length) {
+        --l;
+    }
+    literalLength(out, 257 + l);
+    out.bits(length - LENGTH_BASE[l], LENGTH_EXTRA[l]);
+    int d = 29;
+    while (DIST_BASE[d] > distance) {
+        --d;
+    }
+    out.code(d, 5);
+    out.bits(distance - DIST_BASE[d], DIST_EXTRA[d]);
+}
+
+static void deflateFixed(const std::vector<uint8_t>& data, std::vector<uint8_t>& result) {
+    BitWriter out(result);
+    out.bits(1, 1); // dernier bloc
+    out.bits(1, 2); // codes fixes
+    std::vector<int32_t> head(1 << 15, -1);
+    auto hash = [&](size_t i) {
+        return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & 0x7FFF;
+    };
+    size_t i = 0;
+    while (i < data.size()) {
+        uint32_t best = 0;
+        uint32_t distance = 0;
+        if (i + 3 <= data.size()) {
+            uint32_t h = hash(i);
+            int32_t candidate = head[h];
+            head[h] = i;
+            if (candidate >= 0 && i - candidate <= 32768) {
+                while (best < 258 && i + best < data.size() && data[candidate + best] == data[i + best]) {
+                    ++best;
+                }
+                distance = i - candidate;
+            }
+        }
+        if (best < 3) {
+            literalLength(out, data[i++]);
+            continue;
+        }
+        match(out, best, distance);
+        for (size_t end = i + best, j = i + 1; j < end; ++j) {
+            if (j + 3 <= data.size()) {
+                head[hash(j)] = j;
+            }
+        }
+        i += best;
+    }
+    literalLength(out, 256);
+    out.flush();
+}
+
+static uint32_t adler32(const std::vector<uint8_t>& data) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (uint8_t byte : data) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    return b << 16 | a;
+}
+
+std::vector<uint8_t> compressImage(const std::vector<uint8_t>& image, CompressedImageMethod method) {
+    CompressedImageHeader header = {};
+    header.magic = COMPRESSED_IMAGE_MAGIC;
+    header.method = method;
+    header.rawSize = image.size();
+    header.rawCrc = ~crc32Update(CRC32_INIT, image.data(), image.size());
+    std::vector<uint8_t> result((const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+    if (method == COMPRESSION_ZLIB) {
+        result.push_back(0x78);
+        result.push_back(0x01);
+    }
+    deflateFixed(image, result);
+    if (method == COMPRESSION_ZLIB) {
+        uint32_t adler = adler32(image);
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            result.push_back(adler >> shift);
+        }
+    }
+    return result;
+}
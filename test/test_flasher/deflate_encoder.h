@@ -0,0 +1,9 @@
+#pragma once
+// Conteneur d'image compressée comme le prépare l'interface web: en-tête
+// puis flux deflate (zlib ou brut). Encodeur minimal: LZ77 glouton et codes
+// de Huffman fixes, assez pour produire des flux valides et compressés.
+#include <stdint.h>
+#include <vector>
+#include "rp2040_flasher/compressed_image.h"
+
+std::vector<uint8_t> compressImage(const std::vector<uint8_t>& image, CompressedImageMethod method);
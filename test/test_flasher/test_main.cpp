@@ -0,0 +1,945 @@
+// Fait tourner la machine à états du flasheur contre un bootloader simulé,
+// sur l'hôte et en temps virtuel:
+//   pio test -e native -f test_flasher -v
+// Les débits affichés sont ceux du lien série et des latences simulées, pas
+// ceux de la machine qui exécute les tests.
+#include <unity.h>
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "bootloader_sim.h"
+#include "deflate_encoder.h"
+#include "config.h"
+#include "uploader.h"
+#include "rp2040_flasher/rp2040_flasher.h"
+#include "rp2040_flasher/image_source.h"
+#include "rp2040_flasher/uf2_image.h"
+#include "rp2040_flasher/crc32.h"
+#include "rp2040_flasher/flash_metrics.h"
+#include "rp2040_flasher/firmware_cache.h"
+#include "rp2040_flasher/staging_writer.h"
+#include "rp2040_flasher/byte_ring.h"
+#include "rp2040_flasher/compressed_image.h"
+
+extern Uploader* uploader;
+
+class TestUploader : public Uploader {
+    public:
+        void Setup() override {}
+        void loop() override {}
+        void notifyClients(const String& message) override {
+            messages.push_back(message.s);
+        }
+        bool saw(const char* text) const {
+            for (const auto& m : messages) {
+                if (m.find(text) != std::string::npos) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        std::string firstError() const {
+            for (const auto& m : messages) {
+                if (m.rfind("error:", 0) == 0) {
+                    return m;
+                }
+            }
+            return "";
+        }
+        std::vector<std::string> messages;
+};
+
+static TestUploader events;
+
+void setUp() {
+    events.messages.clear();
+    setDifferentialFlash(false);
+    setFlashSource(nullptr);
+    rp2040Flasher.setCheckpointKey("cible1"); // comme flasherBegin()
+    firmwareCacheSelect(nullptr);             // storeFirmware() écrit /firmware.bin
+    uploader = &events;
+}
+
+void tearDown() {
+    Serial1.attach(nullptr);
+}
+
+static std::vector<uint8_t> makeImage(size_t size, uint32_t seed) {
+    std::vector<uint8_t> image(size);
+    for (auto& b : image) {
+        seed = seed * 1664525 + 1013904223;
+        b = seed >> 24;
+    }
+    // Table des vecteurs plausible: pile en haut de la SRAM, reset en Thumb
+    uint32_t vectors[2] = { RP2040_SRAM_END, 0x10004000 + 0xC1 };
+    memcpy(image.data(), vectors, size < sizeof(vectors) ? size : sizeof(vectors));
+    return image;
+}
+
+// Se compresse à peu près comme un vrai firmware: des motifs répétés parmi
+// des octets quelconques
+static std::vector<uint8_t> makeCompressibleImage(size_t size, uint32_t seed) {
+    std::vector<uint8_t> image = makeImage(size, seed);
+    std::vector<uint8_t> words = makeImage(64 * 16, seed + 1);
+    for (size_t i = 8; i + 16 <= size; i += 32) {
+        seed = seed * 1664525 + 1013904223;
+        memcpy(image.data() + i, words.data() + (seed >> 26) * 16, 16);
+    }
+    return image;
+}
+
+static void storeFirmware(const std::vector<uint8_t>& image) {
+    imageDigestRemove("/firmware.bin");     // comme tout téléversement
+    File f = LittleFS.open("/firmware.bin", "w");
+    f.write(image.data(), image.size());
+    f.close();
+}
+
+static uint32_t crcOf(const uint8_t* data, size_t length) {
+    return ~crc32Update(CRC32_INIT, data, length);
+}
+
+// Appelle handleFlasher() jusqu'au retour à IDLE. Entre deux appels le temps
+// avance jusqu'au prochain événement du simulateur, d'1 ms au plus.
+static bool runFlasher(BootloaderSim& sim, uint32_t limitMs = 600000) {
+    uint64_t deadline = hostClockUs + (uint64_t)limitMs * 1000;
+    while (hostClockUs < deadline) {
+        handleFlasher();
+        if (!rp2040Flasher.busy()) {
+            return true;
+        }
+        uint64_t step = hostClockUs + 1000;
+        uint64_t next = sim.nextEventUs();
+        hostClockAdvance((next && next < step ? next : step) - hostClockUs);
+    }
+    return false;
+}
+
+static void attach(BootloaderSim& sim) {
+    Serial1.attach(&sim);
+    Serial1.begin(RP2040_SERIAL_BAUD);
+}
+
+// Synchronisation (comme PREPARE_FLASH) puis flash (comme START_FLASH).
+// Renvoie la durée virtuelle du flash en ms, 0 en cas d'échec.
+static uint32_t syncAndFlash(BootloaderSim& sim) {
+    startFlashProcess();
+    if (!runFlasher(sim) || !events.saw("EVENT:RP2040_SYNCED")) {
+        return 0;
+    }
+    uint64_t start = hostClockUs;
+    startFlashProcess(SEND_INFO_COMMAND);
+    if (!runFlasher(sim) || !events.saw("EVENT:FLASH_COMPLETE")) {
+        return 0;
+    }
+    return (uint32_t)((hostClockUs - start) / 1000);
+}
+
+// Contenu attendu en flash: l'image complétée à une page avec 0xFF
+static void assertFlashed(BootloaderSim& sim, const std::vector<uint8_t>& image) {
+    uint32_t padded = (image.size() + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1);
+    TEST_ASSERT_EQUAL_MEMORY(image.data(), sim.flash.data(), image.size());
+    for (uint32_t i = image.size(); i < padded; ++i) {
+        TEST_ASSERT_EQUAL_HEX32(0xFF, sim.flash[i]);
+    }
+    TEST_ASSERT_TRUE(sim.sealed);
+    TEST_ASSERT_EQUAL_UINT32(image.size(), sim.sealedSize);
+    TEST_ASSERT_EQUAL_HEX32(crcOf(image.data(), image.size()), sim.sealedCrc);
+    TEST_ASSERT_TRUE(sim.booted);
+}
+
+static void report(const char* name, uint32_t bytes, uint32_t ms) {
+    char line[128];
+    snprintf(line, sizeof(line), "%-28s %8u octets en %6u ms virtuelles (%u o/s)", name, bytes, ms,
+             ms ? (uint32_t)((uint64_t)bytes * 1000 / ms) : 0);
+    TEST_MESSAGE(line);
+}
+
+static void test_full_flash() {
+    BootloaderSim sim;
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(300 * 1024 + 123, 1);
+    storeFirmware(image);
+    uint32_t ms = syncAndFlash(sim);
+    TEST_ASSERT_TRUE_MESSAGE(ms, events.firstError().c_str());
+    assertFlashed(sim, image);
+    TEST_ASSERT_EQUAL_UINT32((image.size() + 4095) / 4096, sim.erasedSectors.size());
+    TEST_ASSERT_EQUAL_UINT32(0, sim.overruns);
+    TEST_ASSERT_TRUE(events.saw("Changement de débit non supporté"));
+
+    // Mesures par phase: octets de chaque phase, temps cohérent avec la durée
+    const FlashRun& run = rp2040Flasher.run();
+    TEST_ASSERT_TRUE(run.success);
+    TEST_ASSERT_EQUAL_UINT32(sim.erasedSectors.size() * 4096, run.phaseBytes[PHASE_ERASE]);
+    TEST_ASSERT_EQUAL_UINT32((image.size() + FLASH_PAGE_SIZE - 1) & ~(FLASH_PAGE_SIZE - 1), run.phaseBytes[PHASE_WRITE]);
+    TEST_ASSERT_EQUAL_UINT32(image.size(), run.phaseBytes[PHASE_SEAL]);
+    uint64_t flashUs = 0;
+    for (int p = PHASE_INFO; p < FLASH_PHASES; ++p) {
+        flashUs += run.phaseUs[p];
+    }
+    TEST_ASSERT_TRUE(run.phaseUs[PHASE_SYNC] > 0 && run.phaseUs[PHASE_WRITE] > 0 && run.phaseUs[PHASE_ERASE] > 0);
+    TEST_ASSERT_TRUE(flashUs <= (uint64_t)ms * 1000 + 1000 && flashUs + 2000 >= (uint64_t)ms * 1000);
+    TEST_ASSERT_TRUE(events.saw("EVENT:METRICS:"));
+    FlasherStatus status = rp2040Flasher.status();
+    TEST_ASSERT_EQUAL_UINT32(IDLE, status.state);
+    TEST_ASSERT_EQUAL_UINT32(image.size(), status.imageSize);
+    TEST_ASSERT_EQUAL_UINT32(run.phaseBytes[PHASE_WRITE], status.ackedBytes);
+    TEST_ASSERT_TRUE(flashMetricsJson().s.find("\"success\":true") != std::string::npos);
+
+    // Export Prometheus du flash enregistré: phases, RTT et reprises
+    static FlashRun runs[FLASH_METRICS_RUNS];
+    const FlashRun& last = runs[flashRunHistory(runs) - 1];
+    std::string text = flashMetricsPrometheus().s;
+    char labels[48];
+    snprintf(labels, sizeof(labels), "{run=\"%u\",target=\"%u\"", last.id, last.target);
+    auto has = [&](const std::string& line) { return text.find(line + "\n") != std::string::npos; };
+    char line[160];
+    for (int p = 0; p < FLASH_PHASES; ++p) {
+        snprintf(line, sizeof(line), "rp2040_flash_phase_seconds%s,phase=\"%s\"} %u.%06u", labels, flashPhaseName(p),
+                 last.phaseUs[p] / 1000000, last.phaseUs[p] % 1000000);
+        TEST_ASSERT_TRUE_MESSAGE(has(line), line);
+        snprintf(line, sizeof(line), "rp2040_flash_phase_bytes%s,phase=\"%s\"} %u", labels, flashPhaseName(p), last.phaseBytes[p]);
+        TEST_ASSERT_TRUE_MESSAGE(has(line), line);
+    }
+    const char* stats[3] = { "min", "avg", "max" };
+    uint32_t writeRtt[3] = { last.rtt[RTT_WRITE].minUs, last.rtt[RTT_WRITE].avgUs, last.rtt[RTT_WRITE].maxUs };
+    TEST_ASSERT_TRUE(last.rtt[RTT_WRITE].count > 0 && writeRtt[0] <= writeRtt[1] && writeRtt[1] <= writeRtt[2]);
+    for (int i = 0; i < 3; ++i) {
+        snprintf(line, sizeof(line), "rp2040_flash_rtt_seconds%s,command=\"%s\",stat=\"%s\"} %u.%06u", labels,
+                 rttCommandName(RTT_WRITE), stats[i], writeRtt[i] / 1000000, writeRtt[i] % 1000000);
+        TEST_ASSERT_TRUE_MESSAGE(has(line), line);
+    }
+    for (int k = 0; k < FLASH_RETRIES; ++k) {
+        snprintf(line, sizeof(line), "rp2040_flash_retries%s,kind=\"%s\"} 0", labels, flashRetryName(k));
+        TEST_ASSERT_TRUE_MESSAGE(has(line), line);
+    }
+    // Au-delà de 71 minutes, la durée en µs ne tient plus sur 32 bits
+    FlashRun slow = last;
+    slow.totalMs = 5 * 3600 * 1000 + 7;
+    recordFlashRun(slow);
+    snprintf(labels, sizeof(labels), "{run=\"%u\",target=\"%u\"", slow.id, slow.target);
+    snprintf(line, sizeof(line), "rp2040_flash_duration_seconds%s,result=\"ok\"} 18000.007000", labels);
+    TEST_ASSERT_TRUE_MESSAGE(flashMetricsPrometheus().s.find(line) != std::string::npos, line);
+    report("flash complet 921600", image.size(), ms);
+}
+
+static void test_baud_escalation() {
+    SimConfig config;
+    config.supportsBaud = true;
+    config.maxBaud = 2000000; // 3000000 refusé: il faut se resynchroniser
+    BootloaderSim sim(config);
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(300 * 1024 + 123, 2);
+    storeFirmware(image);
+    uint32_t ms = syncAndFlash(sim);
+    TEST_ASSERT_TRUE_MESSAGE(ms, events.firstError().c_str());
+    assertFlashed(sim, image);
+    TEST_ASSERT_TRUE(events.saw("UART RP2040 à 2000000 bauds."));
+    TEST_ASSERT_EQUAL_UINT32(RP2040_SERIAL_BAUD, Serial1.baudRate);
+    report("flash complet 2000000", image.size(), ms);
+}
+
+static void test_differential() {
+    BootloaderSim sim;
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(64 * 1024 + 500, 3);
+    storeFirmware(image);
+    TEST_ASSERT_TRUE(syncAndFlash(sim));
+
+    image[5 * 4096 + 17] ^= 0x5A;
+    image[image.size() - 1] ^= 0x01;
+    storeFirmware(image);
+    sim.erasedSectors.clear();
+    sim.sealed = false;
+    events.messages.clear();
+    setDifferentialFlash(true);
+    uint32_t ms = syncAndFlash(sim);
+    TEST_ASSERT_TRUE_MESSAGE(ms, events.firstError().c_str());
+    assertFlashed(sim, image);
+    TEST_ASSERT_EQUAL_UINT32(2, sim.erasedSectors.size());
+    TEST_ASSERT_EQUAL_HEX32(sim.config.flashStart + 5 * 4096, sim.erasedSectors[0]);
+    TEST_ASSERT_EQUAL_HEX32(sim.config.flashStart + 16 * 4096, sim.erasedSectors[1]);
+    report("différentiel, 2 secteurs", image.size(), ms);
+}
+
+static void test_differential_without_crc() {
+    SimConfig config;
+    config.supportsCrc = false;
+    BootloaderSim sim(config);
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(20 * 1024, 4);
+    storeFirmware(image);
+    setDifferentialFlash(true);
+    TEST_ASSERT_TRUE_MESSAGE(syncAndFlash(sim), events.firstError().c_str());
+    assertFlashed(sim, image);
+    TEST_ASSERT_TRUE(events.saw("CRC non supporté"));
+    TEST_ASSERT_EQUAL_UINT32(5, sim.erasedSectors.size());
+}
+
+static void test_blank_pages_skipped() {
+    BootloaderSim sim;
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(128 * 1024, 5);
+    memset(image.data() + 8 * 1024 + 256, 0xFF, 40 * 1024);
+    storeFirmware(image);
+    TEST_ASSERT_TRUE_MESSAGE(syncAndFlash(sim), events.firstError().c_str());
+    assertFlashed(sim, image);
+    TEST_ASSERT_EQUAL_UINT32(image.size() - 40 * 1024, sim.writtenBytes);
+}
+
+static void appendUf2(std::vector<uint8_t>& uf2, uint32_t address, const uint8_t* data, uint32_t length) {
+    uint8_t block[UF2_BLOCK_SIZE] = {0};
+    Uf2BlockHeader h;
+    h.magicStart0 = UF2_MAGIC_START0;
+    h.magicStart1 = UF2_MAGIC_START1;
+    h.flags = UF2_FLAG_FAMILY_ID;
+    h.targetAddr = address;
+    h.payloadSize = length;
+    h.blockNo = uf2.size() / UF2_BLOCK_SIZE;
+    h.numBlocks = 0;
+    h.familyId = UF2_FAMILY_RP2040;
+    memcpy(block, &h, sizeof(h));
+    memcpy(block + UF2_HEADER_SIZE, data, length);
+    uint32_t magicEnd = UF2_MAGIC_END;
+    memcpy(block + UF2_BLOCK_SIZE - 4, &magicEnd, 4);
+    uf2.insert(uf2.end(), block, block + UF2_BLOCK_SIZE);
+}
+
+static void test_uf2_sparse() {
+    BootloaderSim sim;
+    attach(sim);
+    std::vector<uint8_t> before = sim.flash;
+    std::vector<uint8_t> low = makeImage(8 * 1024, 6);
+    std::vector<uint8_t> high = makeImage(3 * 1024, 7);
+    std::vector<uint8_t> uf2;
+    uint32_t base = sim.config.flashStart;
+    for (uint32_t o = 0; o < low.size(); o += 256) {
+        appendUf2(uf2, base + o, low.data() + o, 256);
+    }
+    for (uint32_t o = 0; o < high.size(); o += 256) {
+        appendUf2(uf2, base + 64 * 1024 + o, high.data() + o, 256);
+    }
+    storeFirmware(uf2);
+    TEST_ASSERT_TRUE_MESSAGE(syncAndFlash(sim), events.firstError().c_str());
+
+    TEST_ASSERT_EQUAL_MEMORY(low.data(), sim.flash.data(), low.size());
+    TEST_ASSERT_EQUAL_MEMORY(before.data() + low.size(), sim.flash.data() + low.size(), 56 * 1024);
+    TEST_ASSERT_EQUAL_MEMORY(high.data(), sim.flash.data() + 64 * 1024, high.size());
+    TEST_ASSERT_EQUAL_UINT32(3, sim.erasedSectors.size());
+    TEST_ASSERT_TRUE(sim.sealed);
+    TEST_ASSERT_EQUAL_UINT32(64 * 1024 + high.size(), sim.sealedSize);
+}
+
+static void test_write_error_falls_back() {
+    SimConfig config;
+    config.faults.push_back({ CMD_WRITE, 10, SIM_FAULT_ERR });
+    BootloaderSim sim(config);
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(100 * 1024, 8);
+    storeFirmware(image);
+    TEST_ASSERT_TRUE_MESSAGE(syncAndFlash(sim), events.firstError().c_str());
+    assertFlashed(sim, image);
+    TEST_ASSERT_TRUE(events.saw("repli en mode stop-and-wait"));
+    TEST_ASSERT_EQUAL_UINT32(1, rp2040Flasher.run().retries[RETRY_PIPELINE]);
+}
+
+static void test_write_timeout_falls_back() {
+    SimConfig config;
+    // Dernier bloc: une réponse perdue au milieu serait attribuée au bloc
+    // précédent (les réponses ne sont associées que par leur ordre)
+    config.faults.push_back({ CMD_WRITE, 10, SIM_FAULT_DROP });
+    BootloaderSim sim(config);
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(40 * 1024, 9);
+    storeFirmware(image);
+    TEST_ASSERT_TRUE_MESSAGE(syncAndFlash(sim), events.firstError().c_str());
+    assertFlashed(sim, image);
+    TEST_ASSERT_TRUE(events.saw("repli en mode stop-and-wait"));
+}
+
+// Les CRC renvoyés par WRIT ne sont pas vérifiés: des octets perdus par le
+// RP2040 ne sont détectés qu'au scellement, qui doit échouer.
+static void test_rx_overrun_recovered() {
+    SimConfig config;
+    config.rxBuffer = 32; // FIFO matériel seul: la fenêtre déborde
+    BootloaderSim sim(config);
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(64 * 1024, 10);
+    storeFirmware(image);
+    TEST_ASSERT_TRUE_MESSAGE(syncAndFlash(sim), events.firstError().c_str());
+    TEST_ASSERT_GREATER_THAN(0, sim.overruns);
+    assertFlashed(sim, image);
+}
+
+// Bloc abîmé en route: détecté par son CRC, seul son secteur est réécrit
+static void test_corrupted_write_retransmitted() {
+    SimConfig config;
+    // Blocs de 1 Kio au début (choix de la taille): le 5e ouvre le 2e secteur
+    config.faults.push_back({ CMD_WRITE, 5, SIM_FAULT_CORRUPT });
+    config.faults.push_back({ CMD_ERASE, 3, SIM_FAULT_ERR });
+    BootloaderSim sim(config);
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(16 * 1024, 11);
+    storeFirmware(image);
+    TEST_ASSERT_TRUE_MESSAGE(syncAndFlash(sim), events.firstError().c_str());
+    assertFlashed(sim, image);
+    const FlashRun& run = rp2040Flasher.run();
+    TEST_ASSERT_EQUAL_UINT32(1, run.retries[RETRY_BLOCK_CRC]);
+    TEST_ASSERT_EQUAL_UINT32(1, run.retries[RETRY_ERASE]);
+    TEST_ASSERT_EQUAL_UINT32(0, run.retries[RETRY_PIPELINE]);
+    // 4 secteurs, plus celui du bloc 5 une seconde fois
+    TEST_ASSERT_EQUAL_UINT32(5, sim.erasedSectors.size());
+    TEST_ASSERT_EQUAL_UINT32(2, std::count(sim.erasedSectors.begin(), sim.erasedSectors.end(), config.flashStart + 4096));
+}
+
+// ESP32 redémarré en plein flash: le flash suivant de la même image reprend
+// après la zone déjà écrite, une fois son CRC confirmé par le RP2040
+static void test_resume_after_interruption() {
+    BootloaderSim sim;
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(128 * 1024 + 100, 15);
+    storeFirmware(image);
+    startFlashProcess();
+    TEST_ASSERT_TRUE(runFlasher(sim));
+    startFlashProcess(SEND_INFO_COMMAND);
+    uint64_t deadline = hostClockUs + 60000000ull;
+    // Point de reprise posé tous les FLASHER_CHECKPOINT_INTERVAL (64 Kio)
+    while (sim.writtenBytes < 72 * 1024 && hostClockUs < deadline) {
+        handleFlasher();
+        uint64_t step = hostClockUs + 1000;
+        uint64_t next = sim.nextEventUs();
+        hostClockAdvance((next && next < step ? next : step) - hostClockUs);
+    }
+    rp2040Flasher.stop();
+    TEST_ASSERT_FALSE(sim.sealed);
+
+    BootloaderSim resumed;
+    resumed.flash = sim.flash;
+    attach(resumed);
+    events.messages.clear();
+    TEST_ASSERT_TRUE_MESSAGE(syncAndFlash(resumed), events.firstError().c_str());
+    assertFlashed(resumed, image);
+    TEST_ASSERT_TRUE(events.saw("log:Reprise du flash"));
+    TEST_ASSERT_GREATER_OR_EQUAL(resumed.config.flashStart + 64 * 1024, resumed.erasedSectors.front());
+    TEST_ASSERT_LESS_OR_EQUAL(image.size() - 64 * 1024 + FLASH_PAGE_SIZE, resumed.writtenBytes);
+
+    // Point de reprise effacé par le flash réussi
+    BootloaderSim again;
+    again.flash = resumed.flash;
+    attach(again);
+    events.messages.clear();
+    TEST_ASSERT_TRUE(syncAndFlash(again));
+    TEST_ASSERT_FALSE(events.saw("Reprise du flash"));
+    TEST_ASSERT_EQUAL_HEX32(again.config.flashStart, again.erasedSectors.front());
+}
+
+// Bootloader à secteurs de 16 Kio qui annonce des blocs de 64 Kio: les blocs
+// restent bornés au secteur, la taille retenue est une des tailles essayées
+static void test_write_block_sizing() {
+    SimConfig config;
+    config.eraseSize = 16 * 1024;
+    config.maxDataLen = 64 * 1024;
+    BootloaderSim sim(config);
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(256 * 1024 + 17, 22);
+    storeFirmware(image);
+    TEST_ASSERT_TRUE_MESSAGE(syncAndFlash(sim), events.firstError().c_str());
+    assertFlashed(sim, image);
+    TEST_ASSERT_TRUE(events.saw("log:Blocs WRITE de "));
+    for (const auto& m : events.messages) {
+        if (m.find("log:Blocs WRITE de ") == 0) {
+            TEST_MESSAGE(m.c_str() + 4);
+        }
+    }
+    uint32_t block = rp2040Flasher.run().writeBlock;
+    TEST_ASSERT_TRUE(block >= FLASHER_TUNE_MIN_BLOCK && block <= FLASHER_MAX_BLOCK);
+    TEST_ASSERT_EQUAL_UINT32(0, block & (block - 1));
+}
+
+static void test_invalid_image_rejected() {
+    std::vector<uint8_t> oversized = makeImage(2 * 1024 * 1024, 16);
+    std::vector<uint8_t> esp32 = makeImage(64 * 1024, 17);
+    const uint8_t espHeader[] = { 0xE9, 0x03, 0x02, 0x20 };
+    memcpy(esp32.data(), espHeader, sizeof(espHeader));
+    std::vector<uint8_t> truncated = makeImage(64 * 1024, 18);
+    FlashImageHeader header = { FLASH_IMAGE_HEADER_MAGIC, 80 * 1024, 0, 3 };
+    memcpy(truncated.data() + FLASH_IMAGE_HEADER_OFFSET, &header, sizeof(header));
+    const std::vector<uint8_t>* images[] = { &oversized, &esp32, &truncated };
+    const char* reasons[] = { "zone applicative", "binaire ESP32", "tronquée" };
+
+    for (int i = 0; i < 3; ++i) {
+        BootloaderSim sim;
+        attach(sim);
+        events.messages.clear();
+        storeFirmware(*images[i]);
+        TEST_ASSERT_EQUAL_UINT32(0, syncAndFlash(sim));
+        TEST_ASSERT_TRUE_MESSAGE(events.saw(reasons[i]), events.firstError().c_str());
+        TEST_ASSERT_EQUAL_UINT32(0, sim.erasedSectors.size());
+        TEST_ASSERT_FALSE(sim.sealed);
+    }
+
+    // En-tête cohérent: l'image passe
+    BootloaderSim sim;
+    attach(sim);
+    header.imageSize = truncated.size();
+    memcpy(truncated.data() + FLASH_IMAGE_HEADER_OFFSET, &header, sizeof(header));
+    storeFirmware(truncated);
+    TEST_ASSERT_TRUE_MESSAGE(syncAndFlash(sim), events.firstError().c_str());
+    assertFlashed(sim, truncated);
+    TEST_ASSERT_TRUE(events.saw("Image version 3"));
+}
+
+static std::string sha256Of(const std::vector<uint8_t>& data) {
+    uint8_t digest[SHA256_SIZE];
+    Sha256 hash;
+    hash.update(data.data(), data.size());
+    hash.finish(digest);
+    return sha256Hex(digest).c_str();
+}
+
+static void test_firmware_cache() {
+    std::vector<uint8_t> abc = { 'a', 'b', 'c' };
+    TEST_ASSERT_EQUAL_STRING("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", sha256Of(abc).c_str());
+
+    // Budget de 1 Mio: la troisième image chasse la moins récemment utilisée
+    firmwareCacheBegin();
+    std::vector<uint8_t> imageA = makeImage(400 * 1024, 19);
+    std::vector<uint8_t> imageB = makeImage(400 * 1024 + 9, 20);
+    std::vector<uint8_t> imageC = makeImage(300 * 1024, 21);
+    storeFirmware(imageA);
+    TEST_ASSERT_TRUE(firmwareCacheStore("/firmware.bin"));
+    TEST_ASSERT_FALSE(LittleFS.exists("/firmware.bin"));
+    storeFirmware(imageB);
+    TEST_ASSERT_TRUE(firmwareCacheStore("/firmware.bin"));
+    TEST_ASSERT_EQUAL_STRING(sha256Of(imageB).c_str(), firmwareCacheSelected().c_str());
+    TEST_ASSERT_TRUE(firmwareCacheSelect(sha256Of(imageA).c_str()));
+    storeFirmware(imageC);
+    TEST_ASSERT_TRUE(firmwareCacheStore("/firmware.bin"));
+    TEST_ASSERT_FALSE(firmwareCacheSelect(sha256Of(imageB).c_str()));
+
+    // Flash par empreinte, sans rien téléverser; la sélection survit au redémarrage
+    TEST_ASSERT_TRUE(firmwareCacheSelect(sha256Of(imageA).c_str()));
+    firmwareCacheBegin();
+    TEST_ASSERT_EQUAL_STRING(sha256Of(imageA).c_str(), firmwareCacheSelected().c_str());
+    BootloaderSim sim;
+    attach(sim);
+    TEST_ASSERT_TRUE_MESSAGE(syncAndFlash(sim), events.firstError().c_str());
+    assertFlashed(sim, imageA);
+
+    // Image lue par un flash: jamais chassée, même la moins récemment utilisée
+    String pathA = firmwareImageAcquire();
+    TEST_ASSERT_TRUE(firmwareCacheSelect(sha256Of(imageC).c_str()));
+    storeFirmware(makeImage(400 * 1024 + 1, 25));
+    TEST_ASSERT_TRUE(firmwareCacheStore("/firmware.bin"));
+    TEST_ASSERT_FALSE(firmwareCacheSelect(sha256Of(imageC).c_str()));
+    TEST_ASSERT_TRUE(LittleFS.exists(pathA.c_str()));
+    firmwareCacheRelease(pathA.c_str());
+    storeFirmware(makeImage(300 * 1024 + 1, 26));
+    TEST_ASSERT_TRUE(firmwareCacheStore("/firmware.bin"));
+    TEST_ASSERT_FALSE(firmwareCacheSelect(sha256Of(imageA).c_str()));
+    firmwareCacheSelect(nullptr);
+}
+
+// Fragments de taille quelconque, écrits par blocs entiers; place vérifiée d'avance
+static void test_staging_writer() {
+    std::vector<uint8_t> image = makeImage(100 * 1024 + 3, 22);
+    static StagingWriter writer;  // comme dans wifi_upload: tampons gardés d'un téléversement à l'autre
+    TEST_ASSERT_FALSE(writer.begin("/firmware.bin", 4 * 1024 * 1024));
+    TEST_ASSERT_TRUE(writer.begin("/firmware.bin", image.size() + 200));
+    uint32_t sent = 0;
+    for (uint32_t n = 1; sent < image.size(); n = n * 7 % 1461 + 1) {
+        uint32_t chunk = image.size() - sent < n ? image.size() - sent : n;
+        TEST_ASSERT_TRUE(writer.write(image.data() + sent, chunk));
+        sent += chunk;
+        // Seuls des blocs entiers ont atteint le fichier
+        TEST_ASSERT_EQUAL_UINT32(0, LittleFS.contents("/firmware.bin")->size() % STAGING_BLOCK_SIZE);
+    }
+    // Empreinte de ce qui est reçu, pour reprendre un téléversement coupé
+    ImageDigest partial;
+    writer.progress(partial);
+    TEST_ASSERT_EQUAL_UINT32(image.size(), partial.size);
+    TEST_ASSERT_EQUAL_STRING(sha256Of(image).c_str(), sha256Hex(partial.sha256).c_str());
+    TEST_ASSERT_TRUE(writer.finish());
+    TEST_ASSERT_EQUAL_UINT32(image.size(), writer.size());
+    TEST_ASSERT_TRUE(*LittleFS.contents("/firmware.bin") == image);
+
+    // Empreinte calculée au fil de l'eau, rangée avec l'image et reprise par le cache
+    ImageDigest digest;
+    TEST_ASSERT_TRUE(imageDigestLoad("/firmware.bin", digest));
+    TEST_ASSERT_EQUAL_STRING(sha256Of(image).c_str(), sha256Hex(writer.digest().sha256).c_str());
+    TEST_ASSERT_EQUAL_HEX32(crcOf(image.data(), image.size()), digest.crc32);
+    TEST_ASSERT_TRUE(firmwareCacheStore("/firmware.bin"));
+    TEST_ASSERT_EQUAL_STRING(sha256Of(image).c_str(), firmwareCacheSelected().c_str());
+    TEST_ASSERT_TRUE(imageDigestLoad(firmwareImagePath().c_str(), digest));
+
+    // Image abîmée sur LittleFS après coup: le flasheur le voit au CRC
+    (*LittleFS.contents(firmwareImagePath().c_str()))[50000] ^= 0x01;
+    BootloaderSim sim;
+    attach(sim);
+    TEST_ASSERT_FALSE(syncAndFlash(sim));
+    TEST_ASSERT_TRUE(events.firstError().find("CRC de l'image incorrect") != std::string::npos);
+    TEST_ASSERT_FALSE(sim.sealed);
+    firmwareCacheSelect(nullptr);
+
+    // Place insuffisante: l'image en place et son empreinte restent. Les
+    // images du cache comptent comme place libre et sont supprimées au besoin.
+    storeFirmware(image);
+    TEST_ASSERT_TRUE(imageDigestSave("/firmware.bin", digest));
+    TEST_ASSERT_FALSE(writer.begin("/firmware.bin", 4 * 1024 * 1024));
+    TEST_ASSERT_TRUE(*LittleFS.contents("/firmware.bin") == image);
+    TEST_ASSERT_TRUE(imageDigestLoad("/firmware.bin", digest));
+    uint32_t room = LittleFS.totalBytes() - LittleFS.usedBytes() + image.size();
+    TEST_ASSERT_TRUE_MESSAGE(writer.begin("/firmware.bin", room + 64 * 1024), writer.error().c_str());
+    TEST_ASSERT_TRUE(LittleFS.totalBytes() - LittleFS.usedBytes() >= room + 64 * 1024);
+    writer.abort();
+
+    // Téléversement interrompu: pas de fichier partiel
+    TEST_ASSERT_TRUE(writer.begin("/firmware.bin", 0));
+    TEST_ASSERT_TRUE(writer.write(image.data(), 5000));
+    writer.abort();
+    TEST_ASSERT_FALSE(LittleFS.exists("/firmware.bin"));
+}
+
+static void test_byte_ring() {
+    // Paquets BLE de 514 octets vidés par blocs de 4096, comme ble_fs_writer
+    std::vector<uint8_t> image = makeImage(60 * 1024 + 17, 23);
+    std::vector<uint8_t> out;
+    ByteRing ring;
+    TEST_ASSERT_TRUE(ring.allocate(3 * STAGING_BLOCK_SIZE));
+    uint32_t sent = 0;
+    while (out.size() < image.size()) {
+        uint32_t n = std::min<uint32_t>(514, image.size() - sent);
+        sent += ring.write(image.data() + sent, n);
+        TEST_ASSERT_TRUE(ring.used() <= ring.capacity());
+        const uint8_t* p;
+        uint32_t available = ring.peek(&p);
+        if (available >= STAGING_BLOCK_SIZE || (sent == image.size() && available)) {
+            // L'anneau, multiple du bloc, ne coupe jamais un bloc en deux
+            uint32_t take = std::min<uint32_t>(available, STAGING_BLOCK_SIZE);
+            TEST_ASSERT_TRUE(take == STAGING_BLOCK_SIZE || sent == image.size());
+            out.insert(out.end(), p, p + take);
+            ring.consume(take);
+        }
+    }
+    TEST_ASSERT_TRUE(out == image);
+    TEST_ASSERT_EQUAL_UINT32(0, ring.used());
+    TEST_ASSERT_TRUE(ring.highWater() >= STAGING_BLOCK_SIZE && ring.highWater() < 2 * STAGING_BLOCK_SIZE);
+
+    // Plein: le producteur ne prend que la place libre
+    ring.reset();
+    TEST_ASSERT_EQUAL_UINT32(ring.capacity(), ring.write(image.data(), image.size()));
+    TEST_ASSERT_EQUAL_UINT32(0, ring.write(image.data(), 1));
+    TEST_ASSERT_EQUAL_UINT32(ring.capacity(), ring.highWater());
+}
+
+// Flash en flux: le producteur livre 4 KiB dès qu'il y a de la place dans l'anneau
+static void streamFlash(BootloaderSim& sim, const std::vector<uint8_t>& image, bool keep, uint32_t& sent) {
+    startFlashProcess();
+    TEST_ASSERT_TRUE(runFlasher(sim));
+    TEST_ASSERT_TRUE(startStreamFlash(image.size(), keep));
+    // Un second flux ne remet pas à zéro l'anneau en cours de lecture
+    TEST_ASSERT_FALSE(startStreamFlash(image.size(), keep));
+    sent = 0;
+    uint64_t deadline = hostClockUs + 60000000ull;
+    while (rp2040Flasher.busy() && hostClockUs < deadline) {
+        uint32_t chunk = image.size() - sent < 4096 ? image.size() - sent : 4096;
+        if (chunk && streamImage.acceptChunk(sent, chunk) == 200) {
+            sent += streamImage.write(image.data() + sent, chunk);
+        }
+        handleFlasher();
+        uint64_t step = hostClockUs + 1000;
+        uint64_t next = sim.nextEventUs();
+        hostClockAdvance((next && next < step ? next : step) - hostClockUs);
+    }
+}
+
+static void test_stream_flash() {
+    BootloaderSim sim;
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(200 * 1024 + 7, 12);
+    uint32_t sent = 0;
+    streamFlash(sim, image, false, sent);
+    TEST_ASSERT_TRUE_MESSAGE(events.saw("EVENT:FLASH_COMPLETE"), events.firstError().c_str());
+    TEST_ASSERT_EQUAL_UINT32(image.size(), sent);
+    assertFlashed(sim, image);
+}
+
+// Pages vides sautées au milieu des blocs: le flasheur relit une partie du
+// flux, la copie gardée doit rester complète
+static void test_stream_flash_keep_blank_pages() {
+    BootloaderSim sim;
+    attach(sim);
+    std::vector<uint8_t> image = makeImage(96 * 1024 + 5, 24);
+    memset(image.data() + 256, 0xFF, 512);
+    memset(image.data() + 20 * 1024 + 768, 0xFF, 256);
+    memset(image.data() + 40 * 1024, 0xFF, 6 * 1024 + 256);
+    uint32_t sent = 0;
+    streamFlash(sim, image, true, sent);
+    TEST_ASSERT_TRUE_MESSAGE(events.saw("EVENT:FLASH_COMPLETE"), events.firstError().c_str());
+    TEST_ASSERT_EQUAL_UINT32(image.size(), sent);
+    assertFlashed(sim, image);
+    TEST_ASSERT_TRUE(sim.writtenBytes < image.size());
+
+    TEST_ASSERT_EQUAL_STRING(sha256Of(image).c_str(), firmwareCacheSelected().c_str());
+    TEST_ASSERT_TRUE(*LittleFS.contents(firmwareImagePath().c_str()) == image);
+    ImageDigest digest;
+    TEST_ASSERT_TRUE(imageDigestLoad(firmwareImagePath().c_str(), digest));
+    TEST_ASSERT_EQUAL_STRING(sha256Of(image).c_str(), sha256Hex(digest.sha256).c_str());
+    TEST_ASSERT_EQUAL_HEX32(crcOf(image.data(), image.size()), digest.crc32);
+    firmwareCacheSelect(nullptr);
+}
+
+// Image compressée depuis LittleFS, avec un bloc corrompu et un effacement
+// en erreur: les reprises relisent la sortie de l'inflateur
+static void test_compressed_flash() {
+    SimConfig config;
+    config.faults.push_back({ CMD_WRITE, 5, SIM_FAULT_CORRUPT });
+    config.faults.push_back({ CMD_ERASE, 3, SIM_FAULT_ERR });
+    BootloaderSim sim(config);
+    attach(sim);
+    std::vector<uint8_t> image = makeCompressibleImage(200 * 1024 + 33, 27);
+    std::vector<uint8_t> compressed = compressImage(image, COMPRESSION_ZLIB);
+    TEST_ASSERT_TRUE(compressed.size() < image.size() * 3 / 4);
+    storeFirmware(compressed);
+    TEST_ASSERT_TRUE_MESSAGE(syncAndFlash(sim), events.firstError().c_str());
+    assertFlashed(sim, image);
+    TEST_ASSERT_TRUE(events.saw("log:Image compressée: "));
+    const FlashRun& run = rp2040Flasher.run();
+    TEST_ASSERT_EQUAL_UINT32(1, run.retries[RETRY_BLOCK_CRC]);
+    TEST_ASSERT_EQUAL_UINT32(1, run.retries[RETRY_ERASE]);
+}
+
+// En flux, l'inflateur ne peut pas repartir du début: le repli du pipeline
+// doit retrouver ses données dans le dictionnaire
+static void test_compressed_stream_flash() {
+    SimConfig config;
+    config.faults.push_back({ CMD_WRITE, 30, SIM_FAULT_ERR });
+    BootloaderSim sim(config);
+    attach(sim);
+    std::vector<uint8_t> image = makeCompressibleImage(160 * 1024 + 5, 28);
+    std::vector<uint8_t> compressed = compressImage(image, COMPRESSION_DEFLATE_RAW);
+    uint32_t sent = 0;
+    streamFlash(sim, compressed, false, sent);
+    TEST_ASSERT_TRUE_MESSAGE(events.saw("EVENT:FLASH_COMPLETE"), events.firstError().c_str());
+    TEST_ASSERT_EQUAL_UINT32(compressed.size(), sent);
+    assertFlashed(sim, image);
+    TEST_ASSERT_EQUAL_UINT32(1, rp2040Flasher.run().retries[RETRY_PIPELINE]);
+}
+
+static void test_compressed_corrupted() {
+    BootloaderSim sim;
+    attach(sim);
+    std::vector<uint8_t> image = makeCompressibleImage(64 * 1024, 29);
+    std::vector<uint8_t> compressed = compressImage(image, COMPRESSION_ZLIB);
+    for (size_t i = compressed.size() / 2; i < compressed.size() / 2 + 8; ++i) {
+        compressed[i] ^= 0xA5;
+    }
+    storeFirmware(compressed);
+    TEST_ASSERT_FALSE(syncAndFlash(sim));
+    TEST_ASSERT_FALSE(events.firstError().empty());
+    TEST_ASSERT_FALSE(sim.sealed);
+}
+
+// Source en mémoire, relisible ou non
+class MemorySource : public ImageSource {
+    public:
+        MemorySource(const std::vector<uint8_t>& data, bool canSeek) : data(data), canSeek(canSeek) {}
+        uint32_t size() override { return data.size(); }
+        uint32_t available(uint32_t offset) override { return offset < data.size() ? data.size() - offset : 0; }
+        int read(uint32_t offset, uint8_t* buffer, uint32_t length) override {
+            length = std::min<uint32_t>(length, available(offset));
+            memcpy(buffer, data.data() + offset, length);
+            return length;
+        }
+        bool seekable() override { return canSeek; }
+
+    private:
+        const std::vector<uint8_t>& data;
+        bool canSeek;
+};
+
+// Lecture par blocs comme le flasheur, avec une reprise au dernier secteur
+// libéré tous les 24 KiB
+static void readInflated(InflateImageSource& source, const std::vector<uint8_t>& image) {
+    std::vector<uint8_t> block(4096);
+    uint32_t offset = 0;
+    uint32_t rewound = 0;
+    while (offset < image.size()) {
+        uint32_t wanted = std::min<uint32_t>(block.size() - offset % 256, image.size() - offset);
+        TEST_ASSERT_TRUE(source.available(offset) >= wanted);
+        TEST_ASSERT_EQUAL_INT(wanted, source.read(offset, block.data(), wanted));
+        TEST_ASSERT_EQUAL_MEMORY(image.data() + offset, block.data(), wanted);
+        offset += wanted;
+        uint32_t released = offset > 12 * 1024 ? (offset - 12 * 1024) & ~4095u : 0;
+        source.release(released);
+        if (offset >= rewound + 24 * 1024 && offset < image.size()) {
+            rewound = offset;
+            offset = released;
+        }
+    }
+}
+
+// Au-delà du dictionnaire, une source relisible est redécompressée depuis le
+// début (restart()); un flux garde dans le dictionnaire tout ce qui n'est pas
+// libéré
+static void test_inflate_rewind() {
+    std::vector<uint8_t> image = makeCompressibleImage(100 * 1024 + 77, 30);
+    std::vector<uint8_t> compressed = compressImage(image, COMPRESSION_ZLIB);
+    CompressedImageHeader header;
+    std::vector<uint8_t> block(4096);
+
+    MemorySource file(compressed, true);
+    TEST_ASSERT_TRUE(readCompressedHeader(&file, &header));
+    InflateImageSource inflate;
+    TEST_ASSERT_TRUE(inflate.open(&file, header));
+    readInflated(inflate, image);
+    TEST_ASSERT_EQUAL_INT(block.size(), inflate.read(1024, block.data(), block.size()));
+    TEST_ASSERT_EQUAL_MEMORY(image.data() + 1024, block.data(), block.size());
+    uint32_t crc = 0;
+    TEST_ASSERT_TRUE(inflate.expectedCrc(&crc));
+    TEST_ASSERT_EQUAL_HEX32(crcOf(image.data(), image.size()), crc);
+    inflate.close();
+
+    MemorySource stream(compressed, false);
+    TEST_ASSERT_TRUE(inflate.open(&stream, header));
+    readInflated(inflate, image);
+    TEST_ASSERT_EQUAL_INT(-1, inflate.read(1024, block.data(), block.size()));
+    inflate.close();
+}
+
+class RecordingEvents : public FlasherEvents {
+    public:
+        void flasherMessage(const String& message) override {
+            if (message.startsWith("error:") && error.empty()) {
+                error = message.s;
+            }
+            complete |= message == "EVENT:FLASH_COMPLETE";
+        }
+        void flasherSynced() override {
+            synced = true;
+        }
+        std::string error;
+        bool synced = false;
+        bool complete = false;
+};
+
+// Deux RP2040 flashés en même temps par deux instances, l'une sur un UART,
+// l'autre sur un simple Stream (débit fixe)
+static void test_two_engines() {
+    SimConfig config;
+    config.supportsBaud = true;
+    BootloaderSim simA(config);
+    BootloaderSim simB(config);
+    HardwareSerial portA;
+    HardwareSerial portB;
+    portA.attach(&simA);
+    portB.attach(&simB);
+    portA.begin(RP2040_SERIAL_BAUD);
+    portB.begin(RP2040_SERIAL_BAUD);
+    RecordingEvents eventsA;
+    RecordingEvents eventsB;
+    FlasherEngine engineA(portA, eventsA);
+    FlasherEngine engineB((Stream&)portB, eventsB);
+
+    std::vector<uint8_t> imageA = makeImage(96 * 1024 + 3, 13);
+    std::vector<uint8_t> imageB = makeImage(40 * 1024, 14);
+    File f = LittleFS.open("/a.bin", "w");
+    f.write(imageA.data(), imageA.size());
+    f.close();
+    f = LittleFS.open("/b.bin", "w");
+    f.write(imageB.data(), imageB.size());
+    f.close();
+    FileImageSource sourceA;
+    FileImageSource sourceB;
+    TEST_ASSERT_TRUE(sourceA.open("/a.bin"));
+    TEST_ASSERT_TRUE(sourceB.open("/b.bin"));
+
+    engineA.start();
+    engineB.start();
+    uint64_t deadline = hostClockUs + 60000000ull;
+    bool flashing = false;
+    while ((engineA.busy() || engineB.busy()) && hostClockUs < deadline) {
+        engineA.loop();
+        engineB.loop();
+        if (!flashing && !engineA.busy() && !engineB.busy()) {
+            // Les deux sont synchronisés: même départ pour le flash
+            flashing = true;
+            engineA.setSource(&sourceA);
+            engineB.setSource(&sourceB);
+            engineA.start(SEND_INFO_COMMAND);
+            engineB.start(SEND_INFO_COMMAND);
+        }
+        uint64_t step = hostClockUs + 1000;
+        uint64_t nextA = simA.nextEventUs();
+        uint64_t nextB = simB.nextEventUs();
+        if (nextA && nextA < step) {
+            step = nextA;
+        }
+        if (nextB && nextB < step) {
+            step = nextB;
+        }
+        hostClockAdvance(step - hostClockUs);
+    }
+    TEST_ASSERT_TRUE(eventsA.synced && eventsB.synced);
+    TEST_ASSERT_TRUE_MESSAGE(eventsA.complete, eventsA.error.c_str());
+    TEST_ASSERT_TRUE_MESSAGE(eventsB.complete, eventsB.error.c_str());
+    assertFlashed(simA, imageA);
+    assertFlashed(simB, imageB);
+    TEST_ASSERT_EQUAL_UINT32(3000000, simA.deviceBaud);
+    TEST_ASSERT_EQUAL_UINT32(RP2040_SERIAL_BAUD, simB.deviceBaud);
+    TEST_ASSERT_EQUAL_UINT32(1, engineB.rtt(RTT_SEAL).count);
+}
+
+static void test_throughput() {
+    static const uint32_t bauds[] = { 921600, 1500000, 3000000 };
+    for (uint32_t baud : bauds) {
+        SimConfig config;
+        config.supportsBaud = baud != RP2040_SERIAL_BAUD;
+        config.maxBaud = baud;
+        BootloaderSim sim(config);
+        attach(sim);
+        std::vector<uint8_t> image = makeImage(1024 * 1024, baud);
+        storeFirmware(image);
+        events.messages.clear();
+        uint32_t ms = syncAndFlash(sim);
+        TEST_ASSERT_TRUE_MESSAGE(ms, events.firstError().c_str());
+        char name[32];
+        snprintf(name, sizeof(name), "1 MiB, UART %u", baud);
+        report(name, image.size(), ms);
+    }
+}
+
+static int runAll() {
+    UNITY_BEGIN();
+    RUN_TEST(test_full_flash);
+    RUN_TEST(test_baud_escalation);
+    RUN_TEST(test_differential);
+    RUN_TEST(test_differential_without_crc);
+    RUN_TEST(test_blank_pages_skipped);
+    RUN_TEST(test_uf2_sparse);
+    RUN_TEST(test_write_error_falls_back);
+    RUN_TEST(test_write_timeout_falls_back);
+    RUN_TEST(test_rx_overrun_recovered);
+    RUN_TEST(test_corrupted_write_retransmitted);
+    RUN_TEST(test_resume_after_interruption);
+    RUN_TEST(test_write_block_sizing);
+    RUN_TEST(test_invalid_image_rejected);
+    RUN_TEST(test_firmware_cache);
+    RUN_TEST(test_staging_writer);
+    RUN_TEST(test_byte_ring);
+    RUN_TEST(test_stream_flash);
+    RUN_TEST(test_stream_flash_keep_blank_pages);
+    RUN_TEST(test_compressed_flash);
+    RUN_TEST(test_compressed_stream_flash);
+    RUN_TEST(test_compressed_corrupted);
+    RUN_TEST(test_inflate_rewind);
+    RUN_TEST(test_two_engines);
+    RUN_TEST(test_throughput);
+    return UNITY_END();
+}
+
+int main() {
+    return runAll();
+}